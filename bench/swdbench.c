@@ -0,0 +1,326 @@
+//
+// swdbench.c
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gpiospi.h"
+#include "gpiotrace.h"
+#include "swdloader.h"
+#include "swdregs.h"
+
+#define RAM_BASE 0x20000000u
+#define MAX_SETTINGS 16
+
+static const char* s_pSPIDevice; // -s
+
+static const char* s_DefaultImages[] = {BENCH_IMAGE_DIR "/rndtest.bin",
+                                        BENCH_IMAGE_DIR "/uart.bin"};
+
+static unsigned ParseList(const char* pList, unsigned* pValues) {
+    unsigned nCount = 0;
+    while (*pList && nCount < MAX_SETTINGS) {
+        char* pEnd;
+        pValues[nCount++] = strtoul(pList, &pEnd, 0);
+        if (*pEnd != ',')
+            break;
+        pList = pEnd + 1;
+    }
+    return nCount;
+}
+
+static void* ReadImage(const char* pName, size_t* pnSize) {
+    int fd = open(pName, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    struct stat st;
+    fstat(fd, &st);
+    size_t nSize = (st.st_size + 3) & ~3;
+    char* pImage = calloc(1, nSize ? nSize : 4);
+    if (pImage && read(fd, pImage, st.st_size) != st.st_size) {
+        free(pImage);
+        pImage = 0;
+    }
+    close(fd);
+    *pnSize = nSize;
+    return pImage;
+}
+
+// One SWDLoadChunk() run on a freshly initialised link. Every run writes a
+// record, one without a connection has only the settings and "ok": false.
+static int Bench(FILE* pOut, int bFirst, const char* pName, const void* pImage,
+                 size_t nSize, unsigned nClockPin, unsigned nDataPin,
+                 unsigned nResetPin, unsigned nKHz, unsigned nBlockSize,
+                 int bStream) {
+    struct CSWDLoader loader;
+    struct CGPIOSPI spi;
+    int bSPI = 0;
+    if (!SWDInitialise(&loader, nClockPin, nDataPin, nResetPin, nKHz) ||
+        (s_pSPIDevice && !(bSPI = SPIOpen(&spi, s_pSPIDevice, nClockPin,
+                                          nDataPin, nKHz * 1000))) ||
+        !SWDHalt(&loader)) {
+        if (bSPI)
+            SPIClose(&spi);
+        SWDDeInitialise(&loader);
+        fprintf(pOut,
+                "%s    {\"image\": \"%s\", \"bytes\": %zu, \"clock_khz\": %u, "
+                "\"block_size\": %u, \"stream\": %s, \"ok\": false,\n"
+                "     \"error\": \"no connection\"}",
+                bFirst ? "" : ",\n", pName, nSize, nKHz, nBlockSize,
+                bStream ? "true" : "false");
+        return 0;
+    }
+    if (bSPI)
+        loader.m_pSPI = &spi;
+    loader.m_nBlockSize = nBlockSize;
+    loader.m_bStreamWrites = bStream;
+    loader.m_nTransactions = 0;
+    struct TGPIOStats before = g_GPIOStats;
+    TimingStart(&loader.m_Timing);
+    uint64_t nStart = TimingNow();
+    int bOK = SWDLoadChunk(&loader, pImage, nSize, RAM_BASE);
+    double fSeconds = (TimingNow() - nStart) / 1e9;
+    double fAchieved = TimingAchievedKHz(&loader.m_Timing);
+    uint64_t nBits = loader.m_Timing.m_nHalfPeriods / 2;
+    uint64_t nTransactions = loader.m_nTransactions;
+    if (bSPI)
+        SPIClose(&spi);
+    SWDDeInitialise(&loader);
+    uint64_t nGPIOCalls = g_GPIOStats.m_nWrites + g_GPIOStats.m_nReads +
+                          g_GPIOStats.m_nModeChanges - before.m_nWrites -
+                          before.m_nReads - before.m_nModeChanges;
+    uint64_t nKernelCalls =
+        g_GPIOStats.m_nKernelCalls - before.m_nKernelCalls;
+    fprintf(pOut,
+            "%s    {\"image\": \"%s\", \"bytes\": %zu, \"clock_khz\": %u, "
+            "\"block_size\": %u, \"stream\": %s, \"ok\": %s, "
+            "\"seconds\": %.6f,\n"
+            "     \"kbytes_per_s\": %.2f, \"bits_per_s\": %.0f, "
+            "\"transactions_per_s\": %.0f, \"achieved_clock_khz\": %.1f,\n"
+            "     \"gpio_calls_per_transaction\": %.2f, "
+            "\"kernel_calls_per_transaction\": %.2f}",
+            bFirst ? "" : ",\n", pName, nSize, nKHz, nBlockSize,
+            bStream ? "true" : "false", bOK ? "true" : "false", fSeconds,
+            nSize / fSeconds / 1024.0, nBits / fSeconds,
+            nTransactions / fSeconds, fAchieved,
+            nTransactions ? (double)nGPIOCalls / nTransactions : 0.0,
+            nTransactions ? (double)nKernelCalls / nTransactions : 0.0);
+    return bOK;
+}
+
+// Replay a transaction log (swdloader --trace) on a freshly initialised
+// link. The line sequences before a TARGETSEL are not in the log, it
+// becomes a connection check, as after the reset that preceded it.
+static int Replay(FILE* pOut, int bFirst, const char* pLog,
+                  const struct TGPIOTraceRecord* pRecords, long nRecords,
+                  unsigned nClockPin, unsigned nDataPin, unsigned nResetPin,
+                  unsigned nKHz) {
+    struct CSWDLoader loader;
+    if (!SWDInitialise(&loader, nClockPin, nDataPin, nResetPin, nKHz)) {
+        SWDDeInitialise(&loader);
+        fprintf(pOut,
+                "%s    {\"log\": \"%s\", \"records\": %ld, \"clock_khz\": %u, "
+                "\"ok\": false,\n"
+                "     \"error\": \"no connection\"}",
+                bFirst ? "" : ",\n", pLog, nRecords, nKHz);
+        return 0;
+    }
+    uint64_t nAckMismatches = 0, nDataMismatches = 0, nReconnects = 0;
+    loader.m_nTransactions = 0;
+    TimingStart(&loader.m_Timing);
+    uint64_t nStart = TimingNow();
+    for (long i = 0; i < nRecords; i++) {
+        const struct TGPIOTraceRecord* record = &pRecords[i];
+        if (record->m_uchType != GPIOTraceRequest)
+            continue;
+        if (record->m_uchPin == WR_DP_TARGETSEL) {
+            if (!SWDCheckConnection(&loader))
+                nAckMismatches++;
+            nReconnects++;
+            continue;
+        }
+        uint32_t nData = record->m_nData;
+        unsigned nAck = SWDTransfer(&loader, record->m_uchPin, &nData);
+        if (record->m_uchValue == GPIO_TRACE_NO_ACK)
+            continue; // streamed, the target was not asked then
+        if (nAck != record->m_uchValue)
+            nAckMismatches++;
+        else if (nAck == DP_OK && (record->m_uchPin & 0x04) && // RnW
+                 nData != record->m_nData)
+            nDataMismatches++;
+    }
+    double fSeconds = (TimingNow() - nStart) / 1e9;
+    double fAchieved = TimingAchievedKHz(&loader.m_Timing);
+    uint64_t nTransactions = loader.m_nTransactions;
+    SWDDeInitialise(&loader);
+    int bOK = !nAckMismatches && !nDataMismatches;
+    fprintf(pOut,
+            "%s    {\"log\": \"%s\", \"records\": %ld, \"clock_khz\": %u, "
+            "\"ok\": %s, \"seconds\": %.6f,\n"
+            "     \"transactions_per_s\": %.0f, \"achieved_clock_khz\": %.1f, "
+            "\"reconnects\": %llu,\n"
+            "     \"ack_mismatches\": %llu, \"data_mismatches\": %llu}",
+            bFirst ? "" : ",\n", pLog, nRecords, nKHz,
+            bOK ? "true" : "false", fSeconds, nTransactions / fSeconds,
+            fAchieved, (unsigned long long)nReconnects,
+            (unsigned long long)nAckMismatches,
+            (unsigned long long)nDataMismatches);
+    return bOK;
+}
+
+int main(int ac, char* av[]) {
+    unsigned nDataPin = SWDIO_GPIO, nClockPin = SWCLK_GPIO,
+             nResetPin = SWRST_GPIO;
+    unsigned Clocks[MAX_SETTINGS] = {500, 1000, 4000}, nClocks = 3;
+    unsigned Blocks[MAX_SETTINGS] = {256, 1024}, nBlocks = 2;
+    const char* pOutName = "swdbench.json";
+    const char* pLog = 0;
+    int bStream = 1;
+    int opt;
+    while ((opt = getopt(ac, av, "d:c:r:f:b:o:at:s:")) != -1) {
+        switch (opt) {
+        case 'd':
+            nDataPin = atoi(optarg);
+            break;
+        case 'c':
+            nClockPin = atoi(optarg);
+            break;
+        case 'r':
+            nResetPin = atoi(optarg);
+            break;
+        case 'f':
+            nClocks = ParseList(optarg, Clocks);
+            break;
+        case 'b':
+            nBlocks = ParseList(optarg, Blocks);
+            break;
+        case 'o':
+            pOutName = optarg;
+            break;
+        case 'a':
+            bStream = 0;
+            break;
+        case 't':
+            pLog = optarg;
+            break;
+        case 's':
+            s_pSPIDevice = optarg;
+            break;
+        default:
+            fprintf(stderr,
+                    "Usage: swdbench [-d n] [-c n] [-r n] [-f kHz,...] "
+                    "[-b bytes,...] [-o file] [-a] [-s dev]\n"
+                    "                [image_file_name ...]\n"
+                    "       swdbench [-d n] [-c n] [-r n] [-f kHz,...] "
+                    "[-o file] -t log\n"
+                    " -f    SWD clock frequencies (default 500,1000,4000)\n"
+                    " -b    block sizes, must divide 1024 (default 256,1024)\n"
+                    " -o    JSON result file (default swdbench.json)\n"
+                    " -a    check the ACK of every write, no streaming\n"
+                    " -s    shift the blocks through spidev device dev\n"
+                    " -t    replay a transaction log (swdloader --trace) "
+                    "and count\n"
+                    "       responses that differ from the recorded ones\n");
+            exit(-1);
+        }
+    }
+    for (unsigned i = 0; i < nClocks; i++)
+        if (!Clocks[i] || Clocks[i] > TIMING_MAX_KHZ) {
+            fprintf(stderr, "Clock %u KHz is out of range (1-%u)\n",
+                    Clocks[i], TIMING_MAX_KHZ);
+            exit(-1);
+        }
+    for (unsigned i = 0; i < nBlocks; i++)
+        if (!Blocks[i] || (1024 % Blocks[i]) || (Blocks[i] & 3)) {
+            fprintf(stderr, "Block size %u does not divide 1024\n", Blocks[i]);
+            exit(-1);
+        }
+    const char** ppImages = s_DefaultImages;
+    int nImages = sizeof(s_DefaultImages) / sizeof(s_DefaultImages[0]);
+    if (optind < ac) {
+        ppImages = (const char**)&av[optind];
+        nImages = ac - optind;
+    }
+#if defined(USE_SIMGPIO)
+    SimTargetAttach(nClockPin, nDataPin, nResetPin, SIM_TARGETSEL_CORE0);
+#else
+    if (geteuid() != 0) {
+        fprintf(stderr, "swdbench needs root\n");
+        exit(-1);
+    }
+#endif
+#if defined(USE_LIBPIGPIO)
+    int cfg = gpioCfgGetInternals();
+    cfg |= PI_CFG_NOSIGHANDLER;
+    gpioCfgSetInternals(cfg);
+    if (gpioInitialise() < 0) {
+        fprintf(stderr, "Pigpio initialization failed!\n");
+        exit(-1);
+    }
+#endif
+    FILE* pOut = fopen(pOutName, "w");
+    if (!pOut) {
+        fprintf(stderr, "Can't create %s\n", pOutName);
+        exit(-1);
+    }
+    fprintf(pOut, "{\"backend\": \"%s\", \"results\": [\n", GPIO_BACKEND);
+    int rc = 0, bFirst = 1;
+    if (pLog) {
+        struct TGPIOTraceRecord* pRecords;
+        long nRecords = GPIOTraceReadLog(pLog, &pRecords);
+        if (nRecords < 0)
+            rc = -1;
+        for (unsigned f = 0; nRecords >= 0 && f < nClocks; f++) {
+            if (!Replay(pOut, bFirst, pLog, pRecords, nRecords, nClockPin,
+                        nDataPin, nResetPin, Clocks[f]))
+                rc = -1;
+            bFirst = 0;
+        }
+        if (nRecords >= 0)
+            free(pRecords);
+        nImages = 0;
+    }
+    for (int i = 0; i < nImages; i++) {
+        size_t nSize;
+        void* pImage = ReadImage(ppImages[i], &nSize);
+        if (!pImage) {
+            fprintf(stderr, "Can't read %s\n", ppImages[i]);
+            rc = -1;
+            continue;
+        }
+        const char* pName = strrchr(ppImages[i], '/');
+        pName = pName ? pName + 1 : ppImages[i];
+        for (unsigned f = 0; f < nClocks; f++)
+            for (unsigned b = 0; b < nBlocks; b++) {
+                if (!Bench(pOut, bFirst, pName, pImage, nSize, nClockPin,
+                           nDataPin, nResetPin, Clocks[f], Blocks[b], bStream))
+                    rc = -1;
+                bFirst = 0;
+            }
+        free(pImage);
+    }
+    fprintf(pOut, "\n]}\n");
+    fclose(pOut);
+#if defined(USE_LIBPIGPIO)
+    gpioTerminate();
+#endif
+    printf("\nResults written to %s\n", pOutName);
+    return rc;
+}
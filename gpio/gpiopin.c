@@ -17,12 +17,36 @@
 #include <assert.h>
 #include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
+#if defined(USE_GPIOMEM)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include "gpiopin.h"
+#include "gpiotrace.h"
 
 #define CONSUMER "SWD"
 #define PICO_GPIO_PINS 32
 
+struct TGPIOStats g_GPIOStats;
+
+// Bulk accesses are traced as one event per pin, all at the same time
+#if defined(USE_GPIOTRACE)
+static inline void TracePins(unsigned nType, struct CGPIOPin** ppPins,
+                             unsigned nCount, uint32_t nLevels) {
+    uint64_t nNanos = GPIOTraceNow();
+    for (unsigned i = 0; i < nCount; i++)
+        GPIOTraceAdd(&g_GPIOTrace.m_Pins, nNanos, nType, ppPins[i]->m_nPin,
+                     (nLevels >> i) & 1, 0);
+}
+#define GPIO_TRACE_PINS(nType, ppPins, nCount, nLevels)                    \
+    TracePins(nType, ppPins, nCount, nLevels)
+#else
+#define GPIO_TRACE_PINS(nType, ppPins, nCount, nLevels) ((void)0)
+#endif
+
 static void AssignPin(struct CGPIOPin* pin, unsigned nPin);
 
 void InitPin(struct CGPIOPin* pin, unsigned nPin, enum TGPIOMode Mode) {
@@ -32,6 +56,76 @@ void InitPin(struct CGPIOPin* pin, unsigned nPin, enum TGPIOMode Mode) {
     SetModePin(pin, Mode, 1);
 }
 
+#if !defined(USE_LIBGPIOD)
+
+void InitPins(struct CGPIOPin** ppPins, const unsigned* pPinNumbers,
+              unsigned nCount, enum TGPIOMode Mode) {
+    for (unsigned i = 0; i < nCount; i++)
+        InitPin(ppPins[i], pPinNumbers[i], Mode);
+}
+
+void SetModePins(struct CGPIOPin** ppPins, unsigned nCount,
+                 enum TGPIOMode Mode) {
+    for (unsigned i = 0; i < nCount; i++)
+        SetModePin(ppPins[i], Mode, 0);
+}
+
+#endif
+
+#if defined(USE_SIMGPIO)
+
+void WritePins(struct CGPIOPin** ppPins, unsigned nCount, uint32_t nLevels) {
+    assert(nCount <= GPIO_MAX_PINSET);
+    for (unsigned i = 0; i < nCount; i++)
+        WritePin(ppPins[i], (nLevels >> i) & 1);
+}
+
+uint32_t ReadPins(struct CGPIOPin** ppPins, unsigned nCount) {
+    assert(nCount <= GPIO_MAX_PINSET);
+    uint32_t nLevels = 0;
+    for (unsigned i = 0; i < nCount; i++)
+        nLevels |= ReadPin(ppPins[i]) << i;
+    return nLevels;
+}
+
+#endif
+
+#if !defined(USE_GPIOMEM)
+
+void PlayWave(struct CGPIOPin* pClock, struct CGPIOPin* pData,
+              const uint8_t* pSteps, size_t nSteps, uint32_t* pSamples,
+              void (*pDelay)(void* pParam), void* pParam) {
+    unsigned nSample = 0;
+    int nLevel = -1;
+    for (size_t i = 0; i < nSteps; i++) {
+        uint8_t uchStep = pSteps[i];
+        if (uchStep & WAVE_INPUT) {
+            SetModePin(pData, GPIOModeInputPullUp, 0);
+            nLevel = -1;
+        } else {
+            SetModePin(pData, GPIOModeOutput, 0);
+            // each write may be a system call, skip the redundant ones
+            if ((uchStep & WAVE_DATA) != nLevel) {
+                nLevel = uchStep & WAVE_DATA;
+                WritePin(pData, nLevel);
+            }
+        }
+        if (uchStep & WAVE_SAMPLE) {
+            uint32_t nMask = 1U << (nSample & 31);
+            if (ReadPin(pData))
+                pSamples[nSample / 32] |= nMask;
+            else
+                pSamples[nSample / 32] &= ~nMask;
+            nSample++;
+        }
+        WritePin(pClock, (uchStep & WAVE_CLOCK) ? HIGH : LOW);
+        if (pDelay)
+            pDelay(pParam);
+    }
+}
+
+#endif
+
 #if defined(USE_LIBPIGPIO)
 
 void DeInitPin(struct CGPIOPin* pin) {
@@ -47,6 +141,8 @@ void SetModePin(struct CGPIOPin* pin, enum TGPIOMode Mode, int bInitPin) {
     assert(Mode < GPIOModeUnknown);
     if (Mode == pin->m_Mode && !bInitPin)
         return;
+    GPIO_STATS_ADD(m_nModeChanges, 1);
+    GPIO_TRACE_PIN(GPIOTraceMode, pin->m_nPin, Mode == GPIOModeOutput);
     // on the fly direction change not supported!!!
     pin->m_Mode = Mode;
     int r;
@@ -87,90 +183,700 @@ void WritePin(struct CGPIOPin* pin, unsigned nValue) {
     assert(nPin && (nPin < PICO_GPIO_PINS));
     assert(pin->m_Mode < GPIOModeUnknown);
     assert(nValue == LOW || nValue == HIGH);
+    GPIO_STATS_ADD(m_nWrites, 1);
+    GPIO_TRACE_PIN(GPIOTraceWrite, pin->m_nPin, nValue);
     int r = gpioWrite(pin->m_nPin, nValue);
     assert(r >= 0);
 }
 
 unsigned ReadPin(struct CGPIOPin* pin) {
+    GPIO_STATS_ADD(m_nReads, 1);
     assert(nPin && (nPin < PICO_GPIO_PINS));
     assert(pin->m_Mode == GPIOModeInputPullUp ||
            pin->m_Mode == GPIOModeInputPullNone);
     int r;
     r = gpioRead(pin->m_nPin);
     assert(r >= 0);
+    GPIO_TRACE_PIN(GPIOTraceRead, pin->m_nPin, r);
     return r;
 }
 
+// pigpio has bank 0 set/clear/level registers, all pins are below 32
+void WritePins(struct CGPIOPin** ppPins, unsigned nCount, uint32_t nLevels) {
+    assert(nCount <= GPIO_MAX_PINSET);
+    uint32_t nSet = 0, nClear = 0;
+    for (unsigned i = 0; i < nCount; i++) {
+        assert(ppPins[i]->m_Mode < GPIOModeUnknown);
+        if ((nLevels >> i) & 1)
+            nSet |= 1U << ppPins[i]->m_nPin;
+        else
+            nClear |= 1U << ppPins[i]->m_nPin;
+    }
+    GPIO_STATS_ADD(m_nWrites, 1);
+    GPIO_TRACE_PINS(GPIOTraceWrite, ppPins, nCount, nLevels);
+    if (nSet)
+        gpioWrite_Bits_0_31_Set(nSet);
+    if (nClear)
+        gpioWrite_Bits_0_31_Clear(nClear);
+}
+
+uint32_t ReadPins(struct CGPIOPin** ppPins, unsigned nCount) {
+    assert(nCount <= GPIO_MAX_PINSET);
+    GPIO_STATS_ADD(m_nReads, 1);
+    uint32_t nBank = gpioRead_Bits_0_31(), nLevels = 0;
+    for (unsigned i = 0; i < nCount; i++)
+        nLevels |= ((nBank >> ppPins[i]->m_nPin) & 1) << i;
+    GPIO_TRACE_PINS(GPIOTraceRead, ppPins, nCount, nLevels);
+    return nLevels;
+}
+
 #elif defined(USE_LIBGPIOD)
 
+#define GPIOD_GROUP_MAX_LINES 16
+
+struct CGPIOLineGroup {
+    struct gpiod_chip* m_Chip;
+    unsigned m_nCount;
+    unsigned m_nRefCount;
+#if defined(USE_LIBGPIOD_V2)
+    struct gpiod_line_request* m_Request;
+    struct gpiod_line_config* m_Config;
+    unsigned m_nOffsets[GPIOD_GROUP_MAX_LINES];
+    struct gpiod_line_settings* m_Settings[GPIOD_GROUP_MAX_LINES];
+#else
+    struct gpiod_line_bulk m_Bulk;
+#endif
+};
+
+// Find the chip a logical pin number belongs to
+static unsigned FindChip(unsigned* pnPin) {
+    unsigned dev = 0;
+    for (;;) {
+        char buf[32];
+        unsigned lines;
+#if defined(USE_LIBGPIOD_V2)
+        sprintf(buf, "/dev/gpiochip%d", (uint8_t)dev);
+        struct gpiod_chip* chip = gpiod_chip_open(buf);
+        assert(chip);
+        struct gpiod_chip_info* info = gpiod_chip_get_info(chip);
+        assert(info);
+        lines = gpiod_chip_info_get_num_lines(info);
+        gpiod_chip_info_free(info);
+#else
+        sprintf(buf, "gpiochip%d", (uint8_t)dev);
+        struct gpiod_chip* chip = gpiod_chip_open_by_name(buf);
+        assert(chip);
+        lines = gpiod_chip_num_lines(chip);
+#endif
+        gpiod_chip_close(chip);
+        if (*pnPin < lines)
+            return dev;
+        *pnPin -= lines;
+        dev++;
+    }
+}
+
+static struct gpiod_chip* OpenChip(unsigned dev) {
+    char buf[32];
+#if defined(USE_LIBGPIOD_V2)
+    sprintf(buf, "/dev/gpiochip%d", (uint8_t)dev);
+    struct gpiod_chip* chip = gpiod_chip_open(buf);
+#else
+    sprintf(buf, "gpiochip%d", (uint8_t)dev);
+    struct gpiod_chip* chip = gpiod_chip_open_by_name(buf);
+#endif
+    assert(chip);
+    return chip;
+}
+
+#if defined(USE_LIBGPIOD_V2)
+
+// Reconfiguring resubmits the settings of every line, an output's value in
+// them must be the one last written or the reconfiguration drives it back
+static void KeepOutputValue(struct CGPIOPin* pin) {
+    gpiod_line_settings_set_output_value(
+        pin->m_pGroup->m_Settings[pin->m_nIndex],
+        pin->m_nLastWrite ? GPIOD_LINE_VALUE_ACTIVE
+                          : GPIOD_LINE_VALUE_INACTIVE);
+}
+
+// The new line config replaces the old one entirely, so always resubmit
+// the settings of every line in the group
+static void ApplyGroupConfig(struct CGPIOLineGroup* group) {
+    gpiod_line_config_reset(group->m_Config);
+    for (unsigned i = 0; i < group->m_nCount; i++) {
+        int r = gpiod_line_config_add_line_settings(
+            group->m_Config, &group->m_nOffsets[i], 1, group->m_Settings[i]);
+        assert(r >= 0);
+    }
+    if (group->m_Request) {
+        int r = gpiod_line_request_reconfigure_lines(group->m_Request,
+                                                     group->m_Config);
+        assert(r >= 0);
+        return;
+    }
+    struct gpiod_request_config* req = gpiod_request_config_new();
+    assert(req);
+    gpiod_request_config_set_consumer(req, CONSUMER);
+    group->m_Request =
+        gpiod_chip_request_lines(group->m_Chip, req, group->m_Config);
+    gpiod_request_config_free(req);
+    assert(group->m_Request);
+}
+
+#endif
+
+// Request all lines once, as inputs. Direction changes are applied to the
+// held request so no line is ever released and requested again. A v1
+// request has a single direction for all its lines and addresses their
+// values by position, so there a group holds one line (see InitPins()).
+static struct CGPIOLineGroup* RequestGroup(unsigned dev,
+                                           struct CGPIOPin** ppPins,
+                                           unsigned nCount) {
+    assert(nCount && (nCount <= GPIOD_GROUP_MAX_LINES));
+    struct CGPIOLineGroup* group = calloc(1, sizeof(struct CGPIOLineGroup));
+    assert(group);
+    group->m_Chip = OpenChip(dev);
+    group->m_nCount = nCount;
+    group->m_nRefCount = nCount;
+#if defined(USE_LIBGPIOD_V2)
+    group->m_Config = gpiod_line_config_new();
+    assert(group->m_Config);
+#else
+    gpiod_line_bulk_init(&group->m_Bulk);
+#endif
+    for (unsigned i = 0; i < nCount; i++) {
+        struct CGPIOPin* pin = ppPins[i];
+        pin->m_pGroup = group;
+        pin->m_nIndex = i;
+#if defined(USE_LIBGPIOD_V2)
+        group->m_nOffsets[i] = pin->m_nPin;
+        group->m_Settings[i] = gpiod_line_settings_new();
+        assert(group->m_Settings[i]);
+        gpiod_line_settings_set_direction(group->m_Settings[i],
+                                          GPIOD_LINE_DIRECTION_INPUT);
+#else
+        pin->m_Line = gpiod_chip_get_line(group->m_Chip, pin->m_nPin);
+        assert(pin->m_Line);
+        gpiod_line_bulk_add(&group->m_Bulk, pin->m_Line);
+#endif
+    }
+#if defined(USE_LIBGPIOD_V2)
+    ApplyGroupConfig(group);
+#else
+    int r = gpiod_line_request_bulk_input(&group->m_Bulk, CONSUMER);
+    assert(r >= 0);
+#endif
+    return group;
+}
+
+void InitPins(struct CGPIOPin** ppPins, const unsigned* pPinNumbers,
+              unsigned nCount, enum TGPIOMode Mode) {
+    assert(nCount <= GPIOD_GROUP_MAX_LINES);
+#if defined(USE_LIBGPIOD_V2)
+    unsigned dev = 0;
+    for (unsigned i = 0; i < nCount; i++) {
+        struct CGPIOPin* pin = ppPins[i];
+        pin->m_nPin = pPinNumbers[i];
+        pin->m_Mode = GPIOModeUnknown;
+        unsigned nDev = FindChip(&pin->m_nPin);
+        if (i && (nDev != dev)) {
+            // lines on different chips can't share a request
+            for (unsigned j = 0; j < nCount; j++)
+                InitPin(ppPins[j], pPinNumbers[j], Mode);
+            return;
+        }
+        dev = nDev;
+    }
+    RequestGroup(dev, ppPins, nCount);
+    for (unsigned i = 0; i < nCount; i++)
+        SetModePin(ppPins[i], Mode, 1);
+#else
+    // SET_CONFIG would turn SWCLK around with SWDIO
+    for (unsigned i = 0; i < nCount; i++)
+        InitPin(ppPins[i], pPinNumbers[i], Mode);
+#endif
+}
+
 void DeInitPin(struct CGPIOPin* pin) {
     SetModePin(pin, GPIOModeInputPullNone, 1);
-    gpiod_line_release(pin->m_Line);
-    gpiod_chip_close(pin->m_Chip);
+    struct CGPIOLineGroup* group = pin->m_pGroup;
+    pin->m_pGroup = 0;
+    assert(group && group->m_nRefCount);
+    if (--group->m_nRefCount)
+        return;
+#if defined(USE_LIBGPIOD_V2)
+    gpiod_line_request_release(group->m_Request);
+    gpiod_line_config_free(group->m_Config);
+    for (unsigned i = 0; i < group->m_nCount; i++)
+        gpiod_line_settings_free(group->m_Settings[i]);
+#else
+    gpiod_line_release_bulk(&group->m_Bulk);
+#endif
+    gpiod_chip_close(group->m_Chip);
+    free(group);
 }
 
 void AssignPin(struct CGPIOPin* pin, unsigned nPin) {
     pin->m_nPin = nPin;
-    int dev = 0;
-    for (;;) {
-        char buf[16];
-        sprintf(buf, "gpiochip%d", (uint8_t)dev);
-        pin->m_Chip = gpiod_chip_open_by_name(buf);
-        assert(pin->m_Chip);
-        int lines = gpiod_chip_num_lines(pin->m_Chip);
-        if (pin->m_nPin < lines)
-            break;
-        gpiod_chip_close(pin->m_Chip);
-        pin->m_nPin -= lines;
-        dev++;
-    }
-    assert(pin->m_Chip);
-    pin->m_Line = gpiod_chip_get_line(pin->m_Chip, pin->m_nPin);
-    assert(pin->m_Line);
+    unsigned dev = FindChip(&pin->m_nPin);
+    RequestGroup(dev, &pin, 1);
 }
 
 void SetModePin(struct CGPIOPin* pin, enum TGPIOMode Mode, int bInitPin) {
     assert(Mode < GPIOModeUnknown);
     if (Mode == pin->m_Mode && !bInitPin)
         return;
-        // on the fly direction change not supported!!!
-    gpiod_line_release(pin->m_Line);
+    GPIO_STATS_ADD(m_nModeChanges, 1);
+    GPIO_TRACE_PIN(GPIOTraceMode, pin->m_nPin, Mode == GPIOModeOutput);
+    GPIO_STATS_ADD(m_nKernelCalls, 1);
     pin->m_Mode = Mode;
+    if (Mode == GPIOModeOutput && bInitPin)
+        pin->m_nLastWrite = LOW;
+#if defined(USE_LIBGPIOD_V2)
+    struct gpiod_line_settings* settings =
+        pin->m_pGroup->m_Settings[pin->m_nIndex];
+    gpiod_line_settings_set_direction(settings,
+                                      Mode == GPIOModeOutput
+                                          ? GPIOD_LINE_DIRECTION_OUTPUT
+                                          : GPIOD_LINE_DIRECTION_INPUT);
+    KeepOutputValue(pin);
+    ApplyGroupConfig(pin->m_pGroup);
+#else
     int r;
-    switch (Mode) {
-    case GPIOModeInputPullUp:
-    case GPIOModeInputPullNone:
-        r = gpiod_line_request_input(pin->m_Line, CONSUMER);
-        assert(r >= 0);
-        break;
-    case GPIOModeOutput:
-        if (bInitPin)
-            pin->m_nLastWrite = LOW;
-        r = gpiod_line_request_output(pin->m_Line, CONSUMER, pin->m_nLastWrite);
-        assert(r >= 0);
-        /* fall-through */
-    default:
-        break;
-    }
+    if (Mode == GPIOModeOutput)
+        r = gpiod_line_set_direction_output(pin->m_Line, pin->m_nLastWrite);
+    else
+        r = gpiod_line_set_direction_input(pin->m_Line);
+    assert(r >= 0);
+#endif
 }
 
 void WritePin(struct CGPIOPin* pin, unsigned nValue) {
     assert(pin->m_Mode < GPIOModeUnknown);
     assert(nValue == LOW || nValue == HIGH);
+    GPIO_STATS_ADD(m_nWrites, 1);
+    GPIO_TRACE_PIN(GPIOTraceWrite, pin->m_nPin, nValue);
     pin->m_nLastWrite = nValue;
+#if defined(USE_LIBGPIOD_V2)
+    KeepOutputValue(pin);
+#endif
     if (pin->m_Mode == GPIOModeOutput) {
+        GPIO_STATS_ADD(m_nKernelCalls, 1);
+#if defined(USE_LIBGPIOD_V2)
+        int r = gpiod_line_request_set_value(
+            pin->m_pGroup->m_Request, pin->m_nPin,
+            nValue ? GPIOD_LINE_VALUE_ACTIVE : GPIOD_LINE_VALUE_INACTIVE);
+#else
         int r = gpiod_line_set_value(pin->m_Line, nValue);
+#endif
         assert(r >= 0);
     }
 }
 
 unsigned ReadPin(struct CGPIOPin* pin) {
+    GPIO_STATS_ADD(m_nReads, 1);
+    GPIO_STATS_ADD(m_nKernelCalls, 1);
     assert(pin->m_Mode == GPIOModeInputPullUp ||
            pin->m_Mode == GPIOModeInputPullNone);
     int r;
+#if defined(USE_LIBGPIOD_V2)
+    r = gpiod_line_request_get_value(pin->m_pGroup->m_Request, pin->m_nPin);
+#else
     r = gpiod_line_get_value(pin->m_Line);
+#endif
     assert(r >= 0);
+    GPIO_TRACE_PIN(GPIOTraceRead, pin->m_nPin, r);
     return r;
 }
 
+// One request covers all pins of a set if they were initialised together
+static int SameGroup(struct CGPIOPin** ppPins, unsigned nCount) {
+    for (unsigned i = 1; i < nCount; i++)
+        if (ppPins[i]->m_pGroup != ppPins[0]->m_pGroup)
+            return 0;
+    return nCount != 0;
+}
+
+void SetModePins(struct CGPIOPin** ppPins, unsigned nCount,
+                 enum TGPIOMode Mode) {
+#if defined(USE_LIBGPIOD_V2)
+    // one reconfiguration for the whole set
+    if (SameGroup(ppPins, nCount)) {
+        int bChanged = 0;
+        for (unsigned i = 0; i < nCount; i++) {
+            struct CGPIOPin* pin = ppPins[i];
+            if (pin->m_Mode == Mode)
+                continue;
+            GPIO_STATS_ADD(m_nModeChanges, 1);
+            GPIO_TRACE_PIN(GPIOTraceMode, pin->m_nPin,
+                           Mode == GPIOModeOutput);
+            pin->m_Mode = Mode;
+            struct gpiod_line_settings* settings =
+                pin->m_pGroup->m_Settings[pin->m_nIndex];
+            gpiod_line_settings_set_direction(
+                settings, Mode == GPIOModeOutput ? GPIOD_LINE_DIRECTION_OUTPUT
+                                                 : GPIOD_LINE_DIRECTION_INPUT);
+            KeepOutputValue(pin);
+            bChanged = 1;
+        }
+        if (bChanged) {
+            GPIO_STATS_ADD(m_nKernelCalls, 1);
+            ApplyGroupConfig(ppPins[0]->m_pGroup);
+        }
+        return;
+    }
+#endif
+    for (unsigned i = 0; i < nCount; i++)
+        SetModePin(ppPins[i], Mode, 0);
+}
+
+void WritePins(struct CGPIOPin** ppPins, unsigned nCount, uint32_t nLevels) {
+    assert(nCount <= GPIO_MAX_PINSET);
+    int bBulk = SameGroup(ppPins, nCount);
+    for (unsigned i = 0; i < nCount; i++)
+        if (ppPins[i]->m_Mode != GPIOModeOutput)
+            bBulk = 0;
+    if (!bBulk) {
+        for (unsigned i = 0; i < nCount; i++)
+            WritePin(ppPins[i], (nLevels >> i) & 1);
+        return;
+    }
+    GPIO_STATS_ADD(m_nWrites, 1);
+    GPIO_STATS_ADD(m_nKernelCalls, 1);
+    GPIO_TRACE_PINS(GPIOTraceWrite, ppPins, nCount, nLevels);
+#if defined(USE_LIBGPIOD_V2)
+    unsigned nOffsets[GPIO_MAX_PINSET];
+    enum gpiod_line_value Values[GPIO_MAX_PINSET];
+    for (unsigned i = 0; i < nCount; i++) {
+        ppPins[i]->m_nLastWrite = (nLevels >> i) & 1;
+        KeepOutputValue(ppPins[i]);
+        nOffsets[i] = ppPins[i]->m_nPin;
+        Values[i] = ppPins[i]->m_nLastWrite ? GPIOD_LINE_VALUE_ACTIVE
+                                            : GPIOD_LINE_VALUE_INACTIVE;
+    }
+    int r = gpiod_line_request_set_values_subset(
+        ppPins[0]->m_pGroup->m_Request, nCount, nOffsets, Values);
+#else
+    struct gpiod_line_bulk bulk;
+    int Values[GPIO_MAX_PINSET];
+    gpiod_line_bulk_init(&bulk);
+    for (unsigned i = 0; i < nCount; i++) {
+        ppPins[i]->m_nLastWrite = (nLevels >> i) & 1;
+        gpiod_line_bulk_add(&bulk, ppPins[i]->m_Line);
+        Values[i] = ppPins[i]->m_nLastWrite;
+    }
+    int r = gpiod_line_set_value_bulk(&bulk, Values);
+#endif
+    assert(r >= 0);
+}
+
+uint32_t ReadPins(struct CGPIOPin** ppPins, unsigned nCount) {
+    assert(nCount <= GPIO_MAX_PINSET);
+    uint32_t nLevels = 0;
+    if (!SameGroup(ppPins, nCount)) {
+        for (unsigned i = 0; i < nCount; i++)
+            nLevels |= ReadPin(ppPins[i]) << i;
+        return nLevels;
+    }
+    GPIO_STATS_ADD(m_nReads, 1);
+    GPIO_STATS_ADD(m_nKernelCalls, 1);
+#if defined(USE_LIBGPIOD_V2)
+    unsigned nOffsets[GPIO_MAX_PINSET];
+    enum gpiod_line_value Values[GPIO_MAX_PINSET];
+    for (unsigned i = 0; i < nCount; i++)
+        nOffsets[i] = ppPins[i]->m_nPin;
+    int r = gpiod_line_request_get_values_subset(
+        ppPins[0]->m_pGroup->m_Request, nCount, nOffsets, Values);
+#else
+    struct gpiod_line_bulk bulk;
+    int Values[GPIO_MAX_PINSET];
+    gpiod_line_bulk_init(&bulk);
+    for (unsigned i = 0; i < nCount; i++)
+        gpiod_line_bulk_add(&bulk, ppPins[i]->m_Line);
+    int r = gpiod_line_get_value_bulk(&bulk, Values);
+#endif
+    assert(r >= 0);
+    for (unsigned i = 0; i < nCount; i++)
+        if (Values[i] == 1)
+            nLevels |= 1U << i;
+    GPIO_TRACE_PINS(GPIOTraceRead, ppPins, nCount, nLevels);
+    return nLevels;
+}
+
+#elif defined(USE_GPIOMEM)
+
+// BCM283x/BCM2711 GPIO register word offsets
+#define GPFSEL0 (0x00 / 4)
+#define GPSET0 (0x1C / 4)
+#define GPCLR0 (0x28 / 4)
+#define GPLEV0 (0x34 / 4)
+#define GPPUD (0x94 / 4)
+#define GPPUDCLK0 (0x98 / 4)
+#define GPIO_PUP_PDN_CNTRL_REG0 (0xE4 / 4)
+
+#define GPIOMEM_DEVICE "/dev/gpiomem"
+#define GPIOMEM_PINS 54
+
+static void* s_pBuffer;
+static volatile uint32_t* s_pRegs;
+static unsigned s_nRefCount;
+
+static void SetPullPin(struct CGPIOPin* pin, enum TGPIOMode Mode);
+
+void SetGPIOMemBuffer(void* pBuffer) {
+    assert(s_nRefCount == 0);
+    s_pBuffer = pBuffer;
+}
+
+void DeInitPin(struct CGPIOPin* pin) {
+    SetModePin(pin, GPIOModeInputPullNone, 1);
+    assert(s_nRefCount > 0);
+    if (--s_nRefCount == 0) {
+        if (!s_pBuffer)
+            munmap((void*)s_pRegs, GPIOMEM_BLOCK_SIZE);
+        s_pRegs = 0;
+    }
+}
+
+void AssignPin(struct CGPIOPin* pin, unsigned nPin) {
+    assert(nPin < GPIOMEM_PINS);
+    if (s_nRefCount++ == 0) {
+        if (s_pBuffer)
+            s_pRegs = (volatile uint32_t*)s_pBuffer;
+        else {
+            int fd = open(GPIOMEM_DEVICE, O_RDWR | O_SYNC);
+            if (fd < 0) {
+                fprintf(stderr, "Can't open %s\n", GPIOMEM_DEVICE);
+                exit(-1);
+            }
+            void* pMap = mmap(NULL, GPIOMEM_BLOCK_SIZE, PROT_READ | PROT_WRITE,
+                              MAP_SHARED, fd, 0);
+            close(fd);
+            if (pMap == MAP_FAILED) {
+                fprintf(stderr, "Can't map %s\n", GPIOMEM_DEVICE);
+                exit(-1);
+            }
+            s_pRegs = (volatile uint32_t*)pMap;
+        }
+    }
+    pin->m_nPin = nPin;
+    pin->m_pFSel = s_pRegs + GPFSEL0 + nPin / 10;
+    pin->m_nFSelShift = (nPin % 10) * 3;
+    pin->m_pSet = s_pRegs + GPSET0 + nPin / 32;
+    pin->m_pClr = s_pRegs + GPCLR0 + nPin / 32;
+    pin->m_pLev = s_pRegs + GPLEV0 + nPin / 32;
+    pin->m_nMask = 1U << (nPin % 32);
+}
+
+void SetModePin(struct CGPIOPin* pin, enum TGPIOMode Mode, int bInitPin) {
+    assert(Mode < GPIOModeUnknown);
+    if (Mode == pin->m_Mode && !bInitPin)
+        return;
+    GPIO_STATS_ADD(m_nModeChanges, 1);
+    GPIO_TRACE_PIN(GPIOTraceMode, pin->m_nPin, Mode == GPIOModeOutput);
+    pin->m_Mode = Mode;
+    if (bInitPin)
+        SetPullPin(pin, Mode);
+    if (Mode == GPIOModeOutput && bInitPin)
+        WritePin(pin, LOW);
+    uint32_t nFSel = *pin->m_pFSel & ~(GPFSEL_MASK << pin->m_nFSelShift);
+    if (Mode == GPIOModeOutput)
+        nFSel |= GPFSEL_OUTPUT << pin->m_nFSelShift;
+    *pin->m_pFSel = nFSel;
+}
+
+void SetFunctionPin(struct CGPIOPin* pin, unsigned nFunction) {
+    GPIO_STATS_ADD(m_nModeChanges, 1);
+    pin->m_Mode = GPIOModeUnknown; // the next SetModePin() is not skipped
+    *pin->m_pFSel = (*pin->m_pFSel & ~(GPFSEL_MASK << pin->m_nFSelShift)) |
+                    nFunction << pin->m_nFSelShift;
+}
+
+void WritePin(struct CGPIOPin* pin, unsigned nValue) {
+    assert(pin->m_Mode < GPIOModeUnknown);
+    assert(nValue == LOW || nValue == HIGH);
+    GPIO_STATS_ADD(m_nWrites, 1);
+    GPIO_TRACE_PIN(GPIOTraceWrite, pin->m_nPin, nValue);
+    if (nValue)
+        *pin->m_pSet = pin->m_nMask;
+    else
+        *pin->m_pClr = pin->m_nMask;
+}
+
+unsigned ReadPin(struct CGPIOPin* pin) {
+    GPIO_STATS_ADD(m_nReads, 1);
+    assert(pin->m_Mode == GPIOModeInputPullUp ||
+           pin->m_Mode == GPIOModeInputPullNone);
+    unsigned nLevel = (*pin->m_pLev & pin->m_nMask) != 0;
+    GPIO_TRACE_PIN(GPIOTraceRead, pin->m_nPin, nLevel);
+    return nLevel;
+}
+
+// One set and one clear write per bank (all header pins are in bank 0)
+void WritePins(struct CGPIOPin** ppPins, unsigned nCount, uint32_t nLevels) {
+    assert(nCount <= GPIO_MAX_PINSET);
+    uint32_t nSet[2] = {0, 0}, nClear[2] = {0, 0};
+    for (unsigned i = 0; i < nCount; i++) {
+        struct CGPIOPin* pin = ppPins[i];
+        assert(pin->m_Mode < GPIOModeUnknown);
+        if ((nLevels >> i) & 1)
+            nSet[pin->m_nPin / 32] |= pin->m_nMask;
+        else
+            nClear[pin->m_nPin / 32] |= pin->m_nMask;
+    }
+    GPIO_STATS_ADD(m_nWrites, 1);
+    GPIO_TRACE_PINS(GPIOTraceWrite, ppPins, nCount, nLevels);
+    for (unsigned nBank = 0; nBank < 2; nBank++) {
+        if (nSet[nBank])
+            s_pRegs[GPSET0 + nBank] = nSet[nBank];
+        if (nClear[nBank])
+            s_pRegs[GPCLR0 + nBank] = nClear[nBank];
+    }
+}
+
+uint32_t ReadPins(struct CGPIOPin** ppPins, unsigned nCount) {
+    assert(nCount <= GPIO_MAX_PINSET);
+    GPIO_STATS_ADD(m_nReads, 1);
+    uint32_t nBank0 = s_pRegs[GPLEV0], nLevels = 0;
+    for (unsigned i = 0; i < nCount; i++) {
+        struct CGPIOPin* pin = ppPins[i];
+        uint32_t nBank = pin->m_nPin < 32 ? nBank0 : *pin->m_pLev;
+        if (nBank & pin->m_nMask)
+            nLevels |= 1U << i;
+    }
+    GPIO_TRACE_PINS(GPIOTraceRead, ppPins, nCount, nLevels);
+    return nLevels;
+}
+
+// Same as the generic version, but with the register accesses inlined and
+// the data pin only touched when its level or direction changes
+void PlayWave(struct CGPIOPin* pClock, struct CGPIOPin* pData,
+              const uint8_t* pSteps, size_t nSteps, uint32_t* pSamples,
+              void (*pDelay)(void* pParam), void* pParam) {
+    unsigned nSample = 0;
+    uint32_t nFSel = *pData->m_pFSel & ~(GPFSEL_MASK << pData->m_nFSelShift);
+    uint32_t nFSelOutput = nFSel | (GPFSEL_OUTPUT << pData->m_nFSelShift);
+    int bOutput = pData->m_Mode == GPIOModeOutput;
+    int nLevel = -1;
+    for (size_t i = 0; i < nSteps; i++) {
+        uint8_t uchStep = pSteps[i];
+        if (uchStep & WAVE_INPUT) {
+            if (bOutput) {
+                *pData->m_pFSel = nFSel;
+                bOutput = 0;
+                GPIO_STATS_ADD(m_nModeChanges, 1);
+                GPIO_TRACE_PIN(GPIOTraceMode, pData->m_nPin, 0);
+            }
+        } else {
+            int nData = uchStep & WAVE_DATA;
+            if (nData != nLevel) {
+                if (nData)
+                    *pData->m_pSet = pData->m_nMask;
+                else
+                    *pData->m_pClr = pData->m_nMask;
+                nLevel = nData;
+                GPIO_STATS_ADD(m_nWrites, 1);
+                GPIO_TRACE_PIN(GPIOTraceWrite, pData->m_nPin, nData);
+            }
+            if (!bOutput) {
+                *pData->m_pFSel = nFSelOutput;
+                bOutput = 1;
+                GPIO_STATS_ADD(m_nModeChanges, 1);
+                GPIO_TRACE_PIN(GPIOTraceMode, pData->m_nPin, 1);
+            }
+        }
+        if (uchStep & WAVE_SAMPLE) {
+            GPIO_STATS_ADD(m_nReads, 1);
+            uint32_t nMask = 1U << (nSample & 31);
+            int bHigh = (*pData->m_pLev & pData->m_nMask) != 0;
+            GPIO_TRACE_PIN(GPIOTraceRead, pData->m_nPin, bHigh);
+            if (bHigh)
+                pSamples[nSample / 32] |= nMask;
+            else
+                pSamples[nSample / 32] &= ~nMask;
+            nSample++;
+        }
+        if (uchStep & WAVE_CLOCK)
+            *pClock->m_pSet = pClock->m_nMask;
+        else
+            *pClock->m_pClr = pClock->m_nMask;
+        GPIO_STATS_ADD(m_nWrites, 1);
+        GPIO_TRACE_PIN(GPIOTraceWrite, pClock->m_nPin,
+                       (uchStep & WAVE_CLOCK) != 0);
+        if (pDelay)
+            pDelay(pParam);
+    }
+    pData->m_Mode = bOutput ? GPIOModeOutput : GPIOModeInputPullUp;
+}
+
+#if defined(GPIOMEM_BCM2711)
+
+void SetPullPin(struct CGPIOPin* pin, enum TGPIOMode Mode) {
+    // 2 bits per pin: 0 = none, 1 = pull up, 2 = pull down
+    volatile uint32_t* pReg =
+        s_pRegs + GPIO_PUP_PDN_CNTRL_REG0 + pin->m_nPin / 16;
+    unsigned nShift = (pin->m_nPin % 16) * 2;
+    uint32_t nValue = *pReg & ~(3U << nShift);
+    if (Mode == GPIOModeInputPullUp)
+        nValue |= 1U << nShift;
+    *pReg = nValue;
+}
+
+#else
+
+void SetPullPin(struct CGPIOPin* pin, enum TGPIOMode Mode) {
+    // Legacy sequence, control signal must be setup/held for 150 cycles
+    s_pRegs[GPPUD] = Mode == GPIOModeInputPullUp ? 2 : 0;
+    usleep(1);
+    s_pRegs[GPPUDCLK0 + pin->m_nPin / 32] = pin->m_nMask;
+    usleep(1);
+    s_pRegs[GPPUD] = 0;
+    s_pRegs[GPPUDCLK0 + pin->m_nPin / 32] = 0;
+}
+
+#endif
+
+#elif defined(USE_SIMGPIO)
+
+// Pins of the simulated GPIO bank, see simtarget.c for the targets
+
+void DeInitPin(struct CGPIOPin* pin) {
+    SetModePin(pin, GPIOModeInputPullNone, 1);
+}
+
+void AssignPin(struct CGPIOPin* pin, unsigned nPin) {
+    assert(nPin < SIMGPIO_PINS);
+    pin->m_nPin = nPin;
+}
+
+void SetModePin(struct CGPIOPin* pin, enum TGPIOMode Mode, int bInitPin) {
+    assert(Mode < GPIOModeUnknown);
+    if (Mode == pin->m_Mode && !bInitPin)
+        return;
+    GPIO_STATS_ADD(m_nModeChanges, 1);
+    GPIO_TRACE_PIN(GPIOTraceMode, pin->m_nPin, Mode == GPIOModeOutput);
+    pin->m_Mode = Mode;
+    SimPinMode(pin->m_nPin, Mode == GPIOModeOutput);
+    if (Mode == GPIOModeOutput && bInitPin)
+        WritePin(pin, LOW);
+}
+
+void WritePin(struct CGPIOPin* pin, unsigned nValue) {
+    assert(pin->m_Mode < GPIOModeUnknown);
+    assert(nValue == LOW || nValue == HIGH);
+    GPIO_STATS_ADD(m_nWrites, 1);
+    GPIO_TRACE_PIN(GPIOTraceWrite, pin->m_nPin, nValue);
+    SimPinWrite(pin->m_nPin, nValue);
+}
+
+unsigned ReadPin(struct CGPIOPin* pin) {
+    GPIO_STATS_ADD(m_nReads, 1);
+    assert(pin->m_Mode == GPIOModeInputPullUp ||
+           pin->m_Mode == GPIOModeInputPullNone);
+    unsigned nLevel = SimPinRead(pin->m_nPin);
+    GPIO_TRACE_PIN(GPIOTraceRead, pin->m_nPin, nLevel);
+    return nLevel;
+}
+
 #endif
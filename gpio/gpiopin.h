@@ -21,18 +21,53 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 #if defined(USE_LIBGPIOD)
 #include <gpiod.h>
+#if defined(USE_LIBGPIOD_V2)
+#define GPIO_BACKEND "libgpiod-v2"
+#else
+#define GPIO_BACKEND "libgpiod"
+#endif
 #elif defined(USE_LIBPIGPIO)
 #include <pigpio.h>
+#define GPIO_BACKEND "pigpio"
+#elif defined(USE_GPIOMEM)
+#define GPIO_BACKEND "gpiomem"
+#elif defined(USE_SIMGPIO)
+#include "simtarget.h"
+#define GPIO_BACKEND "sim"
 #else
-#error Must define USE_LIBGPIOD or USE_LIBPIGPIO
+#error Must define USE_LIBGPIOD, USE_LIBPIGPIO, USE_GPIOMEM or USE_SIMGPIO
 #endif
 
 #define LOW 0
 #define HIGH 1
 
+// PlayWave() step flags, one step per clock half period
+#define WAVE_DATA 0x01   // level driven on the data pin
+#define WAVE_CLOCK 0x02  // level of the clock pin
+#define WAVE_INPUT 0x04  // data pin released (input with pull-up)
+#define WAVE_SAMPLE 0x08 // sample the data pin before the clock edge
+
+// GPIO operations since start, for benchmarking. Only counted with
+// USE_SWDSTATS (cmake -DSWD_STATS=ON, always on in swdbench).
+struct TGPIOStats {
+    uint64_t m_nWrites;
+    uint64_t m_nReads;
+    uint64_t m_nModeChanges;
+    uint64_t m_nKernelCalls; // system calls made by the backend
+};
+
+extern struct TGPIOStats g_GPIOStats;
+
+#if defined(USE_SWDSTATS)
+#define GPIO_STATS_ADD(member, n) (g_GPIOStats.member += (n))
+#else
+#define GPIO_STATS_ADD(member, n) ((void)0)
+#endif
+
 enum TGPIOMode {
     GPIOModeInputPullUp,
     GPIOModeInputPullNone,
@@ -40,13 +75,28 @@ enum TGPIOMode {
     GPIOModeUnknown
 };
 
+#if defined(USE_LIBGPIOD)
+// Lines of one chip held under a single request, shared by its pins
+struct CGPIOLineGroup;
+#endif
+
 struct CGPIOPin {
     unsigned m_nPin;
     enum TGPIOMode m_Mode;
 #if defined(USE_LIBGPIOD)
-    struct gpiod_chip* m_Chip;
+    struct CGPIOLineGroup* m_pGroup;
+    unsigned m_nIndex;
+#if !defined(USE_LIBGPIOD_V2)
     struct gpiod_line* m_Line;
+#endif
     unsigned m_nLastWrite;
+#elif defined(USE_GPIOMEM)
+    volatile uint32_t* m_pFSel;
+    volatile uint32_t* m_pSet;
+    volatile uint32_t* m_pClr;
+    volatile uint32_t* m_pLev;
+    uint32_t m_nMask;
+    unsigned m_nFSelShift;
 #endif
 };
 
@@ -56,6 +106,17 @@ struct CGPIOPin {
 void InitPin(struct CGPIOPin* pin, unsigned nPin, enum TGPIOMode Mode);
 void DeInitPin(struct CGPIOPin* pin);
 
+/// \brief Initialise several pins at once
+/// \param ppPins Pins to be initialised
+/// \param pPinNumbers Pin numbers, one per pin
+/// \param nCount Number of pins
+/// \param Mode Pin mode to be set for all pins
+/// \note With libgpiod v2 pins on the same chip share one line request,
+/// which stays held until the last of them is deinitialised. The v1 uAPI
+/// has one direction per request, each pin gets its own there.
+void InitPins(struct CGPIOPin** ppPins, const unsigned* pPinNumbers,
+              unsigned nCount, enum TGPIOMode Mode);
+
 /// \param Mode Pin mode to be set
 /// \param bInitPin Also init pullup/down mode and output level
 void SetModePin(struct CGPIOPin* pin, enum TGPIOMode Mode, int bInitPin);
@@ -66,6 +127,53 @@ void WritePin(struct CGPIOPin* pin, unsigned nValue);
 /// \return Value read from pin (LOW or HIGH)
 unsigned ReadPin(struct CGPIOPin* pin);
 
+// Pin sets for the functions below, bit i of a level mask is ppPins[i]
+#define GPIO_MAX_PINSET 32
+
+/// \brief Set the mode of several pins
+void SetModePins(struct CGPIOPin** ppPins, unsigned nCount,
+                 enum TGPIOMode Mode);
+
+/// \brief Write several output pins, with a single register access or
+/// system call where the backend allows it
+/// \param nLevels Bit i is the level written to ppPins[i]
+void WritePins(struct CGPIOPin** ppPins, unsigned nCount, uint32_t nLevels);
+
+/// \brief Read several input pins at once, see WritePins()
+/// \return Bit i is the level of ppPins[i]
+uint32_t ReadPins(struct CGPIOPin** ppPins, unsigned nCount);
+
+/// \brief Clock out a precomputed edge buffer on a clock/data pin pair
+/// \param pSteps Steps, applied in order: data direction, data level,
+/// sample, clock level, then pDelay
+/// \param nSteps Number of steps
+/// \param pSamples Receives one bit per WAVE_SAMPLE step, LSB first
+/// \param pDelay Called after each step to pace the clock (may be 0)
+/// \param pParam Parameter handed to pDelay
+void PlayWave(struct CGPIOPin* pClock, struct CGPIOPin* pData,
+              const uint8_t* pSteps, size_t nSteps, uint32_t* pSamples,
+              void (*pDelay)(void* pParam), void* pParam);
+
+#if defined(USE_GPIOMEM)
+// Size of the GPIO register block mapped from /dev/gpiomem
+#define GPIOMEM_BLOCK_SIZE 4096
+
+// 3 bit function select fields in GPFSELn, 10 pins per register
+#define GPFSEL_INPUT 0
+#define GPFSEL_OUTPUT 1
+#define GPFSEL_MASK 7
+#define GPFSEL_ALT0 4
+
+/// \brief Hand a pin to a peripheral, SetModePin() takes it back
+/// \param nFunction GPFSEL_ALT0 ...
+void SetFunctionPin(struct CGPIOPin* pin, unsigned nFunction);
+
+/// \brief Use a memory buffer in place of /dev/gpiomem (test hook)
+/// \param pBuffer Buffer of GPIOMEM_BLOCK_SIZE bytes, 0 to use the device
+/// \note Must be called before the first InitPin()
+void SetGPIOMemBuffer(void* pBuffer);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
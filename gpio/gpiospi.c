@@ -0,0 +1,280 @@
+//
+// gpiospi.c
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(USE_GPIOMEM)
+#include <fcntl.h>
+#include <linux/spi/spidev.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+#include "gpiospi.h"
+
+#if defined(USE_GPIOMEM)
+
+static size_t MaxTransfer(void) {
+    FILE* pFile = fopen(SPI_BUFSIZ_PARAM, "r");
+    unsigned long nBufSiz = 0;
+    if (pFile) {
+        if (fscanf(pFile, "%lu", &nBufSiz) != 1)
+            nBufSiz = 0;
+        fclose(pFile);
+    }
+    return nBufSiz ? nBufSiz : SPI_DEFAULT_BUFSIZ;
+}
+
+int SPIOpen(struct CGPIOSPI* spi, const char* pDevice, unsigned nClockPin,
+            unsigned nDataPin, unsigned nSpeedHz) {
+    memset(spi, 0, sizeof(*spi));
+    spi->m_fd = -1;
+    spi->m_nClockPin = nClockPin;
+    spi->m_nDataPin = nDataPin;
+    spi->m_nSpeedHz = nSpeedHz;
+    if (nClockPin != SPI_SCLK_GPIO || nDataPin != SPI_MISO_GPIO) {
+        fprintf(stderr,
+                "SPI needs SWCLK on GPIO%u, SWDIO on GPIO%u and GPIO%u "
+                "joined to it through a resistor\n",
+                SPI_SCLK_GPIO, SPI_MISO_GPIO, SPI_MOSI_GPIO);
+        return 0;
+    }
+    spi->m_fd = open(pDevice, O_RDWR);
+    if (spi->m_fd < 0) {
+        fprintf(stderr, "Can't open %s\n", pDevice);
+        return 0;
+    }
+    // chip select is not wired, not every controller can leave it alone
+    uint8_t uchMode = SPI_MODE_0 | SPI_NO_CS, uchBits = 8;
+    if (ioctl(spi->m_fd, SPI_IOC_WR_MODE, &uchMode) < 0) {
+        uchMode = SPI_MODE_0;
+        ioctl(spi->m_fd, SPI_IOC_WR_MODE, &uchMode);
+    }
+    if (ioctl(spi->m_fd, SPI_IOC_WR_BITS_PER_WORD, &uchBits) < 0 ||
+        ioctl(spi->m_fd, SPI_IOC_WR_MAX_SPEED_HZ, &nSpeedHz) < 0) {
+        fprintf(stderr, "Can't set up %s (%s)\n", pDevice, strerror(errno));
+        close(spi->m_fd);
+        spi->m_fd = -1;
+        return 0;
+    }
+    spi->m_nMaxTransfer = MaxTransfer();
+    InitPin(&spi->m_MOSIPin, SPI_MOSI_GPIO, GPIOModeInputPullNone);
+    return 1;
+}
+
+void SPIClose(struct CGPIOSPI* spi) {
+    if (spi->m_fd >= 0) {
+        DeInitPin(&spi->m_MOSIPin);
+        close(spi->m_fd);
+    }
+    free(spi->m_pTx);
+    free(spi->m_pRx);
+    memset(spi, 0, sizeof(*spi));
+    spi->m_fd = -1;
+}
+
+// The pins go to SPI0 for the wave, MOSI back to high impedance after it
+static void Claim(struct CGPIOSPI* spi, struct CGPIOPin* pClock,
+                  struct CGPIOPin* pData) {
+    WritePin(pClock, LOW); // SCLK idles low in mode 0
+    SetFunctionPin(pClock, GPFSEL_ALT0);
+    SetFunctionPin(pData, GPFSEL_ALT0);
+    SetFunctionPin(&spi->m_MOSIPin, GPFSEL_ALT0);
+}
+
+static void ReleaseMOSI(struct CGPIOSPI* spi) {
+    SetModePin(&spi->m_MOSIPin, GPIOModeInputPullNone, 0);
+}
+
+static int Transfer(struct CGPIOSPI* spi, size_t nBytes) {
+    for (size_t nDone = 0; nDone < nBytes;) {
+        size_t nLength = nBytes - nDone;
+        if (nLength > spi->m_nMaxTransfer)
+            nLength = spi->m_nMaxTransfer;
+        struct spi_ioc_transfer xfer;
+        memset(&xfer, 0, sizeof(xfer));
+        xfer.tx_buf = (uintptr_t)(spi->m_pTx + nDone);
+        xfer.rx_buf = (uintptr_t)(spi->m_pRx + nDone);
+        xfer.len = nLength;
+        xfer.speed_hz = spi->m_nSpeedHz;
+        xfer.bits_per_word = 8;
+        GPIO_STATS_ADD(m_nKernelCalls, 1);
+        if (ioctl(spi->m_fd, SPI_IOC_MESSAGE(1), &xfer) < 0) {
+            fprintf(stderr, "SPI transfer failed (%s)\n", strerror(errno));
+            return 0;
+        }
+        spi->m_nMessages++;
+        nDone += nLength;
+    }
+    return 1;
+}
+
+#elif defined(USE_SIMGPIO)
+
+int SPIOpen(struct CGPIOSPI* spi, const char* pDevice, unsigned nClockPin,
+            unsigned nDataPin, unsigned nSpeedHz) {
+    (void)pDevice;
+    memset(spi, 0, sizeof(*spi));
+    spi->m_fd = -1;
+    spi->m_nClockPin = nClockPin;
+    spi->m_nDataPin = nDataPin;
+    spi->m_nSpeedHz = nSpeedHz;
+    spi->m_nMaxTransfer = SPI_DEFAULT_BUFSIZ;
+    return 1;
+}
+
+void SPIClose(struct CGPIOSPI* spi) {
+    free(spi->m_pTx);
+    free(spi->m_pRx);
+    memset(spi, 0, sizeof(*spi));
+    spi->m_fd = -1;
+}
+
+// The mock drives the simulated pins directly, SetModePin() has to set them
+// up again afterwards
+static void Claim(struct CGPIOSPI* spi, struct CGPIOPin* pClock,
+                  struct CGPIOPin* pData) {
+    (void)spi;
+    WritePin(pClock, LOW);
+    pClock->m_Mode = GPIOModeUnknown;
+    pData->m_Mode = GPIOModeUnknown;
+}
+
+static void ReleaseMOSI(struct CGPIOSPI* spi) { (void)spi; }
+
+// Mode 0, MSB first. MOSI is modelled as a host output that any driving
+// target overrides, MISO reads the line.
+static int Transfer(struct CGPIOSPI* spi, size_t nBytes) {
+    memset(spi->m_pRx, 0, nBytes);
+    SimPinMode(spi->m_nDataPin, 1);
+    for (size_t i = 0; i < nBytes * 8; i++) {
+        unsigned nShift = 7 - (i & 7);
+        SimPinWrite(spi->m_nDataPin, (spi->m_pTx[i / 8] >> nShift) & 1);
+        spi->m_pRx[i / 8] |= SimPinRead(spi->m_nDataPin) << nShift;
+        SimPinWrite(spi->m_nClockPin, HIGH);
+        SimPinWrite(spi->m_nClockPin, LOW);
+    }
+    spi->m_nMessages +=
+        (nBytes + spi->m_nMaxTransfer - 1) / spi->m_nMaxTransfer;
+    return 1;
+}
+
+#else
+
+int SPIOpen(struct CGPIOSPI* spi, const char* pDevice, unsigned nClockPin,
+            unsigned nDataPin, unsigned nSpeedHz) {
+    (void)pDevice, (void)nClockPin, (void)nDataPin, (void)nSpeedHz;
+    memset(spi, 0, sizeof(*spi));
+    spi->m_fd = -1;
+    fprintf(stderr, "SPI needs the gpiomem backend (pin functions)\n");
+    return 0;
+}
+
+void SPIClose(struct CGPIOSPI* spi) { (void)spi; }
+
+int SPIPlayWave(struct CGPIOSPI* spi, struct CGPIOPin* pClock,
+                struct CGPIOPin* pData, const uint8_t* pSteps, size_t nSteps,
+                uint32_t* pSamples) {
+    (void)spi, (void)pClock, (void)pData, (void)pSteps, (void)nSteps;
+    (void)pSamples;
+    return 0;
+}
+
+#endif
+
+void SPISetSpeed(struct CGPIOSPI* spi, unsigned nSpeedHz) {
+    spi->m_nSpeedHz = nSpeedHz;
+}
+
+#if defined(USE_GPIOMEM) || defined(USE_SIMGPIO)
+
+static int GrowBuffers(struct CGPIOSPI* spi, size_t nBytes) {
+    if (nBytes <= spi->m_nBufferSize)
+        return 1;
+    free(spi->m_pTx);
+    free(spi->m_pRx);
+    spi->m_pTx = malloc(nBytes);
+    spi->m_pRx = malloc(nBytes);
+    spi->m_nBufferSize = spi->m_pTx && spi->m_pRx ? nBytes : 0;
+    if (!spi->m_nBufferSize)
+        fprintf(stderr, "Out of memory\n");
+    return spi->m_nBufferSize != 0;
+}
+
+// A wave cycle is a step with the clock low followed by one with it high,
+// a lone low step (the end of WaveIdle()) only sets the level
+static int IsCycle(const uint8_t* pSteps, size_t nSteps, size_t i) {
+    return i + 1 < nSteps && !(pSteps[i] & WAVE_CLOCK) &&
+           (pSteps[i + 1] & WAVE_CLOCK);
+}
+
+int SPIPlayWave(struct CGPIOSPI* spi, struct CGPIOPin* pClock,
+                struct CGPIOPin* pData, const uint8_t* pSteps, size_t nSteps,
+                uint32_t* pSamples) {
+    if (!nSteps)
+        return 1;
+    size_t nCycles = 0;
+    for (size_t i = 0; i < nSteps; i++)
+        if (IsCycle(pSteps, nSteps, i))
+            nCycles++;
+    // padded with idle cycles, SWDIO low
+    size_t nBytes = (nCycles + 7) / 8;
+    if (!GrowBuffers(spi, nBytes ? nBytes : 1))
+        return 0;
+    memset(spi->m_pTx, 0, nBytes);
+    size_t nCycle = 0;
+    for (size_t i = 0; i < nSteps; i++) {
+        if (!IsCycle(pSteps, nSteps, i))
+            continue;
+        if (pSteps[i] & (WAVE_INPUT | WAVE_DATA))
+            spi->m_pTx[nCycle / 8] |= 0x80 >> (nCycle & 7);
+        nCycle++;
+    }
+    Claim(spi, pClock, pData);
+    int bOK = Transfer(spi, nBytes);
+    spi->m_nBytes += nBytes;
+    ReleaseMOSI(spi);
+    SetModePin(pClock, GPIOModeOutput, 0);
+    WritePin(pClock, LOW);
+    uint8_t uchLast = pSteps[nSteps - 1];
+    if (uchLast & WAVE_INPUT)
+        SetModePin(pData, GPIOModeInputPullUp, 0);
+    else {
+        SetModePin(pData, GPIOModeOutput, 0);
+        WritePin(pData, uchLast & WAVE_DATA ? HIGH : LOW);
+    }
+    unsigned nSample = 0;
+    nCycle = 0;
+    for (size_t i = 0; i < nSteps; i++) {
+        if (!IsCycle(pSteps, nSteps, i))
+            continue;
+        if (pSteps[i] & WAVE_SAMPLE) {
+            uint32_t nMask = 1U << (nSample & 31);
+            if (spi->m_pRx[nCycle / 8] & (0x80 >> (nCycle & 7)))
+                pSamples[nSample / 32] |= nMask;
+            else
+                pSamples[nSample / 32] &= ~nMask;
+            nSample++;
+        }
+        nCycle++;
+    }
+    return bOK;
+}
+
+#endif
@@ -0,0 +1,82 @@
+//
+// gpiospi.h
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _pico_gpiospi_h
+#define _pico_gpiospi_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gpiopin.h"
+
+// SPI0 on the Pi header (ALT0): SCLK is SWCLK, MISO is SWDIO, MOSI drives
+// SWDIO through a resistor (about 1 kOhm), so the target overdrives it
+#define SPI_SCLK_GPIO 11
+#define SPI_MISO_GPIO 9
+#define SPI_MOSI_GPIO 10
+
+#define SPI_BUFSIZ_PARAM "/sys/module/spidev/parameters/bufsiz"
+#define SPI_DEFAULT_BUFSIZ 4096 // spidev limit of one message
+
+// Waves shifted through a spidev device in mode 0: MOSI changes after the
+// falling SCLK edge and MISO is sampled at the rising one, as the target
+// samples SWDIO and the wave samples its response. The pins are only
+// switched to SPI while a wave plays, requests in between are bit-banged.
+// In the sim build the device is a mock shifting through the simulated
+// target's pins, with the resistor modelled.
+struct CGPIOSPI {
+    int m_fd; // -1 for the mock
+    unsigned m_nSpeedHz;
+    size_t m_nMaxTransfer; // bytes per SPI_IOC_MESSAGE
+    unsigned m_nClockPin;
+    unsigned m_nDataPin;
+    struct CGPIOPin m_MOSIPin; // not used by the mock
+    uint8_t* m_pTx;
+    uint8_t* m_pRx;
+    size_t m_nBufferSize;
+    uint64_t m_nMessages; // SPI_IOC_MESSAGE calls
+    uint64_t m_nBytes;
+};
+
+/// \brief Open a spidev device for the SWCLK and SWDIO pins of the loader
+/// \param pDevice e.g. /dev/spidev0.0, ignored by the mock
+/// \return Operation successful? Needs the gpiomem backend (pin functions
+/// are switched per wave) or the sim build
+int SPIOpen(struct CGPIOSPI* spi, const char* pDevice, unsigned nClockPin,
+            unsigned nDataPin, unsigned nSpeedHz);
+
+void SPIClose(struct CGPIOSPI* spi);
+
+void SPISetSpeed(struct CGPIOSPI* spi, unsigned nSpeedHz);
+
+/// \brief PlayWave() through SPI, whole steps of one wave in as few
+/// messages as the spidev buffer allows. Released data steps drive MOSI
+/// high, like the pull-up. The clock and data pins are left as PlayWave()
+/// leaves them.
+/// \return Transfer successful?
+int SPIPlayWave(struct CGPIOSPI* spi, struct CGPIOPin* pClock,
+                struct CGPIOPin* pData, const uint8_t* pSteps, size_t nSteps,
+                uint32_t* pSamples);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,235 @@
+//
+// gpiotrace.c
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpiotrace.h"
+
+#define VCD_PINS 256
+#define VCD_FIRST_ID 33 // '!', identifiers are printable characters
+
+struct CGPIOTrace g_GPIOTrace;
+
+static int AllocRing(struct TGPIOTraceRing* ring, size_t nRecords) {
+    ring->m_pRecords = malloc(nRecords * sizeof(struct TGPIOTraceRecord));
+    ring->m_nMask = nRecords - 1;
+    ring->m_nCount = 0;
+    return ring->m_pRecords != 0;
+}
+
+int GPIOTraceStart(void) {
+    GPIOTraceFree();
+    g_GPIOTrace.m_nStart = 0;
+    g_GPIOTrace.m_nStart = GPIOTraceNow();
+    if (!AllocRing(&g_GPIOTrace.m_Pins, GPIO_TRACE_PIN_RECORDS) ||
+        !AllocRing(&g_GPIOTrace.m_Requests, GPIO_TRACE_REQUEST_RECORDS)) {
+        fprintf(stderr, "Out of memory\n");
+        GPIOTraceFree();
+        return 0;
+    }
+    return 1;
+}
+
+// Park the records where the hooks do not find them
+static struct TGPIOTraceRecord* s_pStopped[2];
+
+void GPIOTraceStop(void) {
+    if (!g_GPIOTrace.m_Pins.m_pRecords)
+        return;
+    s_pStopped[0] = g_GPIOTrace.m_Pins.m_pRecords;
+    s_pStopped[1] = g_GPIOTrace.m_Requests.m_pRecords;
+    g_GPIOTrace.m_Pins.m_pRecords = 0;
+    g_GPIOTrace.m_Requests.m_pRecords = 0;
+}
+
+void GPIOTraceFree(void) {
+    GPIOTraceStop();
+    free(s_pStopped[0]);
+    free(s_pStopped[1]);
+    s_pStopped[0] = s_pStopped[1] = 0;
+}
+
+void GPIOTraceName(unsigned nPin, const char* pName) {
+    if (nPin < VCD_PINS)
+        g_GPIOTrace.m_pNames[nPin] = pName;
+}
+
+// \return Records of a ring, oldest first, in two parts if it wrapped
+static size_t RingRecords(const struct TGPIOTraceRing* ring,
+                          const struct TGPIOTraceRecord* pRecords,
+                          size_t* pnFirst) {
+    uint64_t nSize = ring->m_nMask + 1;
+    if (!pRecords || !ring->m_nCount) {
+        *pnFirst = 0;
+        return 0;
+    }
+    if (ring->m_nCount <= nSize) {
+        *pnFirst = 0;
+        return ring->m_nCount;
+    }
+    *pnFirst = ring->m_nCount & ring->m_nMask;
+    return nSize;
+}
+
+static void WriteBinary(FILE* pFile, uint32_t nValue, unsigned nBits) {
+    fputc('b', pFile);
+    for (unsigned i = nBits; i--;)
+        fputc(nValue >> i & 1 ? '1' : '0', pFile);
+}
+
+int GPIOTraceWriteVCD(const char* pPath) {
+    GPIOTraceStop();
+    const struct TGPIOTraceRing* pins = &g_GPIOTrace.m_Pins;
+    const struct TGPIOTraceRing* requests = &g_GPIOTrace.m_Requests;
+    size_t nPinFirst, nRequestFirst;
+    size_t nPins = RingRecords(pins, s_pStopped[0], &nPinFirst);
+    size_t nRequests = RingRecords(requests, s_pStopped[1], &nRequestFirst);
+    FILE* pFile = fopen(pPath, "w");
+    if (!pFile) {
+        fprintf(stderr, "Can't create %s\n", pPath);
+        return 0;
+    }
+    // one wire per pin seen, then request, ACK and data
+    char IDs[VCD_PINS] = {0};
+    char nID = VCD_FIRST_ID;
+    for (size_t i = 0; i < nPins; i++) {
+        unsigned nPin = s_pStopped[0][(nPinFirst + i) & pins->m_nMask].m_uchPin;
+        if (!IDs[nPin])
+            IDs[nPin] = nID++;
+    }
+    fprintf(pFile, "$version swdloader $end\n$timescale 1ns $end\n"
+                   "$scope module swd $end\n");
+    for (unsigned nPin = 0; nPin < VCD_PINS; nPin++) {
+        if (!IDs[nPin])
+            continue;
+        if (g_GPIOTrace.m_pNames[nPin])
+            fprintf(pFile, "$var wire 1 %c %s $end\n", IDs[nPin],
+                    g_GPIOTrace.m_pNames[nPin]);
+        else
+            fprintf(pFile, "$var wire 1 %c gpio%u $end\n", IDs[nPin], nPin);
+    }
+    char nRequestID = nID, nAckID = nID + 1, nDataID = nID + 2;
+    fprintf(pFile,
+            "$var reg 8 %c request $end\n$var reg 4 %c ack $end\n"
+            "$var reg 32 %c data $end\n$upscope $end\n"
+            "$enddefinitions $end\n",
+            nRequestID, nAckID, nDataID);
+    // both rings are in time order, merged here
+    size_t i = 0, j = 0;
+    uint64_t nTime = ~0ULL;
+    while (i < nPins || j < nRequests) {
+        const struct TGPIOTraceRecord* pin =
+            i < nPins ? &s_pStopped[0][(nPinFirst + i) & pins->m_nMask] : 0;
+        const struct TGPIOTraceRecord* request =
+            j < nRequests
+                ? &s_pStopped[1][(nRequestFirst + j) & requests->m_nMask]
+                : 0;
+        const struct TGPIOTraceRecord* record =
+            pin && (!request || pin->m_nNanos <= request->m_nNanos) ? pin
+                                                                    : request;
+        if (record == pin)
+            i++;
+        else
+            j++;
+        // the level is known again with the next write or read
+        if (record->m_uchType == GPIOTraceMode && record->m_uchValue)
+            continue;
+        if (record->m_nNanos != nTime) {
+            nTime = record->m_nNanos;
+            fprintf(pFile, "#%llu\n", (unsigned long long)nTime);
+        }
+        switch (record->m_uchType) {
+        case GPIOTraceWrite:
+        case GPIOTraceRead:
+            fprintf(pFile, "%c%c\n", record->m_uchValue ? '1' : '0',
+                    IDs[record->m_uchPin]);
+            break;
+        case GPIOTraceMode:
+            fprintf(pFile, "z%c\n", IDs[record->m_uchPin]);
+            break;
+        default:
+            WriteBinary(pFile, record->m_uchPin, 8);
+            fprintf(pFile, " %c\n", nRequestID);
+            WriteBinary(pFile, record->m_uchValue, 4);
+            fprintf(pFile, " %c\n", nAckID);
+            WriteBinary(pFile, record->m_nData, 32);
+            fprintf(pFile, " %c\n", nDataID);
+            break;
+        }
+    }
+    if (fclose(pFile) != 0) {
+        fprintf(stderr, "Can't write %s\n", pPath);
+        return 0;
+    }
+    return 1;
+}
+
+int GPIOTraceWriteLog(const char* pPath) {
+    GPIOTraceStop();
+    const struct TGPIOTraceRing* requests = &g_GPIOTrace.m_Requests;
+    size_t nFirst;
+    size_t nRequests = RingRecords(requests, s_pStopped[1], &nFirst);
+    FILE* pFile = fopen(pPath, "wb");
+    if (!pFile) {
+        fprintf(stderr, "Can't create %s\n", pPath);
+        return 0;
+    }
+    uint32_t nCount = nRequests;
+    int bOK = fwrite(GPIO_TRACE_MAGIC, sizeof(GPIO_TRACE_MAGIC), 1, pFile) &&
+              fwrite(&nCount, sizeof(nCount), 1, pFile);
+    // oldest first, up to the end of the ring and then from its start
+    size_t nTail = nRequests - nFirst;
+    bOK = bOK &&
+          fwrite(s_pStopped[1] + nFirst, sizeof(*s_pStopped[1]), nTail,
+                 pFile) == nTail &&
+          fwrite(s_pStopped[1], sizeof(*s_pStopped[1]), nFirst, pFile) ==
+              nFirst;
+    if (fclose(pFile) != 0 || !bOK) {
+        fprintf(stderr, "Can't write %s\n", pPath);
+        return 0;
+    }
+    return 1;
+}
+
+long GPIOTraceReadLog(const char* pPath, struct TGPIOTraceRecord** ppRecords) {
+    FILE* pFile = fopen(pPath, "rb");
+    if (!pFile) {
+        fprintf(stderr, "Can't open %s\n", pPath);
+        return -1;
+    }
+    char Magic[sizeof(GPIO_TRACE_MAGIC)];
+    uint32_t nCount;
+    struct TGPIOTraceRecord* pRecords = 0;
+    int bOK = fread(Magic, sizeof(Magic), 1, pFile) &&
+              !memcmp(Magic, GPIO_TRACE_MAGIC, sizeof(Magic)) &&
+              fread(&nCount, sizeof(nCount), 1, pFile);
+    if (bOK) {
+        pRecords = malloc((nCount ? nCount : 1) * sizeof(*pRecords));
+        bOK = pRecords &&
+              fread(pRecords, sizeof(*pRecords), nCount, pFile) == nCount;
+    }
+    fclose(pFile);
+    if (!bOK) {
+        fprintf(stderr, "%s is not a transaction log\n", pPath);
+        free(pRecords);
+        return -1;
+    }
+    *ppRecords = pRecords;
+    return nCount;
+}
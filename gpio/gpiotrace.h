@@ -0,0 +1,142 @@
+//
+// gpiotrace.h
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _pico_gpiotrace_h
+#define _pico_gpiotrace_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define GPIO_TRACE_PIN_RECORDS (1U << 21)     // edges, reads, mode changes
+#define GPIO_TRACE_REQUEST_RECORDS (1U << 18) // decoded SWD requests
+#define GPIO_TRACE_MAGIC "SWDTRC1" // transaction log, NUL terminated
+#define GPIO_TRACE_PARITY_ERROR 8  // ACK of a read with bad parity
+#define GPIO_TRACE_NO_ACK 0xF      // streamed write or TARGETSEL, not sampled
+
+enum TGPIOTraceType {
+    GPIOTraceWrite,   // m_uchValue level written
+    GPIOTraceRead,    // m_uchValue level read
+    GPIOTraceMode,    // m_uchValue 1 output, 0 input
+    GPIOTraceRequest  // m_uchPin request, m_uchValue ACK, m_nData
+};
+
+// One event, 16 bytes, also the record of a transaction log
+struct TGPIOTraceRecord {
+    uint64_t m_nNanos; // since GPIOTraceStart()
+    uint8_t m_uchType;
+    uint8_t m_uchPin; // pin number, or the request of GPIOTraceRequest
+    uint8_t m_uchValue;
+    uint8_t m_uchReserved;
+    uint32_t m_nData; // written or read, if the ACK was OK
+};
+
+// Ring of the latest events, the oldest are overwritten
+struct TGPIOTraceRing {
+    struct TGPIOTraceRecord* m_pRecords; // 0 while not tracing
+    uint64_t m_nMask;                    // size - 1, size a power of 2
+    uint64_t m_nCount;                   // recorded since the start
+};
+
+struct CGPIOTrace {
+    struct TGPIOTraceRing m_Pins;
+    struct TGPIOTraceRing m_Requests;
+    uint64_t m_nStart;
+    const char* m_pNames[256]; // VCD signal names by pin, may be 0
+};
+
+extern struct CGPIOTrace g_GPIOTrace;
+
+static inline uint64_t GPIOTraceNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000U + ts.tv_nsec -
+           g_GPIOTrace.m_nStart;
+}
+
+static inline void GPIOTraceAdd(struct TGPIOTraceRing* ring, uint64_t nNanos,
+                                unsigned nType, unsigned nPin,
+                                unsigned nValue, uint32_t nData) {
+    if (!ring->m_pRecords)
+        return;
+    struct TGPIOTraceRecord* record =
+        &ring->m_pRecords[ring->m_nCount++ & ring->m_nMask];
+    record->m_nNanos = nNanos;
+    record->m_uchType = nType;
+    record->m_uchPin = nPin;
+    record->m_uchValue = nValue;
+    record->m_uchReserved = 0;
+    record->m_nData = nData;
+}
+
+// Hooks for gpiopin.c and the SWD layer, only with USE_GPIOTRACE (cmake
+// -DSWD_TRACE=ON)
+#if defined(USE_GPIOTRACE)
+#define GPIO_TRACE_ENABLED 1
+#define GPIO_TRACE_NOW() GPIOTraceNow()
+#define GPIO_TRACE_PIN(nType, nPin, nValue)                                \
+    GPIOTraceAdd(&g_GPIOTrace.m_Pins, GPIOTraceNow(), nType, nPin, nValue, 0)
+#define GPIO_TRACE_REQUEST(nNanos, nRequest, nAck, nData)                  \
+    GPIOTraceAdd(&g_GPIOTrace.m_Requests, nNanos, GPIOTraceRequest,       \
+                 nRequest, nAck, nData)
+#define GPIO_TRACE_NAME(nPin, pName) GPIOTraceName(nPin, pName)
+#else
+#define GPIO_TRACE_ENABLED 0
+#define GPIO_TRACE_NOW() 0
+#define GPIO_TRACE_PIN(nType, nPin, nValue) ((void)0)
+#define GPIO_TRACE_REQUEST(nNanos, nRequest, nAck, nData) ((void)(nNanos))
+#define GPIO_TRACE_NAME(nPin, pName) ((void)0)
+#endif
+
+/// \brief Allocate the rings and start recording
+/// \return Operation successful?
+int GPIOTraceStart(void);
+
+/// \brief Stop recording, the rings are kept for export
+void GPIOTraceStop(void);
+
+/// \brief Free the rings
+void GPIOTraceFree(void);
+
+/// \brief Name a pin in the VCD export ("swclk"), pName must stay valid
+void GPIOTraceName(unsigned nPin, const char* pName);
+
+/// \brief Stop recording and write pin events and decoded requests as a
+/// Value Change Dump (1 ns timescale) for GTKWave or sigrok. A released pin
+/// shows as z until it is read.
+/// \return Operation successful?
+int GPIOTraceWriteVCD(const char* pPath);
+
+/// \brief Stop recording and write the decoded requests as a transaction
+/// log: GPIO_TRACE_MAGIC, the record count (uint32_t) and the records, in
+/// host byte order
+/// \return Operation successful?
+int GPIOTraceWriteLog(const char* pPath);
+
+/// \brief Read a transaction log written by GPIOTraceWriteLog()
+/// \param ppRecords Receives the records, to be freed by the caller
+/// \return Number of records, -1 on error
+long GPIOTraceReadLog(const char* pPath, struct TGPIOTraceRecord** ppRecords);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1084 @@
+//
+// simtarget.c
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#if defined(USE_SIMGPIO)
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "simtarget.h"
+
+// References:
+//
+// [1] ARM Debug Interface Architecture Specification ADIv5.0 to ADIv5.2, IHI
+// 0031E [2] ARM v6-M Architecture Reference Manual, DDI 0419E
+// [3] RP2040 Datasheet, section 2.3.4 Debug
+// [4] RP2040 Datasheet, section 2.8.3 Bootrom Contents
+
+#define BIT(x) (1U << (x))
+
+#define DPIDR_VALUE 0x0BC12477
+#define AP_IDR_VALUE 0x04770031
+
+#define CS_ORUNDETECT BIT(0)
+#define CS_STICKYORUN BIT(1)
+#define CS_STICKYCMP BIT(4)
+#define CS_STICKYERR BIT(5)
+#define CS_WDATAERR BIT(7)
+#define CS_CDBGPWRUPREQ BIT(28)
+#define CS_CDBGPWRUPACK BIT(29)
+#define CS_CSYSPWRUPREQ BIT(30)
+#define CS_CSYSPWRUPACK BIT(31)
+#define CS_WRITABLE (CS_ORUNDETECT | CS_CDBGPWRUPREQ | CS_CSYSPWRUPREQ)
+#define CS_STICKY (CS_STICKYORUN | CS_STICKYCMP | CS_STICKYERR | CS_WDATAERR)
+
+#define ABORT_STKCMPCLR BIT(1)
+#define ABORT_STKERRCLR BIT(2)
+#define ABORT_WDERRCLR BIT(3)
+#define ABORT_ORUNERRCLR BIT(4)
+
+#define ACK_OK 0b001
+#define ACK_WAIT 0b010
+#define ACK_FAULT 0b100
+
+// Request bits, in transmission order
+#define REQ_START BIT(0)
+#define REQ_APNDP BIT(1)
+#define REQ_RNW BIT(2)
+#define REQ_ADDR__SHIFT 3
+#define REQ_PARITY BIT(5)
+#define REQ_STOP BIT(6)
+#define REQ_PARK BIT(7)
+
+#define DP_DPIDR 0x0
+#define DP_ABORT 0x0
+#define DP_CTRL_STAT 0x4
+#define DP_SELECT 0x8
+#define DP_RDBUFF 0xC
+#define DP_TARGETSEL 0xC
+
+#define AP_CSW 0x00
+#define AP_TAR 0x04
+#define AP_DRW 0x0C
+#define AP_IDR 0xFC
+#define AP_CSW_ADDR_INC__SHIFT 4
+#define AP_CSW_ADDR_INC_SINGLE 1
+
+#define DHCSR 0xE000EDF0
+#define DHCSR_C_DEBUGEN BIT(0)
+#define DHCSR_C_HALT BIT(1)
+#define DHCSR_S_REGRDY BIT(16)
+#define DHCSR_S_HALT BIT(17)
+#define DHCSR_DBGKEY 0xA05F
+#define DCRSR 0xE000EDF4
+#define DCRSR_REGW_N_R BIT(16)
+#define DCRDR 0xE000EDF8
+
+#define REG_XPSR 16
+#define XPSR_N BIT(31)
+#define XPSR_Z BIT(30)
+#define XPSR_C BIT(29)
+#define XPSR_V BIT(28)
+#define SIM_MAX_STEPS 20000000
+
+#define AIRCR 0xE000ED0C
+#define AIRCR_VECTKEY 0x05FA
+#define AIRCR_SYSRESETREQ BIT(2)
+
+#define RESETS_RESET_DONE 0x4000C008
+#define RESETS_ALL 0x01FFFFFF
+
+// DMA channels complete a transfer as soon as they are triggered
+#define DMA_BASE 0x50000000
+#define DMA_CHANNELS 12
+#define DMA_CH_READ_ADDR 0x00
+#define DMA_CH_WRITE_ADDR 0x04
+#define DMA_CH_TRANS_COUNT 0x08
+#define DMA_CH_CTRL_TRIG 0x0C
+#define DMA_CTRL_EN BIT(0)
+#define DMA_CTRL_INCR_READ BIT(4)
+#define DMA_CTRL_INCR_WRITE BIT(5)
+#define DMA_CTRL_SNIFF_EN BIT(23)
+#define DMA_CTRL_WRITE_ERROR BIT(29)
+#define DMA_CTRL_AHB_ERROR BIT(31)
+#define DMA_SNIFF_CTRL (DMA_BASE + 0x434)
+#define DMA_SNIFF_CTRL_EN BIT(0)
+#define DMA_SNIFF_CTRL_DMACH__SHIFT 1
+#define DMA_SNIFF_CTRL_CALC__SHIFT 5
+#define DMA_SNIFF_CTRL_CALC_CRC32 0
+#define DMA_SNIFF_CTRL_CALC_CRC32R 1
+#define DMA_SNIFF_CTRL_OUT_REV BIT(10)
+#define DMA_SNIFF_CTRL_OUT_INV BIT(11)
+#define DMA_SNIFF_DATA (DMA_BASE + 0x438)
+#define CRC32_POLY 0x04C11DB7
+
+// Cycles of the transaction, counted from the start bit ([1] B4.2)
+#define CYCLE_PARK 7
+#define CYCLE_ACK 8 // ACK bit 0 driven after this edge
+#define CYCLE_READ_DATA 11
+#define CYCLE_READ_PARITY 43
+#define CYCLE_WRITE_DATA 13
+#define CYCLE_WRITE_PARITY 45
+#define CYCLE_FAILED_END 12
+#define CYCLE_END 45
+
+#define LINE_RESET_CYCLES 50
+#define ACTIVATION_BITS 12 // 4 low cycles and the activation code
+#define ACTIVATION_SWD 0x1A
+
+// Boot ROM: the function table lists hooks, which run natively ([4])
+#define SIM_ROM_SIZE 0x4000
+#define ROM_TABLE_POINTERS 0x14 // function table, data table, lookup
+#define ROM_FUNC_TABLE 0x100
+#define ROM_DATA_TABLE 0x180
+#define ROM_FUNC_BASE 0x200
+#define ROM_CODE(c1, c2) ((c1) | (c2) << 8)
+
+// Flash appears in all four XIP aliases (cached, no allocate, ...)
+#define XIP_BASE SIM_FLASH_BASE
+#define XIP_END 0x14000000U
+#define XIP_ALIAS_MASK 0x00FFFFFFU
+#define FLASH_SECTOR_SIZE 4096
+#define FLASH_PAGE_SIZE 256
+
+#define SIM_REGS 20
+#define SIM_OTHER_WORDS 256
+
+enum TSimState {
+    SimDormant,
+    SimReset,   // line reset seen, waiting for the first idle cycle
+    SimIdle,
+    SimTransaction,
+    SimLockout  // protocol error or deselected, waiting for line reset
+};
+
+struct CSimTarget {
+    struct CSimTarget* m_pNext;
+    unsigned m_nClockPin;
+    unsigned m_nDataPin;
+    unsigned m_nResetPin;
+    uint32_t m_nTargetSel;
+    struct TSimFaults m_Faults;
+    unsigned m_nAPRequests;
+    unsigned m_nReads;
+    uint64_t m_nCycles;
+
+    // Line state
+    enum TSimState m_State;
+    int m_bSelected;
+    unsigned m_nOnes;
+    uint32_t m_Alert[4]; // last 128 bits seen, oldest in bit 0 of word 0
+    int m_nActivation;   // bits seen after the alert, -1 if none
+    uint32_t m_nActivationBits;
+    int m_bDriving;
+    unsigned m_nDriveLevel;
+    unsigned m_nSample;
+    uint64_t m_nLastRise; // nanos, with m_Faults.m_nMaxClockKHz
+    int m_bTooFast;
+
+    // Transaction state
+    unsigned m_nCycle;
+    unsigned m_nEnd;
+    uint8_t m_nRequest;
+    int m_bTargetSel;
+    unsigned m_nAck;
+    uint32_t m_nData;
+    unsigned m_nParity;
+
+    // DP and MEM-AP
+    uint32_t m_nCtrlStat;
+    uint32_t m_nSelect;
+    uint32_t m_nReadBuf;
+    uint32_t m_nCSW;
+    uint32_t m_nTAR;
+
+    // Core debug and memory
+    uint32_t m_nDHCSR;
+    uint32_t m_nDCRDR;
+    uint32_t m_Regs[SIM_REGS];
+    int m_bExecuting;
+    unsigned m_nResets;
+    uint32_t* m_pRAM;
+    uint32_t* m_pFlash;
+    int m_bXIP; // flash is readable through the XIP window
+    uint32_t m_OtherAddress[SIM_OTHER_WORDS];
+    uint32_t m_OtherData[SIM_OTHER_WORDS];
+    unsigned m_nOthers;
+    uint32_t m_nSniffData;
+};
+
+static const uint32_t s_Alert[4] = {0x6209F392U, 0x86852D95U, 0xE3DDAFE9U,
+                                    0x19BC0EA2U};
+
+static struct CSimTarget* s_pTargets;
+static int s_HostOutput[SIMGPIO_PINS];
+static unsigned s_HostLevel[SIMGPIO_PINS];
+
+static void ResetTarget(struct CSimTarget* target) {
+    target->m_State = SimDormant;
+    target->m_bSelected = 1;
+    target->m_nOnes = 0;
+    memset(target->m_Alert, 0, sizeof(target->m_Alert));
+    target->m_nActivation = -1;
+    target->m_bDriving = 0;
+    target->m_nCtrlStat = 0;
+    target->m_nSelect = 0;
+    target->m_nReadBuf = 0;
+    target->m_nCSW = 0;
+    target->m_nTAR = 0;
+    target->m_nDHCSR = 0;
+}
+
+struct CSimTarget* SimTargetAttach(unsigned nClockPin, unsigned nDataPin,
+                                   unsigned nResetPin, uint32_t nTargetSel) {
+    assert(nClockPin < SIMGPIO_PINS && nDataPin < SIMGPIO_PINS &&
+           nResetPin < SIMGPIO_PINS);
+    struct CSimTarget* target = calloc(1, sizeof(struct CSimTarget));
+    assert(target);
+    target->m_pRAM = calloc(1, SIM_RAM_SIZE);
+    assert(target->m_pRAM);
+    target->m_pFlash = malloc(SIM_FLASH_SIZE);
+    assert(target->m_pFlash);
+    memset(target->m_pFlash, 0xFF, SIM_FLASH_SIZE);
+    target->m_bXIP = 1; // booted from flash
+    target->m_nClockPin = nClockPin;
+    target->m_nDataPin = nDataPin;
+    target->m_nResetPin = nResetPin;
+    target->m_nTargetSel = nTargetSel;
+    ResetTarget(target);
+    struct CSimTarget** ppTarget = &s_pTargets;
+    while (*ppTarget)
+        ppTarget = &(*ppTarget)->m_pNext;
+    *ppTarget = target;
+    return target;
+}
+
+void SimTargetDetachAll(void) {
+    while (s_pTargets) {
+        struct CSimTarget* target = s_pTargets;
+        s_pTargets = target->m_pNext;
+        free(target->m_pRAM);
+        free(target->m_pFlash);
+        free(target);
+    }
+}
+
+void SimTargetSetFaults(struct CSimTarget* target,
+                        const struct TSimFaults* pFaults) {
+    target->m_Faults = *pFaults;
+    target->m_bTooFast = 0;
+    target->m_nAPRequests = 0;
+    target->m_nReads = 0;
+}
+
+uint32_t* SimTargetMemory(struct CSimTarget* target, uint32_t nAddress) {
+    nAddress &= ~3U;
+    if (nAddress >= SIM_RAM_BASE && nAddress - SIM_RAM_BASE < SIM_RAM_SIZE)
+        return &target->m_pRAM[(nAddress - SIM_RAM_BASE) / 4];
+    if (nAddress >= XIP_BASE && nAddress < XIP_END &&
+        (nAddress & XIP_ALIAS_MASK) < SIM_FLASH_SIZE)
+        return &target->m_pFlash[(nAddress & XIP_ALIAS_MASK) / 4];
+    for (unsigned i = 0; i < target->m_nOthers; i++)
+        if (target->m_OtherAddress[i] == nAddress)
+            return &target->m_OtherData[i];
+    return 0;
+}
+
+uint32_t SimTargetRegister(struct CSimTarget* target, unsigned nRegister) {
+    assert(nRegister < SIM_REGS);
+    return target->m_Regs[nRegister];
+}
+
+int SimTargetRunning(struct CSimTarget* target) {
+    return !(target->m_nDHCSR & DHCSR_C_DEBUGEN) ||
+           !(target->m_nDHCSR & DHCSR_C_HALT);
+}
+
+unsigned SimTargetResets(struct CSimTarget* target) {
+    return target->m_nResets;
+}
+
+uint64_t SimTargetCycles(struct CSimTarget* target) {
+    return target->m_nCycles;
+}
+
+static uint32_t Reverse(uint32_t nValue) {
+    uint32_t nResult = 0;
+    for (unsigned i = 0; i < 32; i++, nValue >>= 1)
+        nResult = (nResult << 1) | (nValue & 1);
+    return nResult;
+}
+
+// Function table entries are a code and a pointer, halfwords each
+static const uint16_t s_RomFunctions[] = {
+    ROM_CODE('I', 'F'), // connect_internal_flash
+    ROM_CODE('E', 'X'), // flash_exit_xip
+    ROM_CODE('R', 'E'), // flash_range_erase
+    ROM_CODE('R', 'P'), // flash_range_program
+    ROM_CODE('F', 'C'), // flash_flush_cache
+    ROM_CODE('C', 'X'), // flash_enter_cmd_xip
+};
+
+#define ROM_FUNCTIONS (sizeof(s_RomFunctions) / sizeof(s_RomFunctions[0]))
+
+static uint32_t ReadROM(uint32_t nAddress) {
+    if (nAddress == ROM_TABLE_POINTERS)
+        return ROM_FUNC_TABLE | ROM_DATA_TABLE << 16;
+    if (nAddress >= ROM_FUNC_TABLE && nAddress < ROM_DATA_TABLE) {
+        unsigned nIndex = (nAddress - ROM_FUNC_TABLE) / 4;
+        if (nIndex < ROM_FUNCTIONS)
+            return s_RomFunctions[nIndex] |
+                   (ROM_FUNC_BASE + nIndex * 4 + 1) << 16;
+    }
+    return 0; // also terminates both tables
+}
+
+static uint32_t ReadMemory(struct CSimTarget* target, uint32_t nAddress) {
+    if (nAddress < SIM_ROM_SIZE)
+        return ReadROM(nAddress & ~3U);
+    if (nAddress >= XIP_BASE && nAddress < XIP_END && !target->m_bXIP)
+        return 0; // the SSI is not in XIP mode
+    switch (nAddress) {
+    case DHCSR: {
+        uint32_t nValue = target->m_nDHCSR | DHCSR_S_REGRDY;
+        if (!SimTargetRunning(target))
+            nValue |= DHCSR_S_HALT;
+        return nValue;
+    }
+    case DCRDR:
+        return target->m_nDCRDR;
+    case RESETS_RESET_DONE:
+        return RESETS_ALL;
+    case DMA_SNIFF_DATA: {
+        uint32_t nSniffCtrl = ReadMemory(target, DMA_SNIFF_CTRL);
+        uint32_t nValue = target->m_nSniffData;
+        if (nSniffCtrl & DMA_SNIFF_CTRL_OUT_REV)
+            nValue = Reverse(nValue);
+        if (nSniffCtrl & DMA_SNIFF_CTRL_OUT_INV)
+            nValue = ~nValue;
+        return nValue;
+    }
+    default: {
+        uint32_t* pWord = SimTargetMemory(target, nAddress);
+        return pWord ? *pWord : 0;
+    }
+    }
+}
+
+static void WriteMemory(struct CSimTarget* target, uint32_t nAddress,
+                        uint32_t nData);
+static void Execute(struct CSimTarget* target);
+
+// Sniffer CRC as in the RP2040 datasheet: MSB first, bit 31 of the data
+// word first, so CALC_CRC32R feeds byte 0 bit 0 first
+static void Sniff(struct CSimTarget* target, uint32_t nData) {
+    unsigned nCalc = (ReadMemory(target, DMA_SNIFF_CTRL) >>
+                      DMA_SNIFF_CTRL_CALC__SHIFT) & 0xF;
+    if (nCalc == DMA_SNIFF_CTRL_CALC_CRC32R)
+        nData = Reverse(nData);
+    else if (nCalc != DMA_SNIFF_CTRL_CALC_CRC32)
+        return;
+    uint32_t nCRC = target->m_nSniffData;
+    for (unsigned i = 0; i < 32; i++, nData <<= 1)
+        nCRC = (nCRC << 1) ^ ((nCRC ^ nData) >> 31 ? CRC32_POLY : 0);
+    target->m_nSniffData = nCRC;
+}
+
+// ROM and the XIP window take no writes (XIP_CTRL_ERR_BADWRITE as at reset)
+static int ReadOnly(uint32_t nAddress) {
+    return nAddress < SIM_ROM_SIZE ||
+           (nAddress >= XIP_BASE && nAddress < XIP_END);
+}
+
+// Word transfers only, the channel is idle again when this returns. A write
+// to read-only memory stops it with a bus error.
+static void RunDMA(struct CSimTarget* target, uint32_t nChannelBase) {
+    uint32_t nCtrl = ReadMemory(target, nChannelBase + DMA_CH_CTRL_TRIG);
+    if (!(nCtrl & DMA_CTRL_EN))
+        return;
+    uint32_t nRead = ReadMemory(target, nChannelBase + DMA_CH_READ_ADDR);
+    uint32_t nWrite = ReadMemory(target, nChannelBase + DMA_CH_WRITE_ADDR);
+    uint32_t nCount = ReadMemory(target, nChannelBase + DMA_CH_TRANS_COUNT);
+    uint32_t nSniffCtrl = ReadMemory(target, DMA_SNIFF_CTRL);
+    unsigned nChannel = (nChannelBase - DMA_BASE) / 0x40;
+    int bSniff =
+        (nCtrl & DMA_CTRL_SNIFF_EN) && (nSniffCtrl & DMA_SNIFF_CTRL_EN) &&
+        ((nSniffCtrl >> DMA_SNIFF_CTRL_DMACH__SHIFT) & 0xF) == nChannel;
+    for (; nCount; nCount--) {
+        if (ReadOnly(nWrite)) {
+            *SimTargetMemory(target, nChannelBase + DMA_CH_CTRL_TRIG) |=
+                DMA_CTRL_WRITE_ERROR | DMA_CTRL_AHB_ERROR;
+            break;
+        }
+        uint32_t nData = ReadMemory(target, nRead);
+        WriteMemory(target, nWrite, nData);
+        if (bSniff)
+            Sniff(target, nData);
+        if (nCtrl & DMA_CTRL_INCR_READ)
+            nRead += 4;
+        if (nCtrl & DMA_CTRL_INCR_WRITE)
+            nWrite += 4;
+    }
+    WriteMemory(target, nChannelBase + DMA_CH_READ_ADDR, nRead);
+    WriteMemory(target, nChannelBase + DMA_CH_WRITE_ADDR, nWrite);
+    WriteMemory(target, nChannelBase + DMA_CH_TRANS_COUNT, nCount);
+}
+
+static void WriteMemory(struct CSimTarget* target, uint32_t nAddress,
+                        uint32_t nData) {
+    switch (nAddress) {
+    case DHCSR:
+        if ((nData >> 16) == DHCSR_DBGKEY) {
+            target->m_nDHCSR = nData & 0xF;
+            Execute(target);
+        }
+        break;
+    case DCRSR: {
+        unsigned nRegister = nData & 0x1F;
+        if (nRegister >= SIM_REGS)
+            break;
+        if (nData & DCRSR_REGW_N_R)
+            target->m_Regs[nRegister] = target->m_nDCRDR;
+        else
+            target->m_nDCRDR = target->m_Regs[nRegister];
+        break;
+    }
+    case DCRDR:
+        target->m_nDCRDR = nData;
+        break;
+    case AIRCR:
+        if ((nData >> 16) == AIRCR_VECTKEY && (nData & AIRCR_SYSRESETREQ)) {
+            // the debug logic is not reset, the core boots from flash
+            memset(target->m_Regs, 0, sizeof(target->m_Regs));
+            target->m_nDHCSR &= ~DHCSR_C_HALT;
+            target->m_bXIP = 1;
+            target->m_nResets++;
+        }
+        break;
+    case DMA_SNIFF_DATA:
+        target->m_nSniffData = nData;
+        break;
+    default: {
+        if (ReadOnly(nAddress))
+            break;
+        uint32_t* pWord = SimTargetMemory(target, nAddress);
+        if (!pWord && target->m_nOthers < SIM_OTHER_WORDS) {
+            // anything outside SRAM behaves as a plain register
+            target->m_OtherAddress[target->m_nOthers] = nAddress & ~3U;
+            pWord = &target->m_OtherData[target->m_nOthers++];
+        }
+        if (pWord)
+            *pWord = nData;
+        if (nAddress >= DMA_BASE &&
+            nAddress < DMA_BASE + DMA_CHANNELS * 0x40 &&
+            (nAddress & 0x3F) == DMA_CH_CTRL_TRIG)
+            RunDMA(target, nAddress & ~0x3FU);
+        break;
+    }
+    }
+}
+
+// Core: a Thumb subset, enough for the loader's stubs. Once released from
+// halt the core runs synchronously until it branches to itself, hits BKPT
+// or an instruction outside the subset, or SIM_MAX_STEPS have been executed.
+
+static uint32_t ReadByteLane(struct CSimTarget* target, uint32_t nAddress,
+                             unsigned nBytes) {
+    unsigned nShift = (nAddress & 3) * 8;
+    uint32_t nWord = ReadMemory(target, nAddress & ~3U) >> nShift;
+    return nBytes == 4 ? nWord : nWord & ((1U << (nBytes * 8)) - 1);
+}
+
+static void WriteByteLane(struct CSimTarget* target, uint32_t nAddress,
+                          unsigned nBytes, uint32_t nData) {
+    if (nBytes == 4) {
+        WriteMemory(target, nAddress & ~3U, nData);
+        return;
+    }
+    unsigned nShift = (nAddress & 3) * 8;
+    uint32_t nMask = ((1U << (nBytes * 8)) - 1) << nShift;
+    uint32_t nWord = ReadMemory(target, nAddress & ~3U);
+    WriteMemory(target, nAddress & ~3U,
+                (nWord & ~nMask) | ((nData << nShift) & nMask));
+}
+
+static void SetNZ(struct CSimTarget* target, uint32_t nResult) {
+    uint32_t* pPSR = &target->m_Regs[REG_XPSR];
+    *pPSR &= ~(XPSR_N | XPSR_Z);
+    if (nResult & BIT(31))
+        *pPSR |= XPSR_N;
+    if (!nResult)
+        *pPSR |= XPSR_Z;
+}
+
+// [2] A2.2.1
+static uint32_t AddWithCarry(struct CSimTarget* target, uint32_t x, uint32_t y,
+                             unsigned nCarry) {
+    uint64_t nUnsigned = (uint64_t)x + y + nCarry;
+    uint32_t nResult = (uint32_t)nUnsigned;
+    SetNZ(target, nResult);
+    uint32_t* pPSR = &target->m_Regs[REG_XPSR];
+    *pPSR &= ~(XPSR_C | XPSR_V);
+    if (nUnsigned >> 32)
+        *pPSR |= XPSR_C;
+    if (~(x ^ y) & (x ^ nResult) & BIT(31))
+        *pPSR |= XPSR_V;
+    return nResult;
+}
+
+static int ConditionPassed(uint32_t nPSR, unsigned nCond) {
+    int n = !!(nPSR & XPSR_N), z = !!(nPSR & XPSR_Z), c = !!(nPSR & XPSR_C),
+        v = !!(nPSR & XPSR_V);
+    int bResult;
+    switch (nCond >> 1) {
+    case 0: // EQ
+        bResult = z;
+        break;
+    case 1: // CS
+        bResult = c;
+        break;
+    case 2: // MI
+        bResult = n;
+        break;
+    case 3: // VS
+        bResult = v;
+        break;
+    case 4: // HI
+        bResult = c && !z;
+        break;
+    case 5: // GE
+        bResult = n == v;
+        break;
+    case 6: // GT
+        bResult = n == v && !z;
+        break;
+    default:
+        return 1;
+    }
+    return nCond & 1 ? !bResult : bResult;
+}
+
+static int Advance(struct CSimTarget* target, uint32_t nNextPC) {
+    if (nNextPC == target->m_Regs[15])
+        return 0; // waiting for the debugger
+    target->m_Regs[15] = nNextPC;
+    return 1;
+}
+
+// Flash functions of the boot ROM, with their documented argument checks.
+// Erase and program do nothing unless flash_exit_xip has been called.
+static int CallROM(struct CSimTarget* target, uint32_t nPC) {
+    uint32_t* r = target->m_Regs;
+    unsigned nIndex = (nPC - ROM_FUNC_BASE) / 4;
+    if (nPC < ROM_FUNC_BASE || (nPC & 3) || nIndex >= ROM_FUNCTIONS)
+        return 0;
+    switch (s_RomFunctions[nIndex]) {
+    case ROM_CODE('I', 'F'):
+    case ROM_CODE('E', 'X'):
+        target->m_bXIP = 0;
+        break;
+    case ROM_CODE('R', 'E'): // offset, count, block size, block command
+        if ((r[0] | r[1]) % FLASH_SECTOR_SIZE || r[0] + r[1] > SIM_FLASH_SIZE)
+            return 0;
+        if (!target->m_bXIP)
+            memset((uint8_t*)target->m_pFlash + r[0], 0xFF, r[1]);
+        break;
+    case ROM_CODE('R', 'P'): // offset, data, count
+        if ((r[0] | r[2]) % FLASH_PAGE_SIZE || r[0] + r[2] > SIM_FLASH_SIZE)
+            return 0;
+        for (uint32_t i = 0; i < r[2] && !target->m_bXIP; i += 4)
+            target->m_pFlash[(r[0] + i) / 4] &= ReadMemory(target, r[1] + i);
+        break;
+    case ROM_CODE('F', 'C'):
+        break;
+    case ROM_CODE('C', 'X'):
+        target->m_bXIP = 1;
+        break;
+    }
+    return Advance(target, r[14] & ~1U);
+}
+
+// \return 0 if the core stops at this instruction
+static int Step(struct CSimTarget* target) {
+    uint32_t* r = target->m_Regs;
+    uint32_t nPC = r[15];
+    if (nPC < SIM_ROM_SIZE)
+        return CallROM(target, nPC);
+    if (nPC - SIM_RAM_BASE >= SIM_RAM_SIZE)
+        return 0; // only SRAM has code
+    unsigned op = ReadByteLane(target, nPC, 2);
+    unsigned d = op & 7, n = (op >> 3) & 7, m = (op >> 6) & 7;
+    unsigned nImm5 = (op >> 6) & 0x1F, nImm8 = op & 0xFF;
+    unsigned nRdn8 = (op >> 8) & 7;
+    uint32_t nCarry = !!(r[REG_XPSR] & XPSR_C);
+    uint32_t nNextPC = nPC + 2;
+    if ((op & 0xF800) == 0x0000) { // LSLS imm
+        if (nImm5) {
+            nCarry = (r[n] >> (32 - nImm5)) & 1;
+            r[d] = r[n] << nImm5;
+        } else
+            r[d] = r[n];
+        SetNZ(target, r[d]);
+        r[REG_XPSR] = (r[REG_XPSR] & ~XPSR_C) | (nCarry ? XPSR_C : 0);
+    } else if ((op & 0xF800) == 0x0800) { // LSRS imm
+        unsigned nShift = nImm5 ? nImm5 : 32;
+        nCarry = (r[n] >> (nShift - 1)) & 1;
+        r[d] = nShift < 32 ? r[n] >> nShift : 0;
+        SetNZ(target, r[d]);
+        r[REG_XPSR] = (r[REG_XPSR] & ~XPSR_C) | (nCarry ? XPSR_C : 0);
+    } else if ((op & 0xFE00) == 0x1800) // ADDS reg
+        r[d] = AddWithCarry(target, r[n], r[m], 0);
+    else if ((op & 0xFE00) == 0x1A00) // SUBS reg
+        r[d] = AddWithCarry(target, r[n], ~r[m], 1);
+    else if ((op & 0xFE00) == 0x1C00) // ADDS imm3
+        r[d] = AddWithCarry(target, r[n], m, 0);
+    else if ((op & 0xFE00) == 0x1E00) // SUBS imm3
+        r[d] = AddWithCarry(target, r[n], ~m, 1);
+    else if ((op & 0xF800) == 0x2000) { // MOVS imm8
+        r[nRdn8] = nImm8;
+        SetNZ(target, nImm8);
+    } else if ((op & 0xF800) == 0x2800) // CMP imm8
+        AddWithCarry(target, r[nRdn8], ~nImm8, 1);
+    else if ((op & 0xF800) == 0x3000) // ADDS imm8
+        r[nRdn8] = AddWithCarry(target, r[nRdn8], nImm8, 0);
+    else if ((op & 0xF800) == 0x3800) // SUBS imm8
+        r[nRdn8] = AddWithCarry(target, r[nRdn8], ~nImm8, 1);
+    else if ((op & 0xFC00) == 0x4000) { // data processing
+        switch ((op >> 6) & 0xF) {
+        case 0x0: // ANDS
+            r[d] &= r[n];
+            break;
+        case 0x1: // EORS
+            r[d] ^= r[n];
+            break;
+        case 0x8: // TST
+            SetNZ(target, r[d] & r[n]);
+            return Advance(target, nPC + 2);
+        case 0x9: // RSBS
+            r[d] = AddWithCarry(target, ~r[n], 0, 1);
+            return Advance(target, nPC + 2);
+        case 0xA: // CMP
+            AddWithCarry(target, r[d], ~r[n], 1);
+            return Advance(target, nPC + 2);
+        case 0xB: // CMN
+            AddWithCarry(target, r[d], r[n], 0);
+            return Advance(target, nPC + 2);
+        case 0xC: // ORRS
+            r[d] |= r[n];
+            break;
+        case 0xD: // MULS
+            r[d] *= r[n];
+            break;
+        case 0xE: // BICS
+            r[d] &= ~r[n];
+            break;
+        case 0xF: // MVNS
+            r[d] = ~r[n];
+            break;
+        default:
+            return 0;
+        }
+        SetNZ(target, r[d]);
+    } else if ((op & 0xFF00) == 0x4600) { // MOV, high registers
+        unsigned nRd = d | ((op >> 4) & 8), nRm = (op >> 3) & 0xF;
+        if (nRd == 15 || nRm == 15)
+            return 0;
+        r[nRd] = r[nRm];
+    } else if ((op & 0xFF07) == 0x4700) { // BX, BLX register
+        uint32_t nTarget = r[(op >> 3) & 0xF];
+        if (op & 0x0080)
+            r[14] = (nPC + 2) | 1;
+        nNextPC = nTarget & ~1U;
+    } else if ((op & 0xF800) == 0x4800) // LDR literal
+        r[nRdn8] = ReadByteLane(target, ((nPC + 4) & ~3U) + nImm8 * 4, 4);
+    else if ((op & 0xF000) == 0x5000) { // load/store register offset
+        static const unsigned s_Size[8] = {4, 2, 1, 0, 4, 2, 1, 0};
+        unsigned nOp = (op >> 9) & 7;
+        uint32_t nAddress = r[n] + r[m];
+        if (!s_Size[nOp])
+            return 0; // LDRSB, LDRSH
+        if (nOp < 3)
+            WriteByteLane(target, nAddress, s_Size[nOp], r[d]);
+        else
+            r[d] = ReadByteLane(target, nAddress, s_Size[nOp]);
+    } else if ((op & 0xE000) == 0x6000) { // load/store immediate offset
+        unsigned nSize = op & 0x1000 ? 1 : 4;
+        uint32_t nAddress = r[n] + nImm5 * nSize;
+        if (op & 0x0800)
+            r[d] = ReadByteLane(target, nAddress, nSize);
+        else
+            WriteByteLane(target, nAddress, nSize, r[d]);
+    } else if ((op & 0xF000) == 0x8000) { // LDRH/STRH immediate
+        uint32_t nAddress = r[n] + nImm5 * 2;
+        if (op & 0x0800)
+            r[d] = ReadByteLane(target, nAddress, 2);
+        else
+            WriteByteLane(target, nAddress, 2, r[d]);
+    } else if ((op & 0xF000) == 0xD000 && (op & 0x0E00) != 0x0E00) {
+        if (ConditionPassed(r[REG_XPSR], (op >> 8) & 0xF)) // B<cond>
+            nNextPC = nPC + 4 + ((int32_t)(int8_t)nImm8 << 1);
+    } else if ((op & 0xF800) == 0xE000) // B
+        nNextPC = nPC + 4 + ((int32_t)((op & 0x7FF) << 21) >> 20);
+    else if ((op & 0xFF00) == 0xBE00) { // BKPT halts with C_DEBUGEN set
+        if (target->m_nDHCSR & DHCSR_C_DEBUGEN)
+            target->m_nDHCSR |= DHCSR_C_HALT;
+        return 0;
+    } else
+        return 0;
+    return Advance(target, nNextPC);
+}
+
+static void Execute(struct CSimTarget* target) {
+    if (target->m_bExecuting)
+        return;
+    target->m_bExecuting = 1;
+    for (unsigned i = 0; i < SIM_MAX_STEPS && SimTargetRunning(target); i++)
+        if (!Step(target))
+            break;
+    target->m_bExecuting = 0;
+}
+
+// Auto-increment only wraps within 1 KB ([1] C2.2.2)
+static void IncrementTAR(struct CSimTarget* target) {
+    if (((target->m_nCSW >> AP_CSW_ADDR_INC__SHIFT) & 3) ==
+        AP_CSW_ADDR_INC_SINGLE)
+        target->m_nTAR =
+            (target->m_nTAR & ~0x3FFU) | ((target->m_nTAR + 4) & 0x3FF);
+}
+
+static unsigned RequestAddress(uint8_t nRequest) {
+    return ((nRequest >> REQ_ADDR__SHIFT) & 3) << 2;
+}
+
+static unsigned Acknowledge(struct CSimTarget* target) {
+    uint8_t nRequest = target->m_nRequest;
+    unsigned nAddress = RequestAddress(nRequest);
+    int bRead = (nRequest & REQ_RNW) != 0;
+    // DPIDR and CTRL/STAT reads and ABORT writes work despite sticky errors
+    if (!(nRequest & REQ_APNDP) &&
+        (nAddress == DP_ABORT || (nAddress == DP_CTRL_STAT && bRead)))
+        return ACK_OK;
+    if (target->m_nCtrlStat & CS_STICKY)
+        return ACK_FAULT;
+    if (!(nRequest & REQ_APNDP))
+        return ACK_OK;
+    if (!(target->m_nCtrlStat & CS_CDBGPWRUPREQ)) {
+        target->m_nCtrlStat |= CS_STICKYERR;
+        return ACK_FAULT;
+    }
+    target->m_nAPRequests++;
+    const struct TSimFaults* pFaults = &target->m_Faults;
+    if (pFaults->m_nWaitEvery &&
+        target->m_nAPRequests % pFaults->m_nWaitEvery == 0) {
+        if (target->m_nCtrlStat & CS_ORUNDETECT)
+            target->m_nCtrlStat |= CS_STICKYORUN;
+        return ACK_WAIT;
+    }
+    if (pFaults->m_nFaultEvery &&
+        target->m_nAPRequests % pFaults->m_nFaultEvery == 0) {
+        target->m_nCtrlStat |= CS_STICKYERR;
+        return ACK_FAULT;
+    }
+    if (pFaults->m_nBadWrites && !bRead && nAddress == AP_DRW &&
+        !(target->m_nSelect & 0xFF0000F0) &&
+        target->m_nTAR == pFaults->m_nBadAddress) {
+        target->m_Faults.m_nBadWrites--;
+        target->m_nCtrlStat |= CS_STICKYERR;
+        return ACK_FAULT;
+    }
+    return ACK_OK;
+}
+
+static uint32_t ReadRegister(struct CSimTarget* target) {
+    uint8_t nRequest = target->m_nRequest;
+    unsigned nAddress = RequestAddress(nRequest);
+    if (!(nRequest & REQ_APNDP)) {
+        switch (nAddress) {
+        case DP_DPIDR:
+            return DPIDR_VALUE;
+        case DP_CTRL_STAT:
+            return (target->m_nSelect & 0xF) ? 0 : target->m_nCtrlStat;
+        default: // RESEND and RDBUFF
+            return target->m_nReadBuf;
+        }
+    }
+    // AP reads are posted, the result is returned by the next AP read or
+    // by RDBUFF
+    uint32_t nResult = target->m_nReadBuf;
+    uint32_t nValue = 0;
+    if ((target->m_nSelect >> 24) == 0)
+        switch ((target->m_nSelect & 0xF0) | nAddress) {
+        case AP_CSW:
+            nValue = target->m_nCSW;
+            break;
+        case AP_TAR:
+            nValue = target->m_nTAR;
+            break;
+        case AP_DRW:
+            nValue = ReadMemory(target, target->m_nTAR);
+            IncrementTAR(target);
+            break;
+        case AP_IDR:
+            nValue = AP_IDR_VALUE;
+            break;
+        }
+    target->m_nReadBuf = nValue;
+    return nResult;
+}
+
+static void WriteRegister(struct CSimTarget* target, uint32_t nData) {
+    uint8_t nRequest = target->m_nRequest;
+    unsigned nAddress = RequestAddress(nRequest);
+    if (!(nRequest & REQ_APNDP)) {
+        switch (nAddress) {
+        case DP_ABORT:
+            if (nData & ABORT_STKCMPCLR)
+                target->m_nCtrlStat &= ~CS_STICKYCMP;
+            if (nData & ABORT_STKERRCLR)
+                target->m_nCtrlStat &= ~CS_STICKYERR;
+            if (nData & ABORT_WDERRCLR)
+                target->m_nCtrlStat &= ~CS_WDATAERR;
+            if (nData & ABORT_ORUNERRCLR)
+                target->m_nCtrlStat &= ~CS_STICKYORUN;
+            break;
+        case DP_CTRL_STAT:
+            if (target->m_nSelect & 0xF)
+                break;
+            target->m_nCtrlStat =
+                (target->m_nCtrlStat & CS_STICKY) | (nData & CS_WRITABLE);
+            // power domains come up immediately
+            target->m_nCtrlStat |= (nData & CS_WRITABLE & ~CS_ORUNDETECT)
+                                   << 1;
+            break;
+        case DP_SELECT:
+            target->m_nSelect = nData;
+            break;
+        }
+        return;
+    }
+    if ((target->m_nSelect >> 24) != 0)
+        return;
+    switch ((target->m_nSelect & 0xF0) | nAddress) {
+    case AP_CSW:
+        target->m_nCSW = nData;
+        break;
+    case AP_TAR:
+        target->m_nTAR = nData;
+        break;
+    case AP_DRW:
+        WriteMemory(target, target->m_nTAR, nData);
+        IncrementTAR(target);
+        break;
+    }
+}
+
+static void DecodeRequest(struct CSimTarget* target) {
+    uint8_t nRequest = target->m_nRequest;
+    unsigned nParity = __builtin_parity(nRequest & 0x1E);
+    if (!(nRequest & REQ_START) || (nRequest & REQ_STOP) ||
+        !(nRequest & REQ_PARK) || nParity != !!(nRequest & REQ_PARITY)) {
+        // no response, the host has to do a line reset
+        target->m_State = SimLockout;
+        return;
+    }
+    target->m_bTargetSel = !(nRequest & (REQ_APNDP | REQ_RNW)) &&
+                           RequestAddress(nRequest) == DP_TARGETSEL;
+    target->m_nEnd = CYCLE_END;
+    if (!target->m_bTargetSel && !target->m_bSelected)
+        target->m_State = SimLockout;
+}
+
+static void Drive(struct CSimTarget* target, unsigned nLevel) {
+    target->m_bDriving = 1;
+    target->m_nDriveLevel = nLevel & 1;
+}
+
+static void TransactionCycle(struct CSimTarget* target, unsigned nBit) {
+    unsigned nCycle = target->m_nCycle++;
+    if (nCycle <= CYCLE_PARK) {
+        target->m_nRequest |= nBit << nCycle;
+        if (nCycle == CYCLE_PARK)
+            DecodeRequest(target);
+        return;
+    }
+    if (target->m_bTargetSel) {
+        if (nCycle >= CYCLE_WRITE_DATA && nCycle < CYCLE_WRITE_PARITY)
+            target->m_nData |= nBit << (nCycle - CYCLE_WRITE_DATA);
+        else if (nCycle == CYCLE_WRITE_PARITY)
+            target->m_bSelected =
+                target->m_nData == target->m_nTargetSel &&
+                nBit == (unsigned)__builtin_parity(target->m_nData);
+    } else if (nCycle == CYCLE_ACK) {
+        target->m_nAck = Acknowledge(target);
+        if (target->m_nAck != ACK_OK &&
+            !(target->m_nCtrlStat & CS_ORUNDETECT))
+            target->m_nEnd = CYCLE_FAILED_END;
+        Drive(target, target->m_nAck);
+    } else if (nCycle < CYCLE_READ_DATA)
+        Drive(target, target->m_nAck >> (nCycle - CYCLE_ACK));
+    else if (target->m_nAck != ACK_OK)
+        target->m_bDriving = 0; // data phase ignored
+    else if (target->m_nRequest & REQ_RNW) {
+        if (nCycle == CYCLE_READ_DATA) {
+            target->m_nData = ReadRegister(target);
+            target->m_nParity = __builtin_parity(target->m_nData);
+            const struct TSimFaults* pFaults = &target->m_Faults;
+            if (pFaults->m_nParityEvery &&
+                ++target->m_nReads % pFaults->m_nParityEvery == 0)
+                target->m_nParity ^= 1;
+        }
+        if (nCycle < CYCLE_READ_PARITY)
+            Drive(target, target->m_nData >> (nCycle - CYCLE_READ_DATA));
+        else if (nCycle == CYCLE_READ_PARITY)
+            Drive(target, target->m_nParity);
+        else
+            target->m_bDriving = 0;
+    } else {
+        target->m_bDriving = 0;
+        if (nCycle >= CYCLE_WRITE_DATA && nCycle < CYCLE_WRITE_PARITY)
+            target->m_nData |= nBit << (nCycle - CYCLE_WRITE_DATA);
+        else if (nCycle == CYCLE_WRITE_PARITY) {
+            if (nBit == (unsigned)__builtin_parity(target->m_nData))
+                WriteRegister(target, target->m_nData);
+            else
+                target->m_nCtrlStat |= CS_WDATAERR;
+        }
+    }
+    if (nCycle >= target->m_nEnd) {
+        target->m_bDriving = 0;
+        target->m_State = SimIdle;
+    }
+}
+
+// Dormant to SWD activation is watched for in every state ([1] B5.3.4)
+static void WatchActivation(struct CSimTarget* target, unsigned nBit) {
+    if (target->m_nActivation >= 0) {
+        target->m_nActivationBits |= nBit << target->m_nActivation;
+        if (++target->m_nActivation == ACTIVATION_BITS) {
+            target->m_nActivation = -1;
+            if ((target->m_nActivationBits >> 4) == ACTIVATION_SWD) {
+                target->m_State = SimReset;
+                target->m_nOnes = 0;
+            }
+        }
+    }
+    unsigned nCarry = nBit;
+    for (int i = 3; i >= 0; i--) {
+        unsigned nOut = target->m_Alert[i] & 1;
+        target->m_Alert[i] = (target->m_Alert[i] >> 1) | (nCarry << 31);
+        nCarry = nOut;
+    }
+    if (!memcmp(target->m_Alert, s_Alert, sizeof(s_Alert))) {
+        target->m_nActivation = 0;
+        target->m_nActivationBits = 0;
+    }
+}
+
+static void ClockTarget(struct CSimTarget* target, unsigned nBit) {
+    target->m_nCycles++;
+    int bDriving = target->m_bDriving;
+    if (!bDriving)
+        WatchActivation(target, nBit);
+    if (target->m_State == SimDormant)
+        return;
+    if (!bDriving) {
+        if (nBit) {
+            if (++target->m_nOnes >= LINE_RESET_CYCLES &&
+                target->m_State != SimReset) {
+                target->m_State = SimReset;
+                target->m_bSelected = 1;
+                target->m_bDriving = 0;
+                return;
+            }
+        } else
+            target->m_nOnes = 0;
+    }
+    switch (target->m_State) {
+    case SimReset:
+        if (!nBit)
+            target->m_State = SimIdle;
+        break;
+    case SimIdle:
+        if (nBit) {
+            target->m_State = SimTransaction;
+            target->m_nRequest = REQ_START;
+            target->m_nCycle = 1;
+            target->m_nData = 0;
+            target->m_bTargetSel = 0;
+        }
+        break;
+    case SimTransaction:
+        TransactionCycle(target, nBit);
+        break;
+    default:
+        break;
+    }
+}
+
+// Too short a clock period corrupts what the host samples
+static void CheckClockRate(struct CSimTarget* target) {
+    if (!target->m_Faults.m_nMaxClockKHz)
+        return;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t nNow = (uint64_t)ts.tv_sec * 1000000000U + ts.tv_nsec;
+    target->m_bTooFast = nNow - target->m_nLastRise <
+                         1000000U / target->m_Faults.m_nMaxClockKHz;
+    target->m_nLastRise = nNow;
+}
+
+void SimPinMode(unsigned nPin, int bOutput) {
+    assert(nPin < SIMGPIO_PINS);
+    s_HostOutput[nPin] = bOutput;
+}
+
+void SimPinWrite(unsigned nPin, unsigned nLevel) {
+    assert(nPin < SIMGPIO_PINS);
+    unsigned nOld = s_HostLevel[nPin];
+    s_HostLevel[nPin] = nLevel;
+    if (!s_HostOutput[nPin] || nOld == nLevel)
+        return;
+    struct CSimTarget* target;
+    if (nLevel) {
+        // all targets sample the line before any of them drives it
+        for (target = s_pTargets; target; target = target->m_pNext)
+            if (target->m_nClockPin == nPin)
+                target->m_nSample = SimPinRead(target->m_nDataPin);
+        for (target = s_pTargets; target; target = target->m_pNext)
+            if (target->m_nClockPin == nPin) {
+                CheckClockRate(target);
+                ClockTarget(target, target->m_nSample);
+            }
+    } else
+        for (target = s_pTargets; target; target = target->m_pNext)
+            if (target->m_nResetPin && target->m_nResetPin == nPin)
+                ResetTarget(target);
+}
+
+unsigned SimPinRead(unsigned nPin) {
+    assert(nPin < SIMGPIO_PINS);
+    for (struct CSimTarget* target = s_pTargets; target;
+         target = target->m_pNext)
+        if (target->m_nDataPin == nPin && target->m_bDriving)
+            return target->m_nDriveLevel ^ target->m_bTooFast;
+    if (s_HostOutput[nPin])
+        return s_HostLevel[nPin];
+    return 1; // SWDIO pull-up
+}
+
+#endif
@@ -0,0 +1,95 @@
+//
+// simtarget.h
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _pico_simtarget_h
+#define _pico_simtarget_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// Bit level model of an RP2040 SW-DP and its AHB MEM-AP, driven by the
+// USE_SIMGPIO backend. Targets sample SWDIO on rising SWCLK edges and
+// change their output right after them, as the real SW-DP does. Released
+// from halt, the core runs a Thumb subset from SRAM until it waits in a
+// branch to itself, which is enough for the loader's stubs. The boot ROM
+// only has a function table, its flash functions act directly on a flash
+// model behind the XIP window.
+
+#define SIMGPIO_PINS 64
+
+#define SIM_RAM_BASE 0x20000000U
+#define SIM_RAM_SIZE (264 * 1024)
+#define SIM_FLASH_BASE 0x10000000U
+#define SIM_FLASH_SIZE (2 * 1024 * 1024)
+
+#define SIM_TARGETSEL_CORE0 0x01002927
+#define SIM_TARGETSEL_CORE1 0x11002927
+
+// Error injection, each counter selects every Nth request (0 = never)
+struct TSimFaults {
+    unsigned m_nWaitEvery;   // AP requests answered with WAIT
+    unsigned m_nFaultEvery;  // AP requests answered with FAULT
+    unsigned m_nParityEvery; // read data sent with a bad parity bit
+    unsigned m_nMaxClockKHz; // faster SWCLK inverts the bits read back
+    uint32_t m_nBadAddress;  // DRW writes to this word are answered with
+    unsigned m_nBadWrites;   // FAULT, this many times
+};
+
+struct CSimTarget;
+
+/// \brief Attach a simulated RP2040 SW-DP to a set of pins
+/// \param nClockPin SWCLK pin
+/// \param nDataPin SWDIO pin, may be shared with other targets (multidrop)
+/// \param nResetPin RUN pin (active LOW), 0 if not connected
+/// \param nTargetSel TARGETSEL value selecting this DP, including TINSTANCE
+struct CSimTarget* SimTargetAttach(unsigned nClockPin, unsigned nDataPin,
+                                   unsigned nResetPin, uint32_t nTargetSel);
+
+/// \brief Detach and free all targets
+void SimTargetDetachAll(void);
+
+void SimTargetSetFaults(struct CSimTarget* target,
+                        const struct TSimFaults* pFaults);
+
+/// \brief Back door access to target memory (SRAM, flash), bypassing SWD
+/// \return Pointer to the word, 0 if not backed by the model
+uint32_t* SimTargetMemory(struct CSimTarget* target, uint32_t nAddress);
+
+/// \return Core register (DCRSR REGSEL numbering)
+uint32_t SimTargetRegister(struct CSimTarget* target, unsigned nRegister);
+
+/// \return Core has been released from halt
+int SimTargetRunning(struct CSimTarget* target);
+
+/// \return Number of system resets requested through AIRCR
+unsigned SimTargetResets(struct CSimTarget* target);
+
+/// \return Number of clock cycles seen by the target
+uint64_t SimTargetCycles(struct CSimTarget* target);
+
+// Host side of the simulated GPIO bank, used by gpiopin.c
+void SimPinMode(unsigned nPin, int bOutput);
+void SimPinWrite(unsigned nPin, unsigned nLevel);
+unsigned SimPinRead(unsigned nPin);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
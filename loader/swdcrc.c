@@ -0,0 +1,35 @@
+//
+// swdcrc.c
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "swdcrc.h"
+
+// Reflected polynomial 0xEDB88320, one nibble at a time
+static const uint32_t s_Table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4,
+    0x4DB26158, 0x5005713C, 0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+
+uint32_t CRC32(uint32_t nCRC, const void* pData, size_t nSize) {
+    const uint8_t* p = (const uint8_t*)pData;
+    nCRC = ~nCRC;
+    while (nSize--) {
+        nCRC ^= *p++;
+        nCRC = (nCRC >> 4) ^ s_Table[nCRC & 0xF];
+        nCRC = (nCRC >> 4) ^ s_Table[nCRC & 0xF];
+    }
+    return ~nCRC;
+}
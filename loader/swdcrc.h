@@ -0,0 +1,37 @@
+//
+// swdcrc.h
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _pico_swdcrc_h
+#define _pico_swdcrc_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// \brief Standard CRC32 (IEEE 802.3, zlib)
+/// \param nCRC Result of the previous call, 0 for the first one
+/// \note Matches the RP2040 DMA sniffer with bit reversed data, seed
+/// 0xFFFFFFFF and the result reversed and inverted
+uint32_t CRC32(uint32_t nCRC, const void* pData, size_t nSize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,226 @@
+//
+// swddaemon.c
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "swddaemon.h"
+#include "swdregs.h"
+
+#define DAEMON_BACKLOG 8
+#define DAEMON_IDLE_SECONDS 60 // a silent client is dropped after this
+#define DAEMON_MAX_REPLY (DAEMON_MAX_READ_WORDS * 9 + 64)
+
+static int OpenSocket(const char* pSocketPath, struct sockaddr_un* pAddress) {
+    memset(pAddress, 0, sizeof(*pAddress));
+    pAddress->sun_family = AF_UNIX;
+    if (strlen(pSocketPath) >= sizeof(pAddress->sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", pSocketPath);
+        return -1;
+    }
+    strcpy(pAddress->sun_path, pSocketPath);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        fprintf(stderr, "Cannot create socket (%s)\n", strerror(errno));
+    return fd;
+}
+
+static int SendReply(int fd, const char* pReply) {
+    size_t nLength = strlen(pReply);
+    while (nLength) {
+        ssize_t nSent = send(fd, pReply, nLength, MSG_NOSIGNAL);
+        if (nSent < 0 && errno == EINTR)
+            continue;
+        if (nSent <= 0)
+            return 0;
+        pReply += nSent;
+        nLength -= nSent;
+    }
+    return 1;
+}
+
+static int ParseNumber(const char* pToken, uint32_t* pValue) {
+    char* pEnd;
+    if (!pToken)
+        return 0;
+    errno = 0;
+    unsigned long nValue = strtoul(pToken, &pEnd, 0);
+    if (errno || *pEnd || pEnd == pToken || nValue > UINT32_MAX)
+        return 0;
+    *pValue = nValue;
+    return 1;
+}
+
+static int Load(struct CSWDLoader* loader, const char* pFileName) {
+    struct CSWDImage image;
+    if (!SWDImageRead(&image, pFileName, SRAM_BASE))
+        return 0;
+    // all segments in one memory, checked by the load function
+    int bOK = image.m_pSegments[0].m_nAddress < SRAM_BASE
+                  ? SWDFlash(loader, &image)
+                  : SWDLoadImage(loader, &image);
+    SWDImageFree(&image);
+    return bOK;
+}
+
+static int Read(struct CSWDLoader* loader, uint32_t nAddress,
+                uint32_t nWords, char* pReply) {
+    uint32_t Data[DAEMON_MAX_READ_WORDS];
+    if (!SWDReadBlock(loader, nAddress, Data, nWords * 4)) {
+        strcpy(pReply, "ERR read failed\n");
+        return 0;
+    }
+    char* p = pReply + sprintf(pReply, "OK");
+    for (uint32_t i = 0; i < nWords; i++)
+        p += sprintf(p, " %08X", Data[i]);
+    strcpy(p, "\n");
+    return 1;
+}
+
+// \return 0 if the daemon is to stop
+static int Serve(struct CSWDLoader* loader, char* pRequest, char* pReply) {
+    char* pSave;
+    const char* pCommand = strtok_r(pRequest, " \t\r\n", &pSave);
+    const char* pArg1 = strtok_r(0, " \t\r\n", &pSave);
+    const char* pArg2 = strtok_r(0, " \t\r\n", &pSave);
+    uint32_t nAddress, nWords = 1;
+    strcpy(pReply, "OK\n");
+    if (!pCommand)
+        strcpy(pReply, "ERR empty request\n");
+    else if (!strcmp(pCommand, "quit"))
+        return 0;
+    else if (!SWDCheckConnection(loader))
+        strcpy(pReply, "ERR target does not respond\n");
+    else if (!strcmp(pCommand, "load")) {
+        if (!pArg1)
+            strcpy(pReply, "ERR file name required\n");
+        else if (!Load(loader, pArg1))
+            strcpy(pReply, "ERR load failed\n");
+    } else if (!strcmp(pCommand, "halt")) {
+        if (!SWDHalt(loader))
+            strcpy(pReply, "ERR halt failed\n");
+    } else if (!strcmp(pCommand, "start")) {
+        if (!ParseNumber(pArg1, &nAddress))
+            strcpy(pReply, "ERR address required\n");
+        else if (!SWDStart(loader, nAddress))
+            strcpy(pReply, "ERR start failed\n");
+    } else if (!strcmp(pCommand, "read")) {
+        if (!ParseNumber(pArg1, &nAddress) || (nAddress & 3))
+            strcpy(pReply, "ERR word aligned address required\n");
+        else if (pArg2 && (!ParseNumber(pArg2, &nWords) || !nWords ||
+                           nWords > DAEMON_MAX_READ_WORDS))
+            sprintf(pReply, "ERR 1 to %u words\n", DAEMON_MAX_READ_WORDS);
+        else
+            Read(loader, nAddress, nWords, pReply);
+    } else
+        sprintf(pReply, "ERR unknown request %.32s\n", pCommand);
+    return 1;
+}
+
+// \return 0 if the daemon is to stop
+static int ServeClient(struct CSWDLoader* loader, int fd) {
+    struct timeval timeout = {DAEMON_IDLE_SECONDS, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    FILE* pClient = fdopen(fd, "r");
+    if (!pClient) {
+        close(fd);
+        return 1;
+    }
+    static char Request[DAEMON_MAX_REQUEST], Reply[DAEMON_MAX_REPLY];
+    int bRun = 1;
+    while (bRun && fgets(Request, sizeof(Request), pClient)) {
+        printf("Request: %s", Request);
+        if (!strchr(Request, '\n'))
+            printf("\n");
+        bRun = Serve(loader, Request, Reply);
+        fflush(stdout);
+        if (bRun && !SendReply(fd, Reply))
+            break;
+    }
+    if (!bRun)
+        SendReply(fd, "OK\n");
+    fclose(pClient);
+    return bRun;
+}
+
+int SWDDaemonRun(struct CSWDLoader* loader, const char* pSocketPath) {
+    struct sockaddr_un address;
+    int fd = OpenSocket(pSocketPath, &address);
+    if (fd < 0)
+        return 0;
+    unlink(pSocketPath); // left over from a daemon that was killed
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+        listen(fd, DAEMON_BACKLOG) < 0) {
+        fprintf(stderr, "Cannot listen on %s (%s)\n", pSocketPath,
+                strerror(errno));
+        close(fd);
+        return 0;
+    }
+    printf("Listening on %s\n", pSocketPath);
+    fflush(stdout);
+    int bOK = 1, bRun = 1;
+    while (bRun) {
+        int nClient = accept(fd, 0, 0);
+        if (nClient < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Accept failed (%s)\n", strerror(errno));
+            bOK = 0;
+            break;
+        }
+        // one client at a time, the others wait in the backlog
+        bRun = ServeClient(loader, nClient);
+    }
+    close(fd);
+    unlink(pSocketPath);
+    return bOK;
+}
+
+int SWDDaemonRequest(const char* pSocketPath, const char* pRequest) {
+    struct sockaddr_un address;
+    int fd = OpenSocket(pSocketPath, &address);
+    if (fd < 0)
+        return 0;
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        fprintf(stderr, "Cannot connect to %s (%s)\n", pSocketPath,
+                strerror(errno));
+        close(fd);
+        return 0;
+    }
+    char Request[DAEMON_MAX_REQUEST], Reply[DAEMON_MAX_REPLY];
+    snprintf(Request, sizeof(Request), "%s\n", pRequest);
+    FILE* pDaemon = fdopen(fd, "r");
+    if (!pDaemon || !SendReply(fd, Request) ||
+        !fgets(Reply, sizeof(Reply), pDaemon)) {
+        fprintf(stderr, "No reply from %s\n", pSocketPath);
+        if (pDaemon)
+            fclose(pDaemon);
+        else
+            close(fd);
+        return 0;
+    }
+    fclose(pDaemon);
+    int bOK = !strncmp(Reply, "OK", 2);
+    fputs(Reply, bOK ? stdout : stderr);
+    return bOK;
+}
@@ -0,0 +1,57 @@
+//
+// swddaemon.h
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _pico_swddaemon_h
+#define _pico_swddaemon_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "swdloader.h"
+
+// Requests are text lines on a Unix stream socket, each answered by a line
+// starting with "OK" or "ERR". A connection may carry several requests.
+//
+//  load <file>             program (flash image) or load and start an image,
+//                          flat binaries go to SRAM_BASE
+//  halt
+//  start <address>
+//  read <address> [words]  OK followed by the words in hex
+//  quit                    stop the daemon
+#define DAEMON_MAX_REQUEST 4096
+#define DAEMON_MAX_READ_WORDS 256
+
+/// \brief Serve requests on a Unix socket until a quit request, keeping the
+/// connection to the target. Before each request the DP is checked with
+/// DPIDR and CTRL/STAT reads, the handshake is only repeated if they fail or
+/// show a sticky error.
+/// \param loader Initialised loader, its settings (verify...) apply
+/// \param pSocketPath Socket to create, an existing file is replaced
+/// \return Operation successful? Errors are reported to stderr.
+int SWDDaemonRun(struct CSWDLoader* loader, const char* pSocketPath);
+
+/// \brief Send one request to a daemon
+/// \param pRequest Request line, without the newline
+/// \note The reply is copied to stdout (OK) or stderr (ERR)
+/// \return The daemon replied OK?
+int SWDDaemonRequest(const char* pSocketPath, const char* pRequest);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,49 @@
+//
+// swdengine.cpp
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "swdengine.h"
+#include "swdengine.hpp"
+
+namespace {
+
+using Engine = swd::SwdEngine<swd::DefaultBackend, swd::LoaderTiming>;
+
+// Stateless, it is made for each call and optimized away
+Engine LoaderEngine(struct CSWDLoader* loader) {
+    return Engine(swd::DefaultBackend(&loader->m_ClockPin, &loader->m_DataPin),
+                  swd::LoaderTiming(&loader->m_Timing));
+}
+
+} // namespace
+
+extern "C" {
+
+void SWDEngineWriteBits(struct CSWDLoader* loader, uint32_t nBits,
+                        unsigned nBitCount) {
+    LoaderEngine(loader).WriteBits(nBits, nBitCount);
+}
+
+uint32_t SWDEngineReadBits(struct CSWDLoader* loader, unsigned nBitCount) {
+    return LoaderEngine(loader).ReadBits(nBitCount);
+}
+
+unsigned SWDEngineRequest(struct CSWDLoader* loader, uint8_t nRequest,
+                          uint32_t* pData) {
+    return LoaderEngine(loader).Request(nRequest, pData);
+}
+
+} // extern "C"
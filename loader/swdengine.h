@@ -0,0 +1,53 @@
+//
+// swdengine.h
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _pico_swdengine_h
+#define _pico_swdengine_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "swdloader.h"
+#include "swdregs.h"
+
+// Bits clocked by SWDEngineRequest(), read or write
+#define SWD_REQUEST_BITS (7 + 1 + TURN_CYCLES + 3 + 32 + 1 + TURN_CYCLES)
+
+// C entry points of the SwdEngine (swdengine.hpp) instantiated for the GPIO
+// backend of the build, on the loader's pins and clock
+
+/// \brief Clock out nBitCount bits, LSB first
+void SWDEngineWriteBits(struct CSWDLoader* loader, uint32_t nBits,
+                        unsigned nBitCount);
+
+/// \brief Clock in nBitCount bits, LSB first
+uint32_t SWDEngineReadBits(struct CSWDLoader* loader, unsigned nBitCount);
+
+/// \brief One request with its data phase, no retries
+/// \param pData Data written, receives the data read, also if its parity
+/// is wrong
+/// \return ACK, SWD_PARITY_ERROR for corrupt read data
+unsigned SWDEngineRequest(struct CSWDLoader* loader, uint8_t nRequest,
+                          uint32_t* pData);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
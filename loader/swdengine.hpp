@@ -0,0 +1,222 @@
+//
+// swdengine.hpp
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _pico_swdengine_hpp
+#define _pico_swdengine_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "gpiopin.h"
+#include "gpiotrace.h"
+#include "swdloader.h"
+#include "swdregs.h"
+#include "swdtiming.h"
+
+namespace swd {
+
+/// \brief Bit level SWD protocol over compile-time policies. Field widths
+/// are template arguments, so the bit loops of a request (7 bit request, 3
+/// bit ACK, 32 bit data) are unrolled and the policies inlined, the parity
+/// is accumulated while the bits are shifted.
+///
+/// Backend: void Output(), void Input() set the data pin direction,
+/// void Data(unsigned) drives it, unsigned Sample() reads it,
+/// void Clock(unsigned) drives the clock pin.
+/// Timing: void HalfPeriod() ends a clock half period.
+template <class Backend, class Timing> class SwdEngine {
+  public:
+    SwdEngine(Backend backend, Timing timing)
+        : m_Backend(backend), m_Timing(timing) {}
+
+    /// \brief Clock out nCount bits, LSB first
+    template <unsigned nCount> void WriteBits(uint32_t nBits) {
+        static_assert(nCount <= 32, "at most a word");
+        m_Backend.Output();
+        WriteEach(nBits, std::make_index_sequence<nCount>());
+    }
+
+    /// \brief Clock in nCount bits, LSB first
+    template <unsigned nCount> uint32_t ReadBits() {
+        static_assert(nCount <= 32, "at most a word");
+        unsigned nParity = 0;
+        m_Backend.Input();
+        return ReadEach(nParity, std::make_index_sequence<nCount>());
+    }
+
+    /// \brief Bit count known at run time only, for line sequences
+    void WriteBits(uint32_t nBits, unsigned nCount) {
+        m_Backend.Output();
+        for (; nCount; nCount--, nBits >>= 1)
+            WriteBit(nBits & 1);
+    }
+
+    uint32_t ReadBits(unsigned nCount) {
+        m_Backend.Input();
+        uint32_t nBits = 0;
+        for (unsigned i = 0; i < nCount; i++)
+            nBits |= (uint32_t)ReadBit() << i;
+        return nBits;
+    }
+
+    /// \brief One request, with the data phase clocked whatever the ACK:
+    /// with ORUNDETECT set the DP expects it after WAIT and FAULT too ([1]
+    /// B4.2.3)
+    /// \param pData Data written, receives the data read, also if its
+    /// parity is wrong
+    /// \return ACK, SWD_PARITY_ERROR for corrupt read data
+    unsigned Request(uint8_t nRequest, uint32_t* pData) {
+        WriteBits<7>(nRequest);
+        ReadBits<1 + TURN_CYCLES>(); // park bit (not driven) and turn cycle
+        unsigned nResponse = ReadBits<3>();
+        if (nResponse == DP_OK && (nRequest & 0x04)) { // RnW
+            unsigned nParity = 0;
+            m_Backend.Input();
+            *pData = ReadEach(nParity, std::make_index_sequence<32>());
+            nParity ^= ReadBit();
+            ReadBits<TURN_CYCLES>();
+            return nParity ? SWD_PARITY_ERROR : DP_OK;
+        }
+        ReadBits<TURN_CYCLES>();
+        uint32_t nData = nResponse == DP_OK ? *pData : 0; // ignored if not OK
+        m_Backend.Output();
+        WriteBit(WriteEach(nData, std::make_index_sequence<32>()));
+        return nResponse;
+    }
+
+  private:
+    // The target samples SWDIO on the rising edge and drives it after it
+    void WriteClock() {
+        m_Backend.Clock(LOW);
+        m_Timing.HalfPeriod();
+        m_Backend.Clock(HIGH);
+        m_Timing.HalfPeriod();
+    }
+
+    unsigned WriteBit(unsigned nLevel) {
+        m_Backend.Data(nLevel);
+        WriteClock();
+        return nLevel;
+    }
+
+    unsigned ReadBit() {
+        unsigned nLevel = m_Backend.Sample();
+        WriteClock();
+        return nLevel;
+    }
+
+    // \return Parity of the bits written
+    template <size_t... i>
+    unsigned WriteEach(uint32_t nBits, std::index_sequence<i...>) {
+        unsigned nParity = 0;
+        ((nParity ^= WriteBit((nBits >> i) & 1)), ...);
+        return nParity;
+    }
+
+    template <size_t... i>
+    uint32_t ReadEach(unsigned& nParity, std::index_sequence<i...>) {
+        uint32_t nBits = 0;
+        ((nBits |= (uint32_t)ReadBit() << i, nParity ^= nBits >> i & 1), ...);
+        return nBits;
+    }
+
+    Backend m_Backend;
+    Timing m_Timing;
+};
+
+/// \brief Any GPIO backend, through the pin functions of gpiopin.h
+class PinBackend {
+  public:
+    PinBackend(struct CGPIOPin* pClock, struct CGPIOPin* pData)
+        : m_pClock(pClock), m_pData(pData) {}
+
+    void Output() { SetModePin(m_pData, GPIOModeOutput, 0); }
+    void Input() { SetModePin(m_pData, GPIOModeInputPullUp, 0); }
+    void Data(unsigned nLevel) { WritePin(m_pData, nLevel); }
+    unsigned Sample() { return ReadPin(m_pData); }
+    void Clock(unsigned nLevel) { WritePin(m_pClock, nLevel); }
+
+  private:
+    struct CGPIOPin* m_pClock;
+    struct CGPIOPin* m_pData;
+};
+
+#if defined(USE_GPIOMEM)
+/// \brief The register accesses of SetModePin(), WritePin() and ReadPin()
+/// inlined, counted and traced the same way
+class GPIOMemBackend {
+  public:
+    GPIOMemBackend(struct CGPIOPin* pClock, struct CGPIOPin* pData)
+        : m_pClock(pClock), m_pData(pData) {}
+
+    void Output() { SetMode(GPIOModeOutput, GPFSEL_OUTPUT); }
+    void Input() { SetMode(GPIOModeInputPullUp, GPFSEL_INPUT); }
+    void Data(unsigned nLevel) { Write(m_pData, nLevel); }
+    void Clock(unsigned nLevel) { Write(m_pClock, nLevel); }
+
+    unsigned Sample() {
+        GPIO_STATS_ADD(m_nReads, 1);
+        unsigned nLevel = (*m_pData->m_pLev & m_pData->m_nMask) != 0;
+        GPIO_TRACE_PIN(GPIOTraceRead, m_pData->m_nPin, nLevel);
+        return nLevel;
+    }
+
+  private:
+    void SetMode(enum TGPIOMode Mode, uint32_t nFunction) {
+        if (m_pData->m_Mode == Mode)
+            return;
+        GPIO_STATS_ADD(m_nModeChanges, 1);
+        GPIO_TRACE_PIN(GPIOTraceMode, m_pData->m_nPin,
+                       Mode == GPIOModeOutput);
+        m_pData->m_Mode = Mode;
+        *m_pData->m_pFSel =
+            (*m_pData->m_pFSel & ~(GPFSEL_MASK << m_pData->m_nFSelShift)) |
+            nFunction << m_pData->m_nFSelShift;
+    }
+
+    static void Write(struct CGPIOPin* pin, unsigned nLevel) {
+        GPIO_STATS_ADD(m_nWrites, 1);
+        GPIO_TRACE_PIN(GPIOTraceWrite, pin->m_nPin, nLevel);
+        if (nLevel)
+            *pin->m_pSet = pin->m_nMask;
+        else
+            *pin->m_pClr = pin->m_nMask;
+    }
+
+    struct CGPIOPin* m_pClock;
+    struct CGPIOPin* m_pData;
+};
+
+using DefaultBackend = GPIOMemBackend;
+#else
+using DefaultBackend = PinBackend;
+#endif
+
+/// \brief Paced by the loader's clock, see TimingHalfPeriod()
+class LoaderTiming {
+  public:
+    explicit LoaderTiming(struct CSWDTiming* pTiming) : m_pTiming(pTiming) {}
+
+    void HalfPeriod() { TimingHalfPeriod(m_pTiming); }
+
+  private:
+    struct CSWDTiming* m_pTiming;
+};
+
+} // namespace swd
+
+#endif
@@ -0,0 +1,346 @@
+//
+// swdgang.c
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "swdgang.h"
+#include "swdregs.h"
+
+#define LOAD_BLOCK_SIZE 1024
+
+static int WriteData(struct CSWDGang* gang, uint8_t nRequest, uint32_t nData);
+static int ReadData(struct CSWDGang* gang, uint8_t nRequest,
+                    uint32_t* pValues);
+static int WriteMem(struct CSWDGang* gang, uint32_t nAddress, uint32_t nData);
+static int ReadMem(struct CSWDGang* gang, uint32_t nAddress,
+                   uint32_t* pValues);
+static void SelectTarget(struct CSWDGang* gang, uint32_t nCPUAPID,
+                         uint8_t uchInstanceID);
+static void Dormant2SWD(struct CSWDGang* gang);
+static void LineReset(struct CSWDGang* gang);
+static void WriteIdle(struct CSWDGang* gang);
+static void WriteBits(struct CSWDGang* gang, uint32_t nBits,
+                      unsigned nBitCount);
+static void ReadSlices(struct CSWDGang* gang, uint32_t* pSlices,
+                       unsigned nBitCount);
+static void SkipBits(struct CSWDGang* gang, unsigned nBitCount);
+static void WriteClock(struct CSWDGang* gang);
+
+// Take failed targets out of the run, their SWDIO is no longer driven
+static void Drop(struct CSWDGang* gang, uint32_t nFailed,
+                 const char* pReason, uint32_t nValue) {
+    nFailed &= gang->m_nActive;
+    if (!nFailed)
+        return;
+    gang->m_nActive &= ~nFailed;
+    gang->m_nActivePins = 0;
+    for (unsigned i = 0; i < gang->m_nTargets; i++)
+        if (nFailed & (1U << i)) {
+            fprintf(stderr, "\nTarget %u (GPIO%u): %s (0x%X)\n", i,
+                    gang->m_nDataPins[i], pReason, nValue);
+            SetModePin(gang->m_pDataPins[i], GPIOModeInputPullUp, 0);
+        } else if (gang->m_nActive & (1U << i))
+            gang->m_pActivePins[gang->m_nActivePins++] = gang->m_pDataPins[i];
+}
+
+// Per target value of nBitCount bit slices
+static uint32_t Gather(const uint32_t* pSlices, unsigned nBitCount,
+                       unsigned nTarget) {
+    uint32_t nValue = 0;
+    for (unsigned i = 0; i < nBitCount; i++)
+        nValue |= ((pSlices[i] >> nTarget) & 1) << i;
+    return nValue;
+}
+
+uint32_t SWDGangInitialise(struct CSWDGang* gang, unsigned nClockPin,
+                           const unsigned* pDataPins, unsigned nTargets,
+                           unsigned nResetPin, unsigned nClockRateKHz) {
+    assert(nTargets && nTargets <= GANG_MAX_TARGETS);
+    gang->m_nTargets = nTargets;
+    gang->m_bResetAvailable = nResetPin != 0;
+    gang->m_nTransactions = 0;
+    TimingInit(&gang->m_Timing, nClockRateKHz);
+    // SWCLK and all SWDIO stay requested together for the whole session
+    struct CGPIOPin* pPins[GANG_MAX_TARGETS + 1] = {&gang->m_ClockPin};
+    unsigned nPins[GANG_MAX_TARGETS + 1] = {nClockPin};
+    for (unsigned i = 0; i < nTargets; i++) {
+        gang->m_nDataPins[i] = pDataPins[i];
+        gang->m_pDataPins[i] = &gang->m_DataPins[i];
+        gang->m_pActivePins[i] = &gang->m_DataPins[i];
+        pPins[i + 1] = &gang->m_DataPins[i];
+        nPins[i + 1] = pDataPins[i];
+    }
+    gang->m_nActivePins = nTargets;
+    gang->m_nActive = (1U << nTargets) - 1;
+    InitPins(pPins, nPins, nTargets + 1, GPIOModeOutput);
+    TimingCalibrate(&gang->m_Timing, &gang->m_ClockPin);
+    if (gang->m_bResetAvailable) {
+        InitPin(&gang->m_ResetPin, nResetPin, GPIOModeOutput);
+        TimingDelay(10000000);
+        WritePin(&gang->m_ResetPin, LOW);
+        TimingDelay(10000000);
+        WritePin(&gang->m_ResetPin, HIGH);
+        TimingDelay(10000000);
+    }
+    WriteIdle(gang);
+    Dormant2SWD(gang);
+    WriteIdle(gang);
+    LineReset(gang);
+    // core 1 remains halted after reset
+    SelectTarget(gang, DP_TARGETSEL_CPUAPID_SUPPORTED,
+                 DP_TARGETSEL_TINSTANCE_CORE0);
+    uint32_t nIDCodes[GANG_MAX_TARGETS];
+    if (ReadData(gang, RD_DP_DPIDR, nIDCodes))
+        for (unsigned i = 0; i < nTargets; i++)
+            if ((gang->m_nActive & (1U << i)) &&
+                nIDCodes[i] != DP_DPIDR_SUPPORTED)
+                Drop(gang, 1U << i, "Debug target not supported",
+                     nIDCodes[i]);
+    if (gang->m_nActive) {
+        uint32_t nCtrlStat[GANG_MAX_TARGETS];
+        if (WriteData(gang, WR_DP_ABORT,
+                      DP_ABORT_STKCMPCLR | DP_ABORT_STKERRCLR |
+                          DP_ABORT_WDERRCLR | DP_ABORT_ORUNERRCLR) &&
+            WriteData(gang, WR_DP_SELECT, DP_SELECT_DEFAULT) &&
+            WriteData(gang, WR_DP_CTRL_STAT,
+                      DP_CTRL_STAT_ORUNDETECT | DP_CTRL_STAT_STICKYERR |
+                          DP_CTRL_STAT_CDBGPWRUPREQ |
+                          DP_CTRL_STAT_CSYSPWRUPREQ) &&
+            ReadData(gang, RD_DP_CTRL_STAT, nCtrlStat))
+            for (unsigned i = 0; i < nTargets; i++)
+                if ((gang->m_nActive & (1U << i)) &&
+                    (!(nCtrlStat[i] & DP_CTRL_STAT_CDBGPWRUPACK) ||
+                     !(nCtrlStat[i] & DP_CTRL_STAT_CSYSPWRUPACK)))
+                    Drop(gang, 1U << i, "Target connect failed",
+                         nCtrlStat[i]);
+    }
+    WriteIdle(gang);
+    return gang->m_nActive;
+}
+
+void SWDGangDeInitialise(struct CSWDGang* gang) {
+    for (unsigned i = 0; i < gang->m_nTargets; i++)
+        DeInitPin(&gang->m_DataPins[i]);
+    DeInitPin(&gang->m_ClockPin);
+#if defined(USE_LIBPIGPIO) || defined(USE_GPIOMEM)
+    // Leave reset high
+    if (gang->m_bResetAvailable)
+        DeInitPin(&gang->m_ResetPin);
+#endif
+}
+
+// Write one 1 KB aligned block to all targets and read back its first word
+static int LoadBlock(struct CSWDGang* gang, const uint32_t* pData,
+                     uint32_t nAddress, size_t nSize) {
+    WriteIdle(gang);
+    if (!WriteData(gang, WR_AP_TAR, nAddress))
+        return 0;
+    for (size_t i = 0; i < nSize / 4; i++)
+        if (!WriteData(gang, WR_AP_DRW, pData[i]))
+            return 0;
+    WriteIdle(gang);
+    uint32_t nValues[GANG_MAX_TARGETS];
+    if (!ReadMem(gang, nAddress, nValues))
+        return 0;
+    for (unsigned i = 0; i < gang->m_nTargets; i++)
+        if ((gang->m_nActive & (1U << i)) && nValues[i] != pData[0])
+            Drop(gang, 1U << i, "Data mismatch", nAddress);
+    return gang->m_nActive != 0;
+}
+
+// Blocks end on 1 KB boundaries, TAR auto-increment wraps there
+static int LoadSegment(struct CSWDGang* gang, const uint32_t* pData,
+                       size_t nSegmentSize, uint32_t nAddress) {
+    size_t nOffset = 0;
+    while (nOffset < nSegmentSize) {
+        uint32_t nBlockAddress = nAddress + nOffset;
+        size_t nSize =
+            LOAD_BLOCK_SIZE - (nBlockAddress & (LOAD_BLOCK_SIZE - 1));
+        if (nSize > nSegmentSize - nOffset)
+            nSize = nSegmentSize - nOffset;
+        printf("\rLoading @ 0x%08x", nBlockAddress);
+        fflush(stdout);
+        if (!LoadBlock(gang, pData + nOffset / 4, nBlockAddress, nSize))
+            return 0;
+        nOffset += nSize;
+    }
+    return 1;
+}
+
+uint32_t SWDGangLoad(struct CSWDGang* gang, const struct CSWDImage* image) {
+    WriteIdle(gang);
+    if (!WriteData(gang, WR_AP_CSW,
+                   (AP_CSW_SIZE_32BITS << AP_CSW_SIZE__SHIFT) |
+                       (AP_CSW_SIZE_INCREMENT_SINGLE
+                        << AP_CSW_ADDR_INC__SHIFT) |
+                       AP_CSW_DEVICE_EN |
+                       (AP_CSW_PROT_DEFAULT << AP_CSW_PROT__SHIFT) |
+                       AP_CSW_DBG_SW_ENABLE) ||
+        !WriteMem(gang, DHCSR,
+                  DHCSR_C_DEBUGEN | DHCSR_C_HALT |
+                      (DHCSR_DBGKEY_KEY << DHCSR_DBGKEY__SHIFT)))
+        return 0;
+    uint64_t nStart = TimingNow();
+    TimingStart(&gang->m_Timing);
+    printf("Disabling XIP and USB\n");
+    if (!WriteMem(gang, XIP_CNTL, 0) || !WriteMem(gang, USB_CNTL, 0))
+        return 0;
+    for (unsigned i = 0; i < image->m_nSegments; i++) {
+        const struct TSWDSegment* segment = &image->m_pSegments[i];
+        if (!LoadSegment(gang, segment->m_pData, segment->m_nSize,
+                         segment->m_nAddress))
+            return 0;
+    }
+    size_t nProgSize = image->m_nSize;
+    double diff_t = (TimingNow() - nStart) / 1e9;
+    printf("\n%lu bytes loaded to %u targets in %.2f seconds "
+           "(%.1f KBytes/s each)\n",
+           nProgSize, __builtin_popcount(gang->m_nActive), diff_t,
+           nProgSize / diff_t / 1024.0);
+    TimingReport(&gang->m_Timing, stdout);
+    printf("Starting\n");
+    WriteIdle(gang);
+    if (!WriteMem(gang, DCRDR, image->m_nEntry & ~1U) ||
+        !WriteMem(gang, DCRSR,
+                  (DCRSR_REGSEL_R15 << DCRSR_REGSEL__SHIFT) | DCRSR_REGW_N_R) ||
+        !WriteMem(gang, DHCSR,
+                  DHCSR_C_DEBUGEN | (DHCSR_DBGKEY_KEY << DHCSR_DBGKEY__SHIFT)))
+        return 0;
+    WriteIdle(gang);
+    return gang->m_nActive;
+}
+
+int WriteMem(struct CSWDGang* gang, uint32_t nAddress, uint32_t nData) {
+    return WriteData(gang, WR_AP_TAR, nAddress) &&
+           WriteData(gang, WR_AP_DRW, nData);
+}
+
+int ReadMem(struct CSWDGang* gang, uint32_t nAddress, uint32_t* pValues) {
+    return WriteData(gang, WR_AP_TAR, nAddress) &&
+           ReadData(gang, RD_AP_DRW, pValues) &&
+           ReadData(gang, RD_DP_RDBUFF, pValues);
+}
+
+// \return Some target is still active
+int WriteData(struct CSWDGang* gang, uint8_t nRequest, uint32_t nData) {
+    gang->m_nTransactions++;
+    WriteBits(gang, nRequest, 7);
+    assert(nRequest & 0x80);
+    SkipBits(gang, 1 + TURN_CYCLES); // park bit (not driven) and turn cycle
+    uint32_t nAck[3];
+    ReadSlices(gang, nAck, 3);
+    SkipBits(gang, TURN_CYCLES);
+    // DP_OK is 0b001
+    Drop(gang, ~(nAck[0] & ~nAck[1] & ~nAck[2]), "Cannot write", nRequest);
+    if (!gang->m_nActive)
+        return 0;
+    WriteBits(gang, nData, 32);
+    WriteBits(gang, __builtin_parity(nData), 1);
+    return 1;
+}
+
+// \param pValues Value read from each target, valid for active ones
+int ReadData(struct CSWDGang* gang, uint8_t nRequest, uint32_t* pValues) {
+    gang->m_nTransactions++;
+    WriteBits(gang, nRequest, 7);
+    assert(nRequest & 0x80);
+    SkipBits(gang, 1 + TURN_CYCLES); // park bit (not driven) and turn cycle
+    uint32_t nSlices[3 + 33];
+    ReadSlices(gang, nSlices, 3 + 33);
+    SkipBits(gang, TURN_CYCLES);
+    Drop(gang, ~(nSlices[0] & ~nSlices[1] & ~nSlices[2]), "Cannot read",
+         nRequest);
+    uint32_t nParity = 0;
+    for (unsigned i = 3; i < 3 + 33; i++)
+        nParity ^= nSlices[i];
+    Drop(gang, nParity, "Parity error", nRequest);
+    for (unsigned i = 0; i < gang->m_nTargets; i++)
+        if (gang->m_nActive & (1U << i))
+            pValues[i] = Gather(nSlices + 3, 32, i);
+    return gang->m_nActive != 0;
+}
+
+void SelectTarget(struct CSWDGang* gang, uint32_t nCPUAPID,
+                  uint8_t uchInstanceID) {
+    uint32_t nWData =
+        nCPUAPID | ((uint32_t)uchInstanceID << DP_TARGETSEL_TINSTANCE__SHIFT);
+    WriteBits(gang, WR_DP_TARGETSEL, 7);
+    SkipBits(gang, 1 + 5); // park bit and 5 bits not driven
+    WriteBits(gang, nWData, 32);
+    WriteBits(gang, __builtin_parity(nWData), 1);
+}
+
+// Leaving dormant state and switch to SW-DP ([1] section B5.3.4)
+void Dormant2SWD(struct CSWDGang* gang) {
+    WriteBits(gang, 0xFF, 8);         // 8 cycles high
+    WriteBits(gang, 0x6209F392U, 32); // selection alert sequence
+    WriteBits(gang, 0x86852D95U, 32);
+    WriteBits(gang, 0xE3DDAFE9U, 32);
+    WriteBits(gang, 0x19BC0EA2U, 32);
+    WriteBits(gang, 0x0, 4);  // 4 cycles low
+    WriteBits(gang, 0x1A, 8); // activation code
+}
+
+void LineReset(struct CSWDGang* gang) {
+    WriteBits(gang, 0xFFFFFFFFU, 32);
+    WriteBits(gang, 0x00FFFFFU, 28);
+}
+
+void WriteIdle(struct CSWDGang* gang) {
+    TimingGap(&gang->m_Timing);
+    WriteBits(gang, 0, 8);
+    WritePin(&gang->m_ClockPin, LOW);
+}
+
+// The same bits to all active targets, one GPIO write per bit
+void WriteBits(struct CSWDGang* gang, uint32_t nBits, unsigned nBitCount) {
+    SetModePins(gang->m_pActivePins, gang->m_nActivePins, GPIOModeOutput);
+    while (nBitCount--) {
+        WritePins(gang->m_pActivePins, gang->m_nActivePins,
+                  nBits & 1 ? ~0U : 0);
+        WriteClock(gang);
+        nBits >>= 1;
+    }
+}
+
+// pSlices[i] bit n is bit i as sent by target n, one GPIO read per bit
+void ReadSlices(struct CSWDGang* gang, uint32_t* pSlices,
+                unsigned nBitCount) {
+    SetModePins(gang->m_pActivePins, gang->m_nActivePins,
+                GPIOModeInputPullUp);
+    for (unsigned i = 0; i < nBitCount; i++) {
+        pSlices[i] =
+            ReadPins(gang->m_pDataPins, gang->m_nTargets) & gang->m_nActive;
+        WriteClock(gang);
+    }
+}
+
+// Turnaround and undriven cycles
+void SkipBits(struct CSWDGang* gang, unsigned nBitCount) {
+    SetModePins(gang->m_pActivePins, gang->m_nActivePins,
+                GPIOModeInputPullUp);
+    while (nBitCount--)
+        WriteClock(gang);
+}
+
+void WriteClock(struct CSWDGang* gang) {
+    WritePin(&gang->m_ClockPin, LOW);
+    TimingHalfPeriod(&gang->m_Timing);
+    WritePin(&gang->m_ClockPin, HIGH);
+    TimingHalfPeriod(&gang->m_Timing);
+}
@@ -0,0 +1,75 @@
+//
+// swdgang.h
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _pico_swdgang_h
+#define _pico_swdgang_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gpiopin.h"
+#include "swdimage.h"
+#include "swdtiming.h"
+
+// One libgpiod request holds SWCLK and all SWDIO lines
+#define GANG_MAX_TARGETS 15
+
+// Several RP2040 sharing SWCLK (and RUN), each on its own SWDIO. All targets
+// get the same bits, written with one WritePins() per clock and sampled with
+// one ReadPins(), responses are kept bit-sliced (bit i of each word is
+// target i) until a per-target value is needed.
+struct CSWDGang {
+    unsigned m_nTargets;
+    uint32_t m_nActive; // targets that have not failed yet
+    unsigned m_bResetAvailable;
+    uint64_t m_nTransactions;
+    struct CSWDTiming m_Timing;
+    unsigned m_nDataPins[GANG_MAX_TARGETS];
+    struct CGPIOPin* m_pDataPins[GANG_MAX_TARGETS];
+    struct CGPIOPin* m_pActivePins[GANG_MAX_TARGETS];
+    unsigned m_nActivePins;
+    struct CGPIOPin m_ResetPin;
+    struct CGPIOPin m_ClockPin;
+    struct CGPIOPin m_DataPins[GANG_MAX_TARGETS];
+};
+
+/// \param nClockPin GPIO pin to which all SWCLK are connected
+/// \param pDataPins GPIO pins to which the SWDIO of each target is connected
+/// \param nTargets Number of data pins (at most GANG_MAX_TARGETS)
+/// \param nResetPin Optional GPIO pin to which all RESET (RUN) are connected
+/// \param nClockRateKHz Requested interface clock rate in KHz
+/// \return Mask of the targets that connected, bit i is pDataPins[i]
+uint32_t SWDGangInitialise(struct CSWDGang* gang, unsigned nClockPin,
+                           const unsigned* pDataPins, unsigned nTargets,
+                           unsigned nResetPin, unsigned nClockRateKHz);
+
+void SWDGangDeInitialise(struct CSWDGang* gang);
+
+/// \brief Halt, load, verify (first word of each 1 KB block) and start all
+/// connected targets, a target failing drops out and the others continue
+/// \param image Program image, started at its entry point
+/// \return Mask of the targets that have been started
+uint32_t SWDGangLoad(struct CSWDGang* gang, const struct CSWDImage* image);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,262 @@
+//
+// swdimage.c
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <elf.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "swdimage.h"
+#include "swdmanifest.h"
+
+// UF2 format, https://github.com/microsoft/uf2
+#define UF2_MAGIC_START0 0x0A324655U
+#define UF2_MAGIC_START1 0x9E5D5157U
+#define UF2_MAGIC_END 0x0AB16F30U
+#define UF2_FLAG_NOT_MAIN_FLASH 0x00000001U
+#define UF2_FLAG_FAMILY_ID_PRESENT 0x00002000U
+#define UF2_FAMILY_ID_RP2040 0xE48BFF56U
+#define UF2_DATA_SIZE 476
+
+struct TUF2Block {
+    uint32_t m_nMagicStart0;
+    uint32_t m_nMagicStart1;
+    uint32_t m_nFlags;
+    uint32_t m_nTargetAddr;
+    uint32_t m_nPayloadSize;
+    uint32_t m_nBlockNo;
+    uint32_t m_nNumBlocks;
+    uint32_t m_nFamilyID; // or file size
+    uint8_t m_Data[UF2_DATA_SIZE];
+    uint32_t m_nMagicEnd;
+};
+
+static int AddSegment(struct CSWDImage* image, uint32_t nAddress,
+                      const void* pData, size_t nSize) {
+    if (nAddress & 3) {
+        fprintf(stderr, "Segment @ 0x%X is not word aligned\n", nAddress);
+        return 0;
+    }
+    struct TSWDSegment* pSegments =
+        realloc(image->m_pSegments,
+                (image->m_nSegments + 1) * sizeof(struct TSWDSegment));
+    if (!pSegments)
+        return 0;
+    image->m_pSegments = pSegments;
+    size_t nPadded = (nSize + 3) & ~(size_t)3;
+    struct TSWDSegment* segment = &pSegments[image->m_nSegments];
+    segment->m_pData = calloc(1, nPadded ? nPadded : 4);
+    if (!segment->m_pData)
+        return 0;
+    memcpy(segment->m_pData, pData, nSize);
+    segment->m_nAddress = nAddress;
+    segment->m_nSize = nPadded;
+    segment->m_nVerify = SWD_VERIFY_LOADER;
+    image->m_nSegments++;
+    image->m_nSize += nPadded;
+    return 1;
+}
+
+static int CompareSegments(const void* p1, const void* p2) {
+    uint32_t nAddress1 = ((const struct TSWDSegment*)p1)->m_nAddress;
+    uint32_t nAddress2 = ((const struct TSWDSegment*)p2)->m_nAddress;
+    return nAddress1 < nAddress2 ? -1 : nAddress1 > nAddress2;
+}
+
+// Sort the segments and join the adjacent ones (UF2 blocks, manifest
+// entries) verified the same way
+static int JoinSegments(struct CSWDImage* image) {
+    struct TSWDSegment* pSegments = image->m_pSegments;
+    unsigned nSegments = image->m_nSegments;
+    qsort(pSegments, nSegments, sizeof(*pSegments), CompareSegments);
+    for (unsigned i = 1; i < nSegments; i++)
+        if (pSegments[i - 1].m_nAddress + pSegments[i - 1].m_nSize >
+            pSegments[i].m_nAddress) {
+            fprintf(stderr, "Segments overlap @ 0x%X\n",
+                    pSegments[i].m_nAddress);
+            return 0;
+        }
+    unsigned nJoined = 1;
+    for (unsigned i = 1; i < nSegments; i++) {
+        struct TSWDSegment* last = &pSegments[nJoined - 1];
+        struct TSWDSegment* next = &pSegments[i];
+        if (last->m_nAddress + last->m_nSize != next->m_nAddress ||
+            last->m_nVerify != next->m_nVerify) {
+            pSegments[nJoined++] = *next;
+            continue;
+        }
+        uint32_t* pData =
+            realloc(last->m_pData, last->m_nSize + next->m_nSize);
+        if (!pData) {
+            // keep every buffer referenced once, for SWDImageFree()
+            memmove(&pSegments[nJoined], next,
+                    (nSegments - i) * sizeof(*pSegments));
+            image->m_nSegments = nJoined + nSegments - i;
+            return 0;
+        }
+        memcpy((uint8_t*)pData + last->m_nSize, next->m_pData,
+               next->m_nSize);
+        free(next->m_pData);
+        last->m_pData = pData;
+        last->m_nSize += next->m_nSize;
+    }
+    image->m_nSegments = nJoined;
+    return 1;
+}
+
+static int ReadELF(struct CSWDImage* image, const uint8_t* pFile,
+                   size_t nFileSize) {
+    Elf32_Ehdr ehdr;
+    memcpy(&ehdr, pFile, sizeof(ehdr));
+    if (nFileSize < sizeof(ehdr) || ehdr.e_ident[EI_CLASS] != ELFCLASS32 ||
+        ehdr.e_ident[EI_DATA] != ELFDATA2LSB || ehdr.e_machine != EM_ARM ||
+        ehdr.e_phentsize != sizeof(Elf32_Phdr) ||
+        ehdr.e_phoff + (size_t)ehdr.e_phnum * sizeof(Elf32_Phdr) >
+            nFileSize) {
+        fprintf(stderr, "Not a 32 bit little endian ARM ELF file\n");
+        return 0;
+    }
+    for (unsigned i = 0; i < ehdr.e_phnum; i++) {
+        Elf32_Phdr phdr;
+        memcpy(&phdr, pFile + ehdr.e_phoff + i * sizeof(phdr), sizeof(phdr));
+        if (phdr.p_type != PT_LOAD || !phdr.p_filesz)
+            continue;
+        if ((size_t)phdr.p_offset + phdr.p_filesz > nFileSize) {
+            fprintf(stderr, "ELF segment %u is truncated\n", i);
+            return 0;
+        }
+        // load address, the startup code copies from there
+        if (!AddSegment(image, phdr.p_paddr, pFile + phdr.p_offset,
+                        phdr.p_filesz))
+            return 0;
+    }
+    image->m_nEntry = ehdr.e_entry;
+    return 1;
+}
+
+static int ReadUF2(struct CSWDImage* image, const uint8_t* pFile,
+                   size_t nFileSize) {
+    if (nFileSize % sizeof(struct TUF2Block)) {
+        fprintf(stderr, "UF2 file size is not a multiple of %zu\n",
+                sizeof(struct TUF2Block));
+        return 0;
+    }
+    for (size_t nOffset = 0; nOffset < nFileSize;
+         nOffset += sizeof(struct TUF2Block)) {
+        struct TUF2Block block;
+        memcpy(&block, pFile + nOffset, sizeof(block));
+        if (block.m_nMagicStart0 != UF2_MAGIC_START0 ||
+            block.m_nMagicStart1 != UF2_MAGIC_START1 ||
+            block.m_nMagicEnd != UF2_MAGIC_END ||
+            block.m_nPayloadSize > UF2_DATA_SIZE) {
+            fprintf(stderr, "Bad UF2 block @ offset %zu\n", nOffset);
+            return 0;
+        }
+        if ((block.m_nFlags & UF2_FLAG_NOT_MAIN_FLASH) ||
+            ((block.m_nFlags & UF2_FLAG_FAMILY_ID_PRESENT) &&
+             block.m_nFamilyID != UF2_FAMILY_ID_RP2040))
+            continue;
+        if (!AddSegment(image, block.m_nTargetAddr, block.m_Data,
+                        block.m_nPayloadSize))
+            return 0;
+    }
+    return 1;
+}
+
+int SWDImageRead(struct CSWDImage* image, const char* pFileName,
+                 uint32_t nBinAddress) {
+    memset(image, 0, sizeof(*image));
+    int fd = open(pFileName, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Can't open %s\n", pFileName);
+        return 0;
+    }
+    struct stat st;
+    uint8_t* pFile = 0;
+    if (fstat(fd, &st) == 0)
+        pFile = malloc(st.st_size + sizeof(Elf32_Ehdr));
+    if (!pFile || read(fd, pFile, st.st_size) != st.st_size) {
+        fprintf(stderr, "Can't read %s\n", pFileName);
+        free(pFile);
+        close(fd);
+        return 0;
+    }
+    close(fd);
+    size_t nFileSize = st.st_size;
+    // zeros past the end, so the magic numbers can be compared
+    memset(pFile + nFileSize, 0, sizeof(Elf32_Ehdr));
+    uint32_t nMagic[2];
+    memcpy(nMagic, pFile, sizeof(nMagic));
+    if (!memcmp(pFile, SWD_MANIFEST_MAGIC, strlen(SWD_MANIFEST_MAGIC))) {
+        free(pFile);
+        return SWDManifestRead(image, pFileName, nBinAddress);
+    }
+    int bOK;
+    if (!memcmp(pFile, ELFMAG, SELFMAG))
+        bOK = ReadELF(image, pFile, nFileSize);
+    else if (nMagic[0] == UF2_MAGIC_START0 && nMagic[1] == UF2_MAGIC_START1)
+        bOK = ReadUF2(image, pFile, nFileSize);
+    else {
+        bOK = AddSegment(image, nBinAddress, pFile, nFileSize);
+        image->m_nEntry = nBinAddress;
+    }
+    free(pFile);
+    if (bOK && !image->m_nSize) {
+        fprintf(stderr, "%s has nothing to load\n", pFileName);
+        bOK = 0;
+    }
+    if (bOK)
+        bOK = JoinSegments(image);
+    // UF2 has no entry point, like a flat binary start at the lowest address
+    if (bOK && !image->m_nEntry)
+        image->m_nEntry = image->m_pSegments[0].m_nAddress;
+    if (!bOK)
+        SWDImageFree(image);
+    return bOK;
+}
+
+int SWDImageMerge(struct CSWDImage* image, struct CSWDImage* other,
+                  int nVerify) {
+    struct TSWDSegment* pSegments =
+        realloc(image->m_pSegments,
+                (image->m_nSegments + other->m_nSegments) *
+                    sizeof(struct TSWDSegment));
+    if (!pSegments) {
+        SWDImageFree(other);
+        return 0;
+    }
+    image->m_pSegments = pSegments;
+    for (unsigned i = 0; i < other->m_nSegments; i++) {
+        pSegments[image->m_nSegments] = other->m_pSegments[i];
+        pSegments[image->m_nSegments++].m_nVerify = nVerify;
+    }
+    image->m_nSize += other->m_nSize;
+    // the buffers belong to image now
+    free(other->m_pSegments);
+    memset(other, 0, sizeof(*other));
+    return JoinSegments(image);
+}
+
+void SWDImageFree(struct CSWDImage* image) {
+    for (unsigned i = 0; i < image->m_nSegments; i++)
+        free(image->m_pSegments[i].m_pData);
+    free(image->m_pSegments);
+    memset(image, 0, sizeof(*image));
+}
@@ -0,0 +1,67 @@
+//
+// swdimage.h
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _pico_swdimage_h
+#define _pico_swdimage_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SWD_VERIFY_LOADER -1 // segment checked as the loader's m_Verify says
+
+// Contiguous part of a program image
+struct TSWDSegment {
+    uint32_t m_nAddress; // word aligned
+    size_t m_nSize;      // multiple of 4
+    uint32_t* m_pData;
+    int m_nVerify; // enum TSWDVerify, or SWD_VERIFY_LOADER
+};
+
+struct CSWDImage {
+    struct TSWDSegment* m_pSegments; // sorted by address, not overlapping
+    unsigned m_nSegments;
+    size_t m_nSize;    // sum of the segment sizes
+    uint32_t m_nEntry; // start address, bit 0 set for Thumb code
+};
+
+/// \brief Read an ELF (PT_LOAD segments with file contents), UF2 or flat
+/// binary program image, or a manifest of several (see swdmanifest.h)
+/// \param nBinAddress Load and start address of a flat binary
+/// \note ELF .bss (memory size above file size) is left to the startup code
+/// \return Operation successful? Errors are reported to stderr.
+int SWDImageRead(struct CSWDImage* image, const char* pFileName,
+                 uint32_t nBinAddress);
+
+/// \brief Move the segments of another image into an image, sorted with
+/// the ones already there. Adjacent segments with the same verify policy
+/// are joined, so they share TAR setups and 1 KB blocks.
+/// \param other Emptied, also if the merge fails
+/// \param nVerify Verify policy of the moved segments
+/// \return Operation successful? Fails if segments overlap.
+int SWDImageMerge(struct CSWDImage* image, struct CSWDImage* other,
+                  int nVerify);
+
+void SWDImageFree(struct CSWDImage* image);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -17,82 +17,38 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "swdloader.h"
+#include "gpiotrace.h"
+#include "swdcrc.h"
+#include "swdengine.h"
+#include "swdlz.h"
+#include "swdregs.h"
+#include "swdstats.h"
+#include "swdwave.h"
 
-// References:
-//
-// [1] ARM Debug Interface Architecture Specification ADIv5.0 to ADIv5.2, IHI
-// 0031E [2] ARM v6-M Architecture Reference Manual, DDI 0419E
-// Debug Port v2
-
-#define TURN_CYCLES 1
-
-#define BIT(x) (1 << (x))
-
-#define XIP_CNTL 0x14000000
-#define USB_CNTL 0x50110040
-
-// SWD-DP Requests
-#define WR_DP_ABORT 0x81
-#define DP_ABORT_STKCMPCLR BIT(1)
-#define DP_ABORT_STKERRCLR BIT(2)
-#define DP_ABORT_WDERRCLR BIT(3)
-#define DP_ABORT_ORUNERRCLR BIT(4)
-#define RD_DP_CTRL_STAT 0x8D
-#define WR_DP_CTRL_STAT 0xA9
-#define DP_CTRL_STAT_ORUNDETECT BIT(0)
-#define DP_CTRL_STAT_STICKYERR BIT(5)
-#define DP_CTRL_STAT_CDBGPWRUPREQ BIT(28)
-#define DP_CTRL_STAT_CDBGPWRUPACK BIT(29)
-#define DP_CTRL_STAT_CSYSPWRUPREQ BIT(30)
-#define DP_CTRL_STAT_CSYSPWRUPACK BIT(31)
-#define RD_DP_DPIDR 0xA5
-#define DP_DPIDR_SUPPORTED 0x0BC12477
-#define RD_DP_RDBUFF 0xBD
-#define WR_DP_SELECT 0xB1
-#define DP_SELECT_DPBANKSEL__SHIFT 0
-#define DP_SELECT_APBANKSEL__SHIFT 4
-#define DP_SELECT_APSEL__SHIFT 24
-#define DP_SELECT_DEFAULT 0 // DP bank 0, AP 0, AP bank 0
-#define WR_DP_TARGETSEL 0x99
-#define DP_TARGETSEL_CPUAPID_SUPPORTED 0x01002927
-#define DP_TARGETSEL_TINSTANCE__SHIFT 28
-#define DP_TARGETSEL_TINSTANCE_CORE0 0
-#define DP_TARGETSEL_TINSTANCE_CORE1 1
-
-// SW-DP response
-#define DP_OK 0b001
-#define DP_WAIT 0b010
-#define DP_FAULT 0b100
-
-// SWD MEM-AP Requests
-#define WR_AP_CSW 0xA3
-#define AP_CSW_SIZE__SHIFT 0
-#define AP_CSW_SIZE_32BITS 2
-#define AP_CSW_ADDR_INC__SHIFT 4
-#define AP_CSW_SIZE_INCREMENT_SINGLE 1
-#define AP_CSW_DEVICE_EN BIT(6)
-#define AP_CSW_PROT__SHIFT 24
-#define AP_CSW_PROT_DEFAULT 0x22
-#define AP_CSW_DBG_SW_ENABLE BIT(31)
-#define RD_AP_DRW 0x9F
-#define WR_AP_DRW 0xBB
-#define WR_AP_TAR 0x8B
-
-// ARMv6-M Debug System Registers
-#define DHCSR 0xE000EDF0
-#define DHCSR_C_DEBUGEN BIT(0)
-#define DHCSR_C_HALT BIT(1)
-#define DHCSR_DBGKEY__SHIFT 16
-#define DHCSR_DBGKEY_KEY 0xA05F
-#define DCRSR 0xE000EDF4
-#define DCRSR_REGSEL__SHIFT 0
-#define DCRSR_REGSEL_R15 15 // PC register
-#define DCRSR_REGW_N_R BIT(16)
-#define DCRDR 0xE000EDF8
+#define LOAD_BLOCK_SIZE 1024
+#define LOAD_BLOCK_RETRIES 3
+#define LOAD_RESUMES 3 // at the same unverified block
+#define SWD_WAIT_RETRIES 16 // per request
+#define SWD_FAULT_RETRIES 2 // per request, also parity errors
+#define VERIFY_SAMPLES 4    // words per block, SWDVerifySampled
+#define VERIFY_POLLS 100000 // DMA reset and transfer completion
+#define WIRE_BITS_PER_WORD 46 // request, turnarounds, ACK, data and parity
+#define UNPACK_OVERHEAD_WORDS 40 // registers, start, mailbox and halt
+#define UNPACK_NANOS_PER_BYTE 2000 // ~12 cycles on the 6 MHz ring oscillator
+#define UNPACK_TIMEOUT_NANOS 1000000000U // on top of the estimate
+#define DELTA_MAX_PERCENT 75 // changed blocks above which a full load is used
+#define FILL_MIN_WORDS 64 // zero runs cleared by the target DMA instead
+#define CRC_SCRATCH (SRAM_END - 4) // CRC DMA destination, restored after
+#define FLASH_BUFFER SRAM_BASE // two sectors, then the flash stub
+#define FLASH_STUB (FLASH_BUFFER + 2 * FLASH_SECTOR_SIZE)
+#define FLASH_CALL_NANOS 100000000U // other bootrom calls
+#define FLASH_SECTOR_NANOS 2000000000ULL // erase and program one sector
 
 static void BeginTransaction(struct CSWDLoader* loader);
 static void EndTransaction(struct CSWDLoader* loader);
@@ -104,6 +60,8 @@ static void SelectTarget(struct CSWDLoader* loader, uint32_t nCPUAPID,
 static int ReadData(struct CSWDLoader* loader, uint8_t nRequest,
                     uint32_t* pData);
 static int PowerOn(struct CSWDLoader* loader);
+static int ProbeTarget(struct CSWDLoader* loader, uint32_t nTargetSel,
+                       uint32_t* pIDCode);
 static int WriteData(struct CSWDLoader* loader, uint8_t nRequest,
                      uint32_t nData);
 static int WriteMem(struct CSWDLoader* loader, uint32_t nAddress,
@@ -113,83 +71,172 @@ static int ReadMem(struct CSWDLoader* loader, uint32_t nAddress,
 static void WriteBits(struct CSWDLoader* loader, uint32_t nBits,
                       unsigned nBitCount);
 static uint32_t ReadBits(struct CSWDLoader* loader, unsigned nBitCount);
-static void WriteClock(struct CSWDLoader* loader);
-
-static void delay_nanos(uint32_t n) {
-    struct timespec start, now;
-    clock_gettime(CLOCK_REALTIME, &start);
-    uint32_t delta_ns;
-    do {
-        clock_gettime(CLOCK_REALTIME, &now);
-        if (now.tv_sec == start.tv_sec)
-            delta_ns = now.tv_nsec - start.tv_nsec;
-        else
-            delta_ns = 1000000000 + now.tv_nsec - start.tv_nsec;
-    } while (delta_ns < n);
-}
+static int Recover(struct CSWDLoader* loader, unsigned nResponse);
+static void SetPhase(struct CSWDLoader* loader, enum TSWDPhase Phase);
+static int LoadPacked(struct CSWDLoader* loader, const void* pProgram,
+                      size_t nProgSize, uint32_t nAddress);
+static int LoadDelta(struct CSWDLoader* loader, const void* pProgram,
+                     size_t nProgSize, uint32_t nAddress);
+static int LoadSegment(struct CSWDLoader* loader, const uint32_t* pData,
+                       size_t nSize, uint32_t nAddress);
+static int Connect(struct CSWDLoader* loader);
+static int RunTarget(struct CSWDLoader* loader, uint32_t nAddress,
+                     const uint32_t* pRegs, unsigned nRegs);
 
 int SWDInitialise(struct CSWDLoader* loader, unsigned nClockPin,
                   unsigned nDataPin, unsigned nResetPin,
                   unsigned nClockRateKHz) {
     loader->m_bResetAvailable = nResetPin != 0;
-    loader->m_nDelayNanos = 1000000U / nClockRateKHz / 2;
-    InitPin(&loader->m_ClockPin, nClockPin, GPIOModeOutput);
-    InitPin(&loader->m_DataPin, nDataPin, GPIOModeOutput);
+    loader->m_nBlockSize = LOAD_BLOCK_SIZE;
+    loader->m_bStreamWrites = 1;
+    loader->m_Verify = SWDVerifyFirstWord;
+    loader->m_Compress = SWDCompressAuto;
+    loader->m_bDelta = 0;
+    loader->m_nTransactions = 0;
+    loader->m_pSPI = 0;
+    memset(loader->m_Targets, 0, sizeof(loader->m_Targets));
+    loader->m_Targets[0].m_nTargetSel =
+        DP_TARGETSEL_CPUAPID_SUPPORTED |
+        (DP_TARGETSEL_TINSTANCE_CORE0 << DP_TARGETSEL_TINSTANCE__SHIFT);
+    loader->m_nTargets = 1;
+    loader->m_nTarget = 0;
+    SetPhase(loader, SWDPhaseConnect);
+    memset(loader->m_Retries, 0, sizeof(loader->m_Retries));
+    TimingInit(&loader->m_Timing, nClockRateKHz);
+    // SWCLK and SWDIO stay requested together for the whole session
+    struct CGPIOPin* pPins[] = {&loader->m_ClockPin, &loader->m_DataPin};
+    unsigned nPins[] = {nClockPin, nDataPin};
+    InitPins(pPins, nPins, 2, GPIOModeOutput);
+    GPIO_TRACE_NAME(nClockPin, "swclk");
+    GPIO_TRACE_NAME(nDataPin, "swdio");
+    TimingCalibrate(&loader->m_Timing, &loader->m_ClockPin);
     if (loader->m_bResetAvailable) {
+        GPIO_TRACE_NAME(nResetPin, "swrst");
         InitPin(&loader->m_ResetPin, nResetPin, GPIOModeOutput);
-        delay_nanos(10000000);
+        TimingDelay(10000000);
         WritePin(&loader->m_ResetPin, LOW);
-        delay_nanos(10000000);
+        TimingDelay(10000000);
         WritePin(&loader->m_ResetPin, HIGH);
-        delay_nanos(10000000);
+        TimingDelay(10000000);
     }
+    return Connect(loader);
+}
+
+// Handshake with the selected DP, from whatever state the line is in. Core 1
+// remains halted after reset, m_Targets[0] is core 0 until SWDScan().
+static int Connect(struct CSWDLoader* loader) {
+    struct TSWDTarget* target = &loader->m_Targets[loader->m_nTarget];
+    enum TSWDPhase Phase = loader->m_Phase;
+    SetPhase(loader, SWDPhaseConnect);
     BeginTransaction(loader);
     Dormant2SWD(loader);
     WriteIdle(loader);
     LineReset(loader);
-    // core 1 remains halted after reset
-    SelectTarget(loader, DP_TARGETSEL_CPUAPID_SUPPORTED,
-                 DP_TARGETSEL_TINSTANCE_CORE0);
+    SelectTarget(loader,
+                 target->m_nTargetSel &
+                     ~(0xFU << DP_TARGETSEL_TINSTANCE__SHIFT),
+                 target->m_nTargetSel >> DP_TARGETSEL_TINSTANCE__SHIFT);
+    // the DPs may have been reset, nothing is known about them
+    for (unsigned i = 0; i < loader->m_nTargets; i++) {
+        loader->m_Targets[i].m_nCSW = 0;
+        loader->m_Targets[i].m_bTAR = 0;
+        loader->m_Targets[i].m_bPowered = 0;
+    }
     uint32_t nIDCode;
-    if (!ReadData(loader, RD_DP_DPIDR, &nIDCode)) {
+    int bOK = 0;
+    if (!ReadData(loader, RD_DP_DPIDR, &nIDCode))
         fprintf(stderr, "Target does not respond\n");
-        return 0;
-    }
-    if (nIDCode != DP_DPIDR_SUPPORTED) {
+    else if (nIDCode != DP_DPIDR_SUPPORTED) {
         EndTransaction(loader);
         fprintf(stderr, "Debug target not supported (ID code 0x%X)\n", nIDCode);
-        return 0;
-    }
-    if (!PowerOn(loader)) {
+    } else if (!PowerOn(loader))
         fprintf(stderr, "Target connect failed\n");
-        return 0;
+    else {
+        EndTransaction(loader);
+        bOK = 1;
     }
-    EndTransaction(loader);
-    return 1;
+    SetPhase(loader, Phase);
+    return bOK;
 }
 
 void SWDDeInitialise(struct CSWDLoader* loader) {
     DeInitPin(&loader->m_DataPin);
     DeInitPin(&loader->m_ClockPin);
-#if defined(USE_LIBPIGPIO)
+#if defined(USE_LIBPIGPIO) || defined(USE_GPIOMEM)
     // Leave reset high
     if (loader->m_bResetAvailable)
         DeInitPin(&loader->m_ResetPin);
 #endif
 }
 
-static long timediff(clock_t t1, clock_t t2) {
-    long elapsed;
-    elapsed = ((double)t2 - t1) / CLOCKS_PER_SEC * 1000;
-    return elapsed;
+void SWDSetClock(struct CSWDLoader* loader, unsigned nClockRateKHz) {
+    TimingSetRate(&loader->m_Timing, nClockRateKHz);
+    if (loader->m_pSPI)
+        SPISetSpeed(loader->m_pSPI, nClockRateKHz * 1000);
 }
 
-int SWDLoad(struct CSWDLoader* loader, const void* pProgram, size_t nProgSize,
-            uint32_t nAddress) {
+int SWDCheckLink(struct CSWDLoader* loader) {
+    uint32_t nIDCode = 0, nCtrlStat = 0;
+    BeginTransaction(loader);
+    // sticky flags left by a failed access make every AP access FAULT
+    int bOK = ReadData(loader, RD_DP_DPIDR, &nIDCode) &&
+              ReadData(loader, RD_DP_CTRL_STAT, &nCtrlStat);
+    EndTransaction(loader);
+    return bOK && nIDCode == DP_DPIDR_SUPPORTED &&
+           !(nCtrlStat & (DP_CTRL_STAT_STICKYORUN | DP_CTRL_STAT_STICKYERR |
+                          DP_CTRL_STAT_WDATAERR));
+}
+
+int SWDCheckConnection(struct CSWDLoader* loader) {
+    if (SWDCheckLink(loader))
+        return 1;
+    printf("Reconnecting\n");
+    assert(loader->m_nTargets);
+    if (loader->m_nTarget >= loader->m_nTargets)
+        loader->m_nTarget = 0; // none selected after SWDScan()
+    return Connect(loader);
+}
+
+static const char* s_PhaseNames[SWDPhases] = {"connect", "halt",  "load",
+                                               "verify",  "start", "other"};
+
+const char* SWDPhaseName(enum TSWDPhase Phase) { return s_PhaseNames[Phase]; }
+
+static const char* s_VerifyNames[] = {"none", "first", "sampled", "full",
+                                      "crc"};
+
+const char* SWDVerifyName(enum TSWDVerify Verify) {
+    return s_VerifyNames[Verify];
+}
+
+static void SetPhase(struct CSWDLoader* loader, enum TSWDPhase Phase) {
+    SWD_STATS_PHASE(Phase);
+    loader->m_Phase = Phase;
+}
+
+void SWDReportRetries(const struct CSWDLoader* loader, FILE* pFile) {
+    int bAny = 0;
+    fprintf(pFile, "Retries:");
+    for (unsigned i = 0; i < SWDPhases; i++) {
+        const struct TSWDRetries* retries = &loader->m_Retries[i];
+        if (!retries->m_nWaits && !retries->m_nFaults &&
+            !retries->m_nParity && !retries->m_nResumes)
+            continue;
+        fprintf(pFile, "%s %s %llu WAIT, %llu FAULT, %llu parity, %llu resumed",
+                bAny ? ";" : "", SWDPhaseName(i),
+                (unsigned long long)retries->m_nWaits,
+                (unsigned long long)retries->m_nFaults,
+                (unsigned long long)retries->m_nParity,
+                (unsigned long long)retries->m_nResumes);
+        bAny = 1;
+    }
+    fprintf(pFile, bAny ? "\n" : " none\n");
+}
+
+// Halt and keep XIP and USB from interfering with the load
+static int PrepareLoad(struct CSWDLoader* loader) {
     if (!SWDHalt(loader))
         return 0;
-    clock_t nStart, nEnd;
-    nStart = clock();
     printf("Disabling XIP and USB\n");
     BeginTransaction(loader);
     if (!WriteData(loader, WR_AP_TAR, XIP_CNTL)) {
@@ -211,24 +258,150 @@ int SWDLoad(struct CSWDLoader* loader, const void* pProgram, size_t nProgSize,
         return 0;
     }
     EndTransaction(loader);
-    if (!SWDLoadChunk(loader, pProgram, nProgSize, nAddress))
+    return 1;
+}
+
+// Incrementally, compressed or plain, whichever applies
+static int LoadRange(struct CSWDLoader* loader, const void* pData,
+                     size_t nSize, uint32_t nAddress) {
+    int bLoaded = LoadDelta(loader, pData, nSize, nAddress);
+    if (!bLoaded)
+        bLoaded = LoadPacked(loader, pData, nSize, nAddress);
+    if (bLoaded < 0)
+        return 0;
+    return bLoaded || SWDLoadChunk(loader, pData, nSize, nAddress);
+}
+
+static void ReportLoad(struct CSWDLoader* loader, size_t nSize,
+                       uint64_t nStart) {
+    // wall time, the process mostly waits on GPIO calls
+    double diff_t = (TimingNow() - nStart) / 1e9;
+    printf("\n%lu bytes loaded in %.2f seconds (%.1f KBytes/s)\n", nSize,
+           diff_t, nSize / diff_t / 1024.0);
+    TimingReport(&loader->m_Timing, stdout);
+}
+
+int SWDLoad(struct CSWDLoader* loader, const void* pProgram, size_t nProgSize,
+            uint32_t nAddress) {
+    uint64_t nStart = TimingNow();
+    TimingStart(&loader->m_Timing);
+    if (!PrepareLoad(loader) ||
+        !LoadRange(loader, pProgram, nProgSize, nAddress))
         return 0;
-    nEnd = clock();
-    double diff_t = timediff(nStart, nEnd) / 1000.0;
-    printf("\n%lu bytes loaded in %.2f seconds (%.1f KBytes/s)\n", nProgSize,
-           diff_t, nProgSize / diff_t / 1024.0);
+    ReportLoad(loader, nProgSize, nStart);
     return SWDStart(loader, nAddress);
 }
 
+int SWDLoadImage(struct CSWDLoader* loader, const struct CSWDImage* image) {
+    for (unsigned i = 0; i < image->m_nSegments; i++) {
+        const struct TSWDSegment* segment = &image->m_pSegments[i];
+        if (segment->m_nAddress < SRAM_BASE ||
+            segment->m_nAddress + segment->m_nSize > SRAM_END) {
+            fprintf(stderr, "Segment 0x%08X-0x%08zX is not in RAM\n",
+                    segment->m_nAddress,
+                    segment->m_nAddress + segment->m_nSize);
+            return 0;
+        }
+    }
+    uint64_t nStart = TimingNow();
+    TimingStart(&loader->m_Timing);
+    if (!PrepareLoad(loader))
+        return 0;
+    // ascending, the compressed upload scratch area is above the segment
+    enum TSWDVerify Verify = loader->m_Verify;
+    int bOK = 1;
+    for (unsigned i = 0; bOK && i < image->m_nSegments; i++) {
+        const struct TSWDSegment* segment = &image->m_pSegments[i];
+        // a manifest may set the policy per entry
+        if (segment->m_nVerify != SWD_VERIFY_LOADER)
+            loader->m_Verify = (enum TSWDVerify)segment->m_nVerify;
+        bOK = LoadSegment(loader, segment->m_pData, segment->m_nSize,
+                          segment->m_nAddress);
+        loader->m_Verify = Verify;
+    }
+    if (!bOK)
+        return 0;
+    ReportLoad(loader, image->m_nSize, nStart);
+    return SWDStart(loader, image->m_nEntry & ~1U);
+}
+
+unsigned SWDScan(struct CSWDLoader* loader, uint32_t nTargetID) {
+    struct TSWDTarget Found[SWD_MAX_TARGETS];
+    unsigned nFound = 0;
+    BeginTransaction(loader);
+    for (unsigned i = 0; i < DP_TARGETSEL_TINSTANCE_COUNT; i++) {
+        if (i == DP_TARGETSEL_TINSTANCE_RESCUE)
+            continue;
+        uint32_t nTargetSel = nTargetID | (i << DP_TARGETSEL_TINSTANCE__SHIFT);
+        uint32_t nIDCode;
+        if (!ProbeTarget(loader, nTargetSel, &nIDCode))
+            continue;
+        printf("Found DP instance %u (ID code 0x%X)\n", i, nIDCode);
+        // keep what is known about DPs already used
+        struct TSWDTarget* target = &Found[nFound++];
+        memset(target, 0, sizeof(*target));
+        target->m_nTargetSel = nTargetSel;
+        for (unsigned j = 0; j < loader->m_nTargets; j++)
+            if (loader->m_Targets[j].m_nTargetSel == nTargetSel)
+                *target = loader->m_Targets[j];
+    }
+    EndTransaction(loader);
+    memcpy(loader->m_Targets, Found, sizeof(Found));
+    loader->m_nTargets = nFound;
+    // no DP is selected after the last probe
+    loader->m_nTarget = SWD_MAX_TARGETS;
+    if (nFound && !SWDSelectTarget(loader, 0))
+        return 0;
+    return nFound;
+}
+
+int SWDSelectTarget(struct CSWDLoader* loader, unsigned nTarget) {
+    assert(nTarget < loader->m_nTargets);
+    if (nTarget == loader->m_nTarget)
+        return 1;
+    struct TSWDTarget* target = &loader->m_Targets[nTarget];
+    uint32_t nIDCode;
+    BeginTransaction(loader);
+    if (!ProbeTarget(loader, target->m_nTargetSel, &nIDCode)) {
+        loader->m_nTarget = SWD_MAX_TARGETS;
+        fprintf(stderr, "Target 0x%08X does not respond\n",
+                target->m_nTargetSel);
+        return 0;
+    }
+    loader->m_nTarget = nTarget;
+    if (!target->m_bPowered && !PowerOn(loader)) {
+        fprintf(stderr, "Target connect failed\n");
+        return 0;
+    }
+    EndTransaction(loader);
+    return 1;
+}
+
+// Word accesses with TAR auto-increment, written unless already set
+static int WriteCSW(struct CSWDLoader* loader) {
+    assert(loader->m_nTarget < loader->m_nTargets);
+    struct TSWDTarget* target = &loader->m_Targets[loader->m_nTarget];
+    uint32_t nCSW =
+        (AP_CSW_SIZE_32BITS << AP_CSW_SIZE__SHIFT) |
+        (AP_CSW_SIZE_INCREMENT_SINGLE << AP_CSW_ADDR_INC__SHIFT) |
+        AP_CSW_DEVICE_EN | (AP_CSW_PROT_DEFAULT << AP_CSW_PROT__SHIFT) |
+        AP_CSW_DBG_SW_ENABLE;
+    if (nCSW == target->m_nCSW)
+        return 1;
+    if (!WriteData(loader, WR_AP_CSW, nCSW))
+        return 0;
+    target->m_nCSW = nCSW;
+    return 1;
+}
+
 int SWDHalt(struct CSWDLoader* loader) {
+    SetPhase(loader, SWDPhaseHalt);
     BeginTransaction(loader);
-    if (!WriteData(
-            loader, WR_AP_CSW,
-            (AP_CSW_SIZE_32BITS << AP_CSW_SIZE__SHIFT) |
-                (AP_CSW_SIZE_INCREMENT_SINGLE << AP_CSW_ADDR_INC__SHIFT) |
-                AP_CSW_DEVICE_EN | (AP_CSW_PROT_DEFAULT << AP_CSW_PROT__SHIFT) |
-                AP_CSW_DBG_SW_ENABLE) ||
-        !WriteMem(loader, DHCSR,
+    if (!WriteCSW(loader)) {
+        fprintf(stderr, "Target halt failed\n");
+        return 0;
+    }
+    if (!WriteMem(loader, DHCSR,
                   DHCSR_C_DEBUGEN | DHCSR_C_HALT |
                       (DHCSR_DBGKEY_KEY << DHCSR_DBGKEY__SHIFT))) {
         fprintf(stderr, "Target halt failed\n");
@@ -238,52 +411,966 @@ int SWDHalt(struct CSWDLoader* loader) {
     return 1;
 }
 
-int SWDLoadChunk(struct CSWDLoader* loader, const void* pChunk,
-                 size_t nChunkSize, uint32_t nAddress) {
-    assert(pChunk != 0);
-    assert((nChunkSize & 3) == 0);
-    int iChunkSize = nChunkSize;
-    uint32_t* pChunk32 = (uint32_t*)pChunk;
-    while (iChunkSize > 0) {
-        printf("\rLoading @ 0x%08x", nAddress);
-        fflush(stdout);
+struct TChunk {
+    const uint32_t* m_pData;
+    size_t m_nSize;
+    uint32_t m_nAddress;
+    unsigned m_nBlockSize;
+    int m_bStream;
+    unsigned m_nFirstBlock; // where the pipe starts, after a resume
+};
+
+// Blocks are aligned to the block size in the target address space, so TAR
+// auto-increment never crosses a 1 KB boundary within a block
+// \return Size of block nBlock of the range, 0 past its end
+static size_t BlockSpan(uint32_t nAddress, size_t nSize, unsigned nBlockSize,
+                        unsigned nBlock, size_t* pnOffset) {
+    size_t nFirst = nAddress & (nBlockSize - 1);
+    size_t nOffset = nBlock ? (size_t)nBlock * nBlockSize - nFirst : 0;
+    size_t nEnd = (size_t)(nBlock + 1) * nBlockSize - nFirst;
+    *pnOffset = nOffset;
+    if (nOffset >= nSize)
+        return 0;
+    return (nEnd < nSize ? nEnd : nSize) - nOffset;
+}
+
+static unsigned BlockCount(uint32_t nAddress, size_t nSize,
+                           unsigned nBlockSize) {
+    size_t nFirst = nAddress & (nBlockSize - 1);
+    return (nFirst + nSize + nBlockSize - 1) / nBlockSize;
+}
+
+// Producer side of SWDLoadChunk(): TAR setup plus the DRW writes of one
+// block
+static void CompileBlock(struct CSWDWave* wave, unsigned nBlock,
+                         void* pParam) {
+    const struct TChunk* chunk = (const struct TChunk*)pParam;
+    nBlock += chunk->m_nFirstBlock;
+    size_t nOffset;
+    size_t nBlockSize = BlockSpan(chunk->m_nAddress, chunk->m_nSize,
+                                  chunk->m_nBlockSize, nBlock, &nOffset);
+    const uint32_t* pData = chunk->m_pData + nOffset / 4;
+    WaveIdle(wave);
+    if (!chunk->m_bStream) {
+        WaveWriteData(wave, WR_AP_TAR, chunk->m_nAddress + nOffset);
+        for (size_t i = 0; i < nBlockSize; i += 4)
+            WaveWriteData(wave, WR_AP_DRW, *pData++);
+        WaveIdle(wave);
+        return;
+    }
+    // With ORUNDETECT set a WAIT or FAULT only sets a sticky flag, all
+    // following AP requests are answered with FAULT and their data ignored.
+    // The CTRL/STAT read at the end tells whether the block made it.
+    WaveStreamData(wave, WR_AP_TAR, chunk->m_nAddress + nOffset);
+    for (size_t i = 0; i < nBlockSize; i += 4)
+        WaveStreamData(wave, WR_AP_DRW, *pData++);
+    WaveReadData(wave, RD_DP_CTRL_STAT);
+    WaveIdle(wave);
+}
+
+static void WaveDelay(void* pParam) {
+    TimingHalfPeriod((struct CSWDTiming*)pParam);
+}
+
+#if defined(USE_GPIOTRACE)
+// Record the decoded requests of a played wave up to nFailed, at times
+// spread evenly over the wave
+static void TraceWave(const struct CSWDWave* wave, unsigned nFailed,
+                      uint64_t nStart) {
+    uint64_t nNanos = GPIOTraceNow() - nStart;
+    for (unsigned i = 0; i < wave->m_nOps && i <= nFailed; i++) {
+        const struct TSWDWaveOp* op = &wave->m_pOps[i];
+        unsigned nAck = op->m_nAck == WAVE_NO_ACK ? GPIO_TRACE_NO_ACK
+                        : i == nFailed && op->m_nResponse == DP_OK
+                            ? SWD_PARITY_ERROR
+                            : op->m_nResponse;
+        GPIO_TRACE_REQUEST(nStart + nNanos * i / wave->m_nOps,
+                           op->m_nRequest, nAck, op->m_nData);
+    }
+}
+#endif
+
+// Clock out a compiled block and check its ACKs. A block is replayed after
+// a WAIT, FAULT or parity error, or sticky flags set by a streamed block,
+// once these have been cleared and SELECT and CSW restored.
+static int PlayBlock(struct CSWDLoader* loader, struct CSWDWave* wave,
+                     int bStream) {
+    // the wave writes TAR
+    loader->m_Targets[loader->m_nTarget].m_bTAR = 0;
+    for (unsigned nTry = 0;; nTry++) {
+        // unpaced it only counts, and checks for stalls now and then
+        TimingGap(&loader->m_Timing);
+#if defined(USE_GPIOTRACE)
+        uint64_t nTraceStart = GPIOTraceNow();
+#endif
+        if (loader->m_pSPI) {
+            if (!SPIPlayWave(loader->m_pSPI, &loader->m_ClockPin,
+                             &loader->m_DataPin, wave->m_pSteps,
+                             wave->m_nSteps, wave->m_pSamples))
+                return 0;
+            // paced by the controller, not by TimingHalfPeriod()
+            loader->m_Timing.m_nHalfPeriods += wave->m_nSteps;
+            TimingGap(&loader->m_Timing);
+        } else
+            PlayWave(&loader->m_ClockPin, &loader->m_DataPin,
+                     wave->m_pSteps, wave->m_nSteps, wave->m_pSamples,
+                     WaveDelay, &loader->m_Timing);
+        loader->m_nTransactions += wave->m_nOps;
+        SWD_STATS_ADD(m_nBits, wave->m_nSteps / 2);
+#if defined(USE_SWDSTATS)
+        for (unsigned i = 0; i < wave->m_nOps; i++)
+            SWD_STATS_REQUEST(wave->m_pOps[i].m_nRequest);
+#endif
+        unsigned nFailed = WaveDecode(wave);
+#if defined(USE_GPIOTRACE)
+        TraceWave(wave, nFailed, nTraceStart);
+#endif
+        const struct TSWDWaveOp* op = &wave->m_pOps[wave->m_nOps - 1];
+        unsigned nResponse;
+        if (nFailed < wave->m_nOps) {
+            op = &wave->m_pOps[nFailed];
+            nResponse = op->m_nResponse == DP_OK ? SWD_PARITY_ERROR
+                                                 : op->m_nResponse;
+        } else if (bStream &&
+                   (op->m_nData & (DP_CTRL_STAT_STICKYORUN |
+                                   DP_CTRL_STAT_STICKYERR |
+                                   DP_CTRL_STAT_WDATAERR)))
+            nResponse = op->m_nData & DP_CTRL_STAT_STICKYORUN ? DP_WAIT
+                                                              : DP_FAULT;
+        else
+            return 1;
+        if (nResponse == SWD_PARITY_ERROR)
+            SWD_STATS_ADD(m_nParityErrors, 1);
+        else
+            SWD_STATS_RESPONSE(nResponse);
+        if (nTry == LOAD_BLOCK_RETRIES) {
+            if (nFailed < wave->m_nOps)
+                fprintf(stderr,
+                        "Request failed (req 0x%02X, data 0x%X, resp %u)\n",
+                        (unsigned)op->m_nRequest, op->m_nData,
+                        op->m_nResponse);
+            else
+                fprintf(stderr, "Block write failed (CTRL/STAT 0x%X)\n",
+                        op->m_nData);
+            return 0;
+        }
         BeginTransaction(loader);
-        if (!WriteData(loader, WR_AP_TAR, nAddress)) {
-            fprintf(stderr, "\nCannot write TAR (0x%X)\n", nAddress);
+        int bRecovered = Recover(loader, nResponse);
+        EndTransaction(loader);
+        if (!bRecovered)
+            return 0;
+    }
+}
+
+// Read back a block with posted DRW reads, the data of word i is returned
+// by request i + 2
+static int ReadBackBlock(struct CSWDLoader* loader, struct CSWDWave* wave,
+                         uint32_t nAddress, size_t nSize) {
+    WaveReset(wave);
+    WaveIdle(wave);
+    WaveWriteData(wave, WR_AP_TAR, nAddress);
+    for (size_t i = 0; i < nSize; i += 4)
+        WaveReadData(wave, RD_AP_DRW);
+    WaveReadData(wave, RD_DP_RDBUFF);
+    WaveIdle(wave);
+    return PlayBlock(loader, wave, 0);
+}
+
+int SWDReadBlock(struct CSWDLoader* loader, uint32_t nAddress, void* pBuffer,
+                 size_t nSize) {
+    assert(!(nAddress & 3) && !(nSize & 3));
+    uint32_t* pData = (uint32_t*)pBuffer;
+    BeginTransaction(loader);
+    int bOK = WriteCSW(loader);
+    EndTransaction(loader);
+    struct CSWDWave wave;
+    WaveInit(&wave);
+    size_t nOffset = 0, nBlockSize;
+    // one TAR write and one RDBUFF read per 1 KB
+    for (unsigned nBlock = 0;
+         bOK && (nBlockSize = BlockSpan(nAddress, nSize, LOAD_BLOCK_SIZE,
+                                        nBlock, &nOffset)) != 0;
+         nBlock++) {
+        bOK = ReadBackBlock(loader, &wave, nAddress + nOffset, nBlockSize);
+        for (size_t i = 0; bOK && i < nBlockSize / 4; i++)
+            pData[nOffset / 4 + i] = wave.m_pOps[i + 2].m_nData;
+    }
+    WaveFree(&wave);
+    if (!bOK)
+        fprintf(stderr, "Memory read failed (0x%zX)\n", nAddress + nOffset);
+    return bOK;
+}
+
+int SWDWriteWord(struct CSWDLoader* loader, uint32_t nAddress,
+                 uint32_t nData) {
+    BeginTransaction(loader);
+    if (!WriteCSW(loader) || !WriteMem(loader, nAddress, nData)) {
+        fprintf(stderr, "Memory write failed (0x%X)\n", nAddress);
+        return 0;
+    }
+    EndTransaction(loader);
+    return 1;
+}
+
+// Check a block that has just been written, according to m_Verify
+static int VerifyBlock(struct CSWDLoader* loader, struct CSWDWave* wave,
+                       const uint32_t* pData, uint32_t nAddress,
+                       size_t nSize) {
+    unsigned nWords = nSize / 4;
+    unsigned Index[VERIFY_SAMPLES] = {0};
+    unsigned nSamples = 1;
+    switch (loader->m_Verify) {
+    case SWDVerifyFirstWord:
+        break;
+    case SWDVerifySampled:
+        // first and last word, the others vary from block to block
+        Index[nSamples++] = nWords - 1;
+        for (; nSamples < VERIFY_SAMPLES; nSamples++)
+            Index[nSamples] =
+                ((nAddress >> 2) * 2654435761U + nSamples) % nWords;
+        break;
+    case SWDVerifyReadback:
+        if (!ReadBackBlock(loader, wave, nAddress, nSize)) {
+            fprintf(stderr, "\nMemory read failed (0x%X)\n", nAddress);
             return 0;
         }
-        int nBlockSize = 1024;
-        if (iChunkSize < nBlockSize)
-            nBlockSize = iChunkSize;
-        uint32_t* pChunk32_save = pChunk32;
-        for (unsigned i = 0; i < nBlockSize; i += 4)
-            if (!WriteData(loader, WR_AP_DRW, *pChunk32++)) {
-                fprintf(stderr, "\nMemory write failed (0x%X)\n", nAddress);
+        for (unsigned i = 0; i < nWords; i++)
+            if (wave->m_pOps[i + 2].m_nData != pData[i]) {
+                fprintf(stderr, "\nData mismatch @ 0x%X (0x%X != 0x%X)\n",
+                        nAddress + i * 4, wave->m_pOps[i + 2].m_nData,
+                        pData[i]);
                 return 0;
             }
+        return 1;
+    default:
+        return 1;
+    }
+    for (unsigned i = 0; i < nSamples; i++) {
+        uint32_t nWordAddress = nAddress + Index[i] * 4;
+        uint32_t nWordRead;
+        BeginTransaction(loader);
+        int bRead = ReadMem(loader, nWordAddress, &nWordRead);
         EndTransaction(loader);
+        if (!bRead) {
+            fprintf(stderr, "\nMemory read failed (0x%X)\n", nWordAddress);
+            return 0;
+        }
+        if (nWordRead != pData[Index[i]]) {
+            fprintf(stderr, "\nData mismatch @ 0x%X (0x%X != 0x%X)\n",
+                    nWordAddress, nWordRead, pData[Index[i]]);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Reset the DMA, whatever the previous program left its channels doing
+static int ResetDMA(struct CSWDLoader* loader) {
+    uint32_t nDone = 0;
+    int bOK =
+        WriteMem(loader, RESETS_RESET + REG_ALIAS_SET_BITS, RESETS_DMA) &&
+        WriteMem(loader, RESETS_RESET + REG_ALIAS_CLR_BITS, RESETS_DMA);
+    for (unsigned i = 0; bOK && !(nDone & RESETS_DMA) && i < VERIFY_POLLS;
+         i++)
+        bOK = ReadMem(loader, RESETS_RESET_DONE, &nDone);
+    return bOK && (nDone & RESETS_DMA);
+}
+
+// Run channel DMA_CH to completion
+static int RunTargetDMA(struct CSWDLoader* loader, uint32_t nRead,
+                        uint32_t nWrite, uint32_t nCount, uint32_t nCtrl) {
+    // the channel registers are consecutive, TAR auto-increments
+    int bOK = WriteData(loader, WR_AP_TAR, DMA_CH_READ_ADDR) &&
+              WriteData(loader, WR_AP_DRW, nRead) &&
+              WriteData(loader, WR_AP_DRW, nWrite) &&
+              WriteData(loader, WR_AP_DRW, nCount) &&
+              WriteData(loader, WR_AP_DRW, nCtrl);
+    nCtrl = DMA_CTRL_BUSY;
+    for (unsigned i = 0; bOK && (nCtrl & DMA_CTRL_BUSY) && i < VERIFY_POLLS;
+         i++)
+        bOK = ReadMem(loader, DMA_CH_CTRL_TRIG, &nCtrl);
+    return bOK && !(nCtrl & (DMA_CTRL_BUSY | DMA_CTRL_AHB_ERROR));
+}
+
+// Clear a RAM range on the target: its first word is written, the DMA
+// copies it over the rest
+static int TargetFill(struct CSWDLoader* loader, uint32_t nAddress,
+                      size_t nSize) {
+    uint32_t nCtrl =
+        DMA_CTRL_EN | (DMA_CTRL_DATA_SIZE_WORD << DMA_CTRL_DATA_SIZE__SHIFT) |
+        DMA_CTRL_INCR_WRITE |
+        (DMA_CH << DMA_CTRL_CHAIN_TO__SHIFT) | // chaining to itself disables
+        (DMA_CTRL_TREQ_SEL_PERMANENT << DMA_CTRL_TREQ_SEL__SHIFT);
+    uint32_t nLast = ~0U;
+    BeginTransaction(loader);
+    int bOK = ResetDMA(loader) && WriteMem(loader, nAddress, 0) &&
+              RunTargetDMA(loader, nAddress, nAddress + 4, nSize / 4 - 1,
+                           nCtrl) &&
+              (loader->m_Verify == SWDVerifyNone ||
+               ReadMem(loader, nAddress + nSize - 4, &nLast));
+    EndTransaction(loader);
+    if (!bOK) {
+        fprintf(stderr, "\nTarget fill failed (0x%X)\n", nAddress);
+        return 0;
+    }
+    if (loader->m_Verify != SWDVerifyNone && nLast) {
+        fprintf(stderr, "\nData mismatch @ 0x%zX (0x%X != 0)\n",
+                nAddress + nSize - 4, nLast);
+        return 0;
+    }
+    return 1;
+}
+
+// Attach the sniffer to channel DMA_CH
+static int PrepareTargetCRC(struct CSWDLoader* loader) {
+    uint32_t nSniffCtrl =
+        DMA_SNIFF_CTRL_EN | (DMA_CH << DMA_SNIFF_CTRL_DMACH__SHIFT) |
+        (DMA_SNIFF_CTRL_CALC_CRC32R << DMA_SNIFF_CTRL_CALC__SHIFT) |
+        DMA_SNIFF_CTRL_OUT_REV | DMA_SNIFF_CTRL_OUT_INV;
+    return ResetDMA(loader) && WriteMem(loader, DMA_SNIFF_CTRL, nSniffCtrl);
+}
+
+// Have the target compute the CRC32 of a RAM or flash range: DMA channel
+// DMA_CH reads it into a single SRAM word with the sniffer watching, so
+// the range itself is never written. The word is restored afterwards.
+static int TargetCRC32(struct CSWDLoader* loader, uint32_t nAddress,
+                       size_t nSize, uint32_t* pCRC) {
+    uint32_t nCtrl =
+        DMA_CTRL_EN | (DMA_CTRL_DATA_SIZE_WORD << DMA_CTRL_DATA_SIZE__SHIFT) |
+        DMA_CTRL_INCR_READ |
+        (DMA_CH << DMA_CTRL_CHAIN_TO__SHIFT) | // chaining to itself disables
+        (DMA_CTRL_TREQ_SEL_PERMANENT << DMA_CTRL_TREQ_SEL__SHIFT) |
+        DMA_CTRL_SNIFF_EN;
+    uint32_t nScratch = CRC_SCRATCH, nSaved;
+    if (nAddress <= nScratch && nAddress + nSize > nScratch)
+        nScratch = nAddress - 4; // the range reaches the top of SRAM
+    if (nScratch < SRAM_BASE) {
+        fprintf(stderr, "\nNo SRAM left for the target CRC\n");
+        return 0;
+    }
+    return ReadMem(loader, nScratch, &nSaved) &&
+           WriteMem(loader, DMA_SNIFF_DATA, 0xFFFFFFFF) &&
+           RunTargetDMA(loader, nAddress, nScratch, nSize / 4, nCtrl) &&
+           ReadMem(loader, DMA_SNIFF_DATA, pCRC) &&
+           WriteMem(loader, nScratch, nSaved);
+}
+
+static int VerifyCRC(struct CSWDLoader* loader, const void* pData,
+                     size_t nSize, uint32_t nAddress) {
+    if (!nSize)
+        return 1;
+    uint32_t nCRC = CRC32(0, pData, nSize), nTargetCRC;
+    BeginTransaction(loader);
+    int bOK = PrepareTargetCRC(loader) &&
+              TargetCRC32(loader, nAddress, nSize, &nTargetCRC);
+    EndTransaction(loader);
+    if (!bOK) {
+        fprintf(stderr, "\nTarget CRC failed\n");
+        return 0;
+    }
+    if (nTargetCRC != nCRC) {
+        fprintf(stderr, "\nCRC mismatch (0x%08X != 0x%08X)\n", nTargetCRC,
+                nCRC);
+        return 0;
+    }
+    return 1;
+}
+
+// Verify a range that has not been written by SWDLoadChunk()
+static int VerifyRange(struct CSWDLoader* loader, const void* pData,
+                       size_t nSize, uint32_t nAddress) {
+    if (loader->m_Verify == SWDVerifyCRC)
+        return VerifyCRC(loader, pData, nSize, nAddress);
+    struct CSWDWave readback;
+    WaveInit(&readback);
+    int bOK = 1;
+    size_t nOffset, nBlockSize;
+    for (unsigned nBlock = 0;
+         bOK && (nBlockSize = BlockSpan(nAddress, nSize, loader->m_nBlockSize,
+                                        nBlock, &nOffset)) != 0;
+         nBlock++)
+        bOK = VerifyBlock(loader, &readback,
+                          (const uint32_t*)pData + nOffset / 4,
+                          nAddress + nOffset, nBlockSize);
+    WaveFree(&readback);
+    return bOK;
+}
+
+// Write and verify the blocks of a chunk from *pnBlock on, *pnBlock is left
+// at the first block not verified
+static int LoadBlocks(struct CSWDLoader* loader, struct TChunk* chunk,
+                      struct CSWDWave* readback, unsigned* pnBlock,
+                      unsigned nBlocks) {
+    // CSW is unknown after a reconnect
+    BeginTransaction(loader);
+    int bOK = WriteCSW(loader);
+    EndTransaction(loader);
+    struct CSWDWavePipe pipe;
+    chunk->m_nFirstBlock = *pnBlock;
+    if (!bOK || !WavePipeStart(&pipe, nBlocks - *pnBlock, CompileBlock,
+                               chunk)) {
+        fprintf(stderr, "\nCannot start wave compiler\n");
+        return 0;
+    }
+    struct CSWDWave* wave;
+    for (; (wave = WavePipeNext(&pipe)) != 0; ++*pnBlock) {
+        size_t nOffset;
+        size_t nSize = BlockSpan(chunk->m_nAddress, chunk->m_nSize,
+                                 chunk->m_nBlockSize, *pnBlock, &nOffset);
+        uint32_t nBlockAddress = chunk->m_nAddress + nOffset;
+        printf("\rLoading @ 0x%08x", nBlockAddress);
+        fflush(stdout);
+        SetPhase(loader, SWDPhaseLoad);
+        bOK = PlayBlock(loader, wave, chunk->m_bStream);
+        WavePipeRelease(&pipe, wave);
+        if (!bOK) {
+            fprintf(stderr, "\nMemory write failed (0x%X)\n", nBlockAddress);
+            break;
+        }
+        SetPhase(loader, SWDPhaseVerify);
+        bOK = VerifyBlock(loader, readback, chunk->m_pData + nOffset / 4,
+                          nBlockAddress, nSize);
+        if (!bOK)
+            break;
+    }
+    WavePipeStop(&pipe);
+    return bOK;
+}
+
+int SWDLoadChunk(struct CSWDLoader* loader, const void* pChunk,
+                 size_t nChunkSize, uint32_t nAddress) {
+    assert(pChunk != 0);
+    assert((nChunkSize & 3) == 0);
+    unsigned nBlockSize = loader->m_nBlockSize;
+    assert(nBlockSize && !(LOAD_BLOCK_SIZE % nBlockSize) && !(nBlockSize & 3));
+    struct TChunk chunk = {(const uint32_t*)pChunk, nChunkSize, nAddress,
+                           nBlockSize, loader->m_bStreamWrites, 0};
+    unsigned nBlocks = BlockCount(nAddress, nChunkSize, nBlockSize);
+    struct CSWDWave readback;
+    WaveInit(&readback);
+    unsigned nBlock = 0, nResumes = 0;
+    int bOK;
+    for (;;) {
+        unsigned nFirst = nBlock;
+        bOK = LoadBlocks(loader, &chunk, &readback, &nBlock, nBlocks);
+        // only resumes without progress count against the limit
+        if (nBlock > nFirst)
+            nResumes = 0;
+        if (bOK || nBlock == nBlocks || nResumes++ == LOAD_RESUMES ||
+            !SWDCheckConnection(loader))
+            break;
+        // the blocks before nBlock are in place
+        loader->m_Retries[SWDPhaseLoad].m_nResumes++;
+        printf("Resuming at block %u of %u\n", nBlock, nBlocks);
+    }
+    WaveFree(&readback);
+    SetPhase(loader, SWDPhaseVerify);
+    if (bOK && loader->m_Verify == SWDVerifyCRC)
+        bOK = VerifyCRC(loader, pChunk, nChunkSize, nAddress);
+    SetPhase(loader, SWDPhaseLoad);
+    return bOK;
+}
+
+// Unpacker, r0 compressed data, r1 output, r2 output end, r3 mailbox. The
+// output end is stored to the mailbox when done. Thumb code, assembled
+// with llvm-mc -triple=thumbv6m-none-eabi:
+//
+//  loop:       cmp     r1, r2          copy:       ldrb    r6, [r5]
+//              bhs     done                        adds    r5, r5, #1
+//              ldrb    r4, [r0]                    strb    r6, [r1]
+//              adds    r0, r0, #1                  adds    r1, r1, #1
+//              cmp     r4, #127                    subs    r4, r4, #1
+//              bhi     match                       bne     copy
+//              adds    r4, r4, #1                  b       loop
+//  literal:    ldrb    r5, [r0]        done:       str     r1, [r3]
+//              adds    r0, r0, #1      halt:       b       halt
+//              strb    r5, [r1]
+//              adds    r1, r1, #1
+//              subs    r4, r4, #1
+//              bne     literal
+//              b       loop
+//  match:      subs    r4, #125
+//              ldrb    r5, [r0]
+//              ldrb    r6, [r0, #1]
+//              adds    r0, r0, #2
+//              lsls    r6, r6, #8
+//              orrs    r5, r6
+//              subs    r5, r1, r5      distance back from the output
+static const uint16_t s_Unpacker[] = {
+    0x4291, 0xD219, 0x7804, 0x1C40, 0x2C7F, 0xD807, 0x1C64, 0x7805,
+    0x1C40, 0x700D, 0x1C49, 0x1E64, 0xD1F9, 0xE7F1, 0x3C7D, 0x7805,
+    0x7846, 0x1C80, 0x0236, 0x4335, 0x1B4D, 0x782E, 0x1C6D, 0x700E,
+    0x1C49, 0x1E64, 0xD1F9, 0xE7E3, 0x6019, 0xE7FE};
+
+#define UNPACKER_SIZE sizeof(s_Unpacker) // multiple of 4
+
+static int WriteCoreRegister(struct CSWDLoader* loader, unsigned nRegister,
+                             uint32_t nValue) {
+    return WriteMem(loader, DCRDR, nValue) &&
+           WriteMem(loader, DCRSR,
+                    (nRegister << DCRSR_REGSEL__SHIFT) | DCRSR_REGW_N_R);
+}
+
+static uint64_t WireNanos(const struct CSWDLoader* loader, size_t nWords) {
+    const struct CSWDTiming* timing = &loader->m_Timing;
+    uint64_t nHalfPeriod = timing->m_nHalfPeriodNanos;
+    if (nHalfPeriod < timing->m_nLatencyNanos)
+        nHalfPeriod = timing->m_nLatencyNanos;
+    return nWords * WIRE_BITS_PER_WORD * 2 * nHalfPeriod;
+}
+
+// Upload the image compressed, behind the unpacker, between the end of the
+// image and SRAM_STRIPED_END, run the unpacker and halt the core again
+// \return 1 if loaded, 0 if not worthwhile (nothing written), -1 on error
+static int LoadPacked(struct CSWDLoader* loader, const void* pProgram,
+                      size_t nProgSize, uint32_t nAddress) {
+    if (loader->m_Compress == SWDCompressOff || nAddress < SRAM_BASE ||
+        nAddress + nProgSize > SRAM_STRIPED_END)
+        return 0;
+    uint8_t* pPacked = malloc(UNPACKER_SIZE + 4 + LZBound(nProgSize) + 3);
+    if (!pPacked)
+        return 0;
+    // unpacker, mailbox, compressed image
+    memcpy(pPacked, s_Unpacker, UNPACKER_SIZE);
+    memset(pPacked + UNPACKER_SIZE, 0, 4);
+    size_t nPackedSize =
+        UNPACKER_SIZE + 4 +
+        LZCompress(pProgram, nProgSize, pPacked + UNPACKER_SIZE + 4);
+    while (nPackedSize & 3)
+        pPacked[nPackedSize++] = 0;
+    uint32_t nStub = (SRAM_STRIPED_END - nPackedSize) & ~3U;
+    uint32_t nMailbox = nStub + UNPACKER_SIZE, nEnd = nAddress + nProgSize;
+    uint64_t nPlainNanos = WireNanos(loader, nProgSize / 4);
+    uint64_t nPackedNanos =
+        WireNanos(loader, nPackedSize / 4 + UNPACK_OVERHEAD_WORDS) +
+        (uint64_t)nProgSize * UNPACK_NANOS_PER_BYTE;
+    if (nStub < nEnd || (loader->m_Compress == SWDCompressAuto &&
+                         nPackedNanos >= nPlainNanos)) {
+        free(pPacked);
+        return 0;
+    }
+    printf("Compressed %lu to %lu bytes\n", nProgSize, nPackedSize);
+    enum TSWDVerify verify = loader->m_Verify;
+    if (verify == SWDVerifyCRC)
+        loader->m_Verify = SWDVerifyFirstWord; // the unpacked image is checked
+    int bOK = SWDLoadChunk(loader, pPacked, nPackedSize, nStub);
+    loader->m_Verify = verify;
+    free(pPacked);
+    if (!bOK)
+        return -1;
+    printf("\rUnpacking @ 0x%08x\n", nStub);
+    // interrupts of the previous program would vector into the image
+    const uint32_t pRegs[] = {nMailbox + 4, nAddress, nEnd, nMailbox};
+    bOK = RunTarget(loader, nStub, pRegs, sizeof(pRegs) / sizeof(pRegs[0]));
+    uint64_t nDeadline =
+        TimingNow() + (uint64_t)nProgSize * UNPACK_NANOS_PER_BYTE * 4 +
+        UNPACK_TIMEOUT_NANOS;
+    uint32_t nDone = 0;
+    while (bOK && nDone != nEnd && TimingNow() < nDeadline) {
         BeginTransaction(loader);
-        uint32_t nWordRead;
-        if (!ReadMem(loader, nAddress, &nWordRead))
-            fprintf(stderr, "\nMemory read failed (0x%X)\n", nAddress);
+        bOK = ReadMem(loader, nMailbox, &nDone);
         EndTransaction(loader);
-        if (nWordRead != *pChunk32_save) {
-            fprintf(stderr, "\nData mismatch (0x%X != 0x%X)\n", nWordRead,
-                    *pChunk32_save);
+    }
+    if (!bOK || nDone != nEnd) {
+        fprintf(stderr, "Unpacker did not complete (0x%X)\n", nDone);
+        return -1;
+    }
+    if (!SWDHalt(loader) || !VerifyRange(loader, pProgram, nProgSize, nAddress))
+        return -1;
+    return 1;
+}
+
+// Compare the CRC32 of each 1 KB block in target RAM with the image and
+// load the runs of changed blocks. RAM left from a previous load is reused
+// whatever happened in between, a reset or another image only means more
+// blocks differ.
+// \return 1 if loaded, 0 if a full load is preferable, -1 on error
+static int LoadDelta(struct CSWDLoader* loader, const void* pProgram,
+                     size_t nProgSize, uint32_t nAddress) {
+    if (!loader->m_bDelta || nAddress < SRAM_BASE ||
+        nAddress + nProgSize > SRAM_END)
+        return 0;
+    unsigned nBlocks = BlockCount(nAddress, nProgSize, LOAD_BLOCK_SIZE);
+    uint8_t* pChanged = calloc(nBlocks ? nBlocks : 1, 1);
+    if (!pChanged)
+        return 0;
+    const uint8_t* pData = (const uint8_t*)pProgram;
+    unsigned nChanged = 0;
+    BeginTransaction(loader);
+    int bOK = PrepareTargetCRC(loader);
+    for (unsigned i = 0; bOK && i < nBlocks; i++) {
+        size_t nOffset;
+        size_t nSize =
+            BlockSpan(nAddress, nProgSize, LOAD_BLOCK_SIZE, i, &nOffset);
+        uint32_t nCRC;
+        bOK = TargetCRC32(loader, nAddress + nOffset, nSize, &nCRC);
+        if (!bOK)
+            break;
+        pChanged[i] = nCRC != CRC32(0, pData + nOffset, nSize);
+        nChanged += pChanged[i];
+    }
+    EndTransaction(loader);
+    if (!bOK) {
+        fprintf(stderr, "Target CRC failed, loading all blocks\n");
+        free(pChanged);
+        return 0;
+    }
+    printf("%u of %u blocks changed\n", nChanged, nBlocks);
+    if (nChanged * 100 > nBlocks * DELTA_MAX_PERCENT) {
+        free(pChanged);
+        return 0;
+    }
+    // runs of changed blocks, each verified according to m_Verify
+    for (unsigned i = 0; bOK && i < nBlocks;) {
+        if (!pChanged[i]) {
+            i++;
+            continue;
+        }
+        size_t nOffset, nEnd = 0, nSize = 0;
+        BlockSpan(nAddress, nProgSize, LOAD_BLOCK_SIZE, i, &nOffset);
+        for (; i < nBlocks && pChanged[i]; i++) {
+            nSize = BlockSpan(nAddress, nProgSize, LOAD_BLOCK_SIZE, i, &nEnd);
+            nEnd += nSize;
+        }
+        bOK = SWDLoadChunk(loader, pData + nOffset, nEnd - nOffset,
+                           nAddress + nOffset);
+    }
+    free(pChanged);
+    return bOK ? 1 : -1;
+}
+
+// Runs of at least FILL_MIN_WORDS zero words are cleared by the target, the
+// rest is loaded by LoadRange()
+static int LoadSegment(struct CSWDLoader* loader, const uint32_t* pData,
+                       size_t nSize, uint32_t nAddress) {
+    size_t nWords = nSize / 4, nLoaded = 0, i = 0;
+    while (i < nWords) {
+        if (pData[i]) {
+            i++;
+            continue;
+        }
+        size_t nZero = i;
+        while (i < nWords && !pData[i])
+            i++;
+        if (i - nZero < FILL_MIN_WORDS)
+            continue;
+        if (nZero > nLoaded &&
+            !LoadRange(loader, pData + nLoaded, (nZero - nLoaded) * 4,
+                       nAddress + nLoaded * 4))
+            return 0;
+        printf("\rClearing @ 0x%08zx", nAddress + nZero * 4);
+        fflush(stdout);
+        if (!TargetFill(loader, nAddress + nZero * 4, (i - nZero) * 4))
+            return 0;
+        nLoaded = i;
+    }
+    return nLoaded == nWords ||
+           LoadRange(loader, pData + nLoaded, (nWords - nLoaded) * 4,
+                     nAddress + nLoaded * 4);
+}
+
+// Flash stub, r0-r3 flash_range_erase() arguments, r4 flash offset, r5
+// sector buffer, r6 flash_range_erase, r7 flash_range_program. Assembled
+// with llvm-mc -triple=thumbv6m-none-eabi:
+//
+//              blx     r6
+//              movs    r0, r4
+//              movs    r1, r5
+//              movs    r2, #1
+//              lsls    r2, r2, #12     FLASH_SECTOR_SIZE
+//              blx     r7
+//  halt:       bkpt    #0              bootrom calls return here
+//  idle:       b       idle
+static const uint16_t s_FlashStub[] = {0x47B0, 0x0020, 0x0029, 0x2201,
+                                       0x0312, 0x47B8, 0xBE00, 0xE7FE};
+
+#define FLASH_STUB_HALT (FLASH_STUB + 12)
+#define FLASH_STUB_IDLE (FLASH_STUB + 14)
+
+// Bootrom functions used, in the order of their codes in s_FlashCodes
+enum TFlashFunction {
+    FlashConnect,
+    FlashExitXIP,
+    FlashErase,
+    FlashProgram,
+    FlashFlushCache,
+    FlashEnterXIP,
+    FlashFunctions
+};
+
+static const uint16_t s_FlashCodes[FlashFunctions] = {
+    ROM_FUNC_CONNECT_INTERNAL_FLASH, ROM_FUNC_FLASH_EXIT_XIP,
+    ROM_FUNC_FLASH_RANGE_ERASE,      ROM_FUNC_FLASH_RANGE_PROGRAM,
+    ROM_FUNC_FLASH_FLUSH_CACHE,      ROM_FUNC_FLASH_ENTER_CMD_XIP};
+
+static int ReadHalfword(struct CSWDLoader* loader, uint32_t nAddress,
+                        uint16_t* pData) {
+    uint32_t nWord;
+    if (!ReadMem(loader, nAddress & ~3U, &nWord))
+        return 0;
+    *pData = nWord >> (nAddress & 2) * 8;
+    return 1;
+}
+
+// Look the flash functions up in the bootrom function table
+static int FindFlashFunctions(struct CSWDLoader* loader,
+                              uint32_t pFunctions[FlashFunctions]) {
+    memset(pFunctions, 0, FlashFunctions * sizeof(uint32_t));
+    uint16_t nTable, nCode = 1, nFunction;
+    BeginTransaction(loader);
+    int bOK = ReadHalfword(loader, ROM_TABLE_POINTERS, &nTable);
+    for (unsigned i = 0; bOK && nCode && i < ROM_TABLE_MAX_ENTRIES; i++) {
+        bOK = ReadHalfword(loader, nTable + i * 4, &nCode) &&
+              ReadHalfword(loader, nTable + i * 4 + 2, &nFunction);
+        for (unsigned j = 0; bOK && nCode && j < FlashFunctions; j++)
+            if (nCode == s_FlashCodes[j])
+                pFunctions[j] = nFunction;
+    }
+    EndTransaction(loader);
+    for (unsigned j = 0; bOK && j < FlashFunctions; j++)
+        if (!pFunctions[j]) {
+            fprintf(stderr, "Bootrom function %c%c not found\n",
+                    s_FlashCodes[j] & 0xFF, s_FlashCodes[j] >> 8);
             return 0;
         }
-        nAddress += nBlockSize;
-        iChunkSize -= nBlockSize;
+    if (!bOK)
+        fprintf(stderr, "Cannot read bootrom function table\n");
+    return bOK;
+}
+
+// Release the halted core at nAddress with r0... set from pRegs, returning
+// to the flash stub's BKPT, interrupts stay masked
+static int RunTarget(struct CSWDLoader* loader, uint32_t nAddress,
+                     const uint32_t* pRegs, unsigned nRegs) {
+    uint32_t nDHCSR =
+        DHCSR_C_DEBUGEN | DHCSR_C_MASKINTS |
+        (DHCSR_DBGKEY_KEY << DHCSR_DBGKEY__SHIFT);
+    BeginTransaction(loader);
+    int bOK = 1;
+    for (unsigned i = 0; bOK && i < nRegs; i++)
+        bOK = WriteCoreRegister(loader, i, pRegs[i]);
+    // C_MASKINTS may only change while halted
+    bOK = bOK && WriteCoreRegister(loader, DCRSR_REGSEL_R13, SRAM_END) &&
+          WriteCoreRegister(loader, DCRSR_REGSEL_R14, FLASH_STUB_HALT | 1) &&
+          WriteCoreRegister(loader, DCRSR_REGSEL_XPSR, XPSR_T) &&
+          WriteCoreRegister(loader, DCRSR_REGSEL_R15, nAddress & ~1U) &&
+          WriteMem(loader, DHCSR, nDHCSR | DHCSR_C_HALT) &&
+          WriteMem(loader, DHCSR, nDHCSR);
+    EndTransaction(loader);
+    if (!bOK)
+        fprintf(stderr, "\nTarget start failed (0x%X)\n", nAddress);
+    return bOK;
+}
+
+static int WaitHalt(struct CSWDLoader* loader, uint64_t nTimeoutNanos) {
+    uint64_t nDeadline = TimingNow() + nTimeoutNanos;
+    uint32_t nDHCSR = 0;
+    int bOK = 1;
+    while (bOK && !(nDHCSR & DHCSR_S_HALT) && TimingNow() < nDeadline) {
+        BeginTransaction(loader);
+        bOK = ReadMem(loader, DHCSR, &nDHCSR);
+        EndTransaction(loader);
+    }
+    if (!bOK || !(nDHCSR & DHCSR_S_HALT)) {
+        fprintf(stderr, "\nTarget did not halt (DHCSR 0x%X)\n", nDHCSR);
+        return 0;
     }
     return 1;
 }
 
+static int CallFlashFunction(struct CSWDLoader* loader,
+                             const uint32_t pFunctions[FlashFunctions],
+                             enum TFlashFunction Function) {
+    return RunTarget(loader, pFunctions[Function], 0, 0) &&
+           WaitHalt(loader, FLASH_CALL_NANOS);
+}
+
+// Sector contents from the image, bytes not in the image are erased (0xFF)
+static void FillSector(const struct CSWDImage* image, uint32_t nAddress,
+                       uint8_t* pSector) {
+    memset(pSector, 0xFF, FLASH_SECTOR_SIZE);
+    for (unsigned i = 0; i < image->m_nSegments; i++) {
+        const struct TSWDSegment* segment = &image->m_pSegments[i];
+        uint32_t nStart = segment->m_nAddress, nEnd = nStart + segment->m_nSize;
+        if (nStart < nAddress)
+            nStart = nAddress;
+        if (nEnd > nAddress + FLASH_SECTOR_SIZE)
+            nEnd = nAddress + FLASH_SECTOR_SIZE;
+        if (nStart < nEnd)
+            memcpy(pSector + (nStart - nAddress),
+                   (const uint8_t*)segment->m_pData +
+                       (nStart - segment->m_nAddress),
+                   nEnd - nStart);
+    }
+}
+
+// \return Number of sectors with image data, their addresses in pSectors
+static unsigned ListSectors(const struct CSWDImage* image,
+                            uint32_t* pSectors) {
+    unsigned nSectors = 0;
+    for (unsigned i = 0; i < image->m_nSegments; i++) {
+        const struct TSWDSegment* segment = &image->m_pSegments[i];
+        uint32_t nFirst = segment->m_nAddress & ~(FLASH_SECTOR_SIZE - 1U);
+        for (uint32_t nSector = nFirst;
+             nSector < segment->m_nAddress + segment->m_nSize;
+             nSector += FLASH_SECTOR_SIZE)
+            // segments are sorted, only the last one may share a sector
+            if (!nSectors || pSectors[nSectors - 1] != nSector)
+                pSectors[nSectors++] = nSector;
+    }
+    return nSectors;
+}
+
+// CRC32 of flash sectors, compared through the uncached XIP alias
+static int CompareSectors(struct CSWDLoader* loader, const uint32_t* pSectors,
+                          const uint8_t* pData, unsigned nSectors,
+                          uint8_t* pChanged, unsigned* pChangedCount) {
+    SetPhase(loader, SWDPhaseVerify);
+    *pChangedCount = 0;
+    BeginTransaction(loader);
+    int bOK = PrepareTargetCRC(loader);
+    for (unsigned i = 0; bOK && i < nSectors; i++) {
+        if (!pChanged[i])
+            continue;
+        uint32_t nCRC; // the uncached alias is only read, XIP writes fault
+        bOK = TargetCRC32(loader,
+                          pSectors[i] - XIP_BASE + XIP_NOCACHE_NOALLOC_BASE,
+                          FLASH_SECTOR_SIZE, &nCRC);
+        pChanged[i] = nCRC != CRC32(0, pData + (size_t)i * FLASH_SECTOR_SIZE,
+                                    FLASH_SECTOR_SIZE);
+        *pChangedCount += pChanged[i];
+    }
+    EndTransaction(loader);
+    if (!bOK)
+        fprintf(stderr, "\nTarget CRC failed\n");
+    return bOK;
+}
+
+// Stream each changed sector into one of two SRAM buffers while the core
+// erases and programs the sector in the other
+static int ProgramSectors(struct CSWDLoader* loader,
+                          const uint32_t pFunctions[FlashFunctions],
+                          const uint32_t* pSectors, const uint8_t* pData,
+                          unsigned nSectors, const uint8_t* pChanged) {
+    int bOK = 1, bRunning = 0;
+    unsigned nBuffer = 0;
+    for (unsigned i = 0; bOK && i < nSectors; i++) {
+        if (!pChanged[i])
+            continue;
+        SetPhase(loader, SWDPhaseLoad);
+        uint32_t nOffset = pSectors[i] - XIP_BASE;
+        uint32_t nSectorBuffer = FLASH_BUFFER + nBuffer * FLASH_SECTOR_SIZE;
+        nBuffer ^= 1;
+        bOK = SWDLoadChunk(loader, pData + (size_t)i * FLASH_SECTOR_SIZE,
+                           FLASH_SECTOR_SIZE, nSectorBuffer) &&
+              (!bRunning || WaitHalt(loader, FLASH_SECTOR_NANOS));
+        if (!bOK)
+            break;
+        printf("\rFlashing @ 0x%08x", pSectors[i]);
+        fflush(stdout);
+        uint32_t Regs[] = {nOffset, FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE,
+                           FLASH_SECTOR_ERASE_CMD, nOffset, nSectorBuffer,
+                           pFunctions[FlashErase], pFunctions[FlashProgram]};
+        bOK = bRunning =
+            RunTarget(loader, FLASH_STUB, Regs, sizeof(Regs) / sizeof(Regs[0]));
+    }
+    if (bOK && bRunning)
+        bOK = WaitHalt(loader, FLASH_SECTOR_NANOS);
+    return bOK;
+}
+
+// Leave the stub idling and have the chip boot from flash
+static int ResetTarget(struct CSWDLoader* loader) {
+    SetPhase(loader, SWDPhaseStart);
+    printf("Resetting\n");
+    BeginTransaction(loader);
+    int bOK =
+        WriteCoreRegister(loader, DCRSR_REGSEL_R15, FLASH_STUB_IDLE) &&
+        WriteMem(loader, DHCSR,
+                 DHCSR_C_DEBUGEN | (DHCSR_DBGKEY_KEY << DHCSR_DBGKEY__SHIFT)) &&
+        WriteMem(loader, AIRCR,
+                 (AIRCR_VECTKEY_KEY << AIRCR_VECTKEY__SHIFT) |
+                     AIRCR_SYSRESETREQ);
+    EndTransaction(loader);
+    if (!bOK)
+        fprintf(stderr, "Target reset failed\n");
+    else
+        SetPhase(loader, SWDPhaseOther);
+    return bOK;
+}
+
+int SWDFlash(struct CSWDLoader* loader, const struct CSWDImage* image) {
+    for (unsigned i = 0; i < image->m_nSegments; i++) {
+        const struct TSWDSegment* segment = &image->m_pSegments[i];
+        uint32_t nEnd = segment->m_nAddress + segment->m_nSize;
+        if (segment->m_nAddress < XIP_BASE ||
+            nEnd > XIP_BASE + FLASH_MAX_SIZE) {
+            fprintf(stderr, "Segment 0x%08X-0x%08X is not in flash\n",
+                    segment->m_nAddress, nEnd);
+            return 0;
+        }
+    }
+    size_t nMaxSectors = image->m_nSize / FLASH_SECTOR_SIZE +
+                         2 * image->m_nSegments;
+    uint32_t* pSectors = malloc(nMaxSectors * sizeof(uint32_t));
+    uint8_t* pChanged = malloc(nMaxSectors);
+    uint8_t* pData = malloc(nMaxSectors * FLASH_SECTOR_SIZE);
+    if (!pSectors || !pChanged || !pData) {
+        fprintf(stderr, "Out of memory\n");
+        free(pSectors);
+        free(pChanged);
+        free(pData);
+        return 0;
+    }
+    unsigned nSectors = ListSectors(image, pSectors), nChanged = 0;
+    for (unsigned i = 0; i < nSectors; i++)
+        FillSector(image, pSectors[i], pData + (size_t)i * FLASH_SECTOR_SIZE);
+    memset(pChanged, 1, nSectors);
+    uint64_t nStart = TimingNow();
+    TimingStart(&loader->m_Timing);
+    uint32_t pFunctions[FlashFunctions];
+    // XIP in command mode for the CRCs, whatever the chip was doing
+    int bOK =
+        PrepareLoad(loader) && FindFlashFunctions(loader, pFunctions) &&
+        SWDLoadChunk(loader, s_FlashStub, sizeof(s_FlashStub), FLASH_STUB) &&
+        CallFlashFunction(loader, pFunctions, FlashConnect) &&
+        CallFlashFunction(loader, pFunctions, FlashExitXIP) &&
+        CallFlashFunction(loader, pFunctions, FlashFlushCache) &&
+        CallFlashFunction(loader, pFunctions, FlashEnterXIP) &&
+        CompareSectors(loader, pSectors, pData, nSectors, pChanged,
+                       &nChanged);
+    if (bOK)
+        printf("\n%u of %u sectors changed\n", nChanged, nSectors);
+    if (bOK && nChanged) {
+        unsigned nProgrammed = nChanged;
+        bOK = CallFlashFunction(loader, pFunctions, FlashConnect) &&
+              CallFlashFunction(loader, pFunctions, FlashExitXIP) &&
+              ProgramSectors(loader, pFunctions, pSectors, pData, nSectors,
+                             pChanged) &&
+              CallFlashFunction(loader, pFunctions, FlashFlushCache) &&
+              CallFlashFunction(loader, pFunctions, FlashEnterXIP) &&
+              (loader->m_Verify == SWDVerifyNone ||
+               CompareSectors(loader, pSectors, pData, nSectors, pChanged,
+                              &nChanged));
+        if (bOK && loader->m_Verify != SWDVerifyNone && nChanged) {
+            fprintf(stderr, "\n%u sectors failed to verify\n", nChanged);
+            bOK = 0;
+        }
+        if (bOK)
+            ReportLoad(loader, (size_t)nProgrammed * FLASH_SECTOR_SIZE,
+                       nStart);
+    }
+    free(pSectors);
+    free(pChanged);
+    free(pData);
+    return bOK && ResetTarget(loader);
+}
+
 int SWDStart(struct CSWDLoader* loader, uint32_t nAddress) {
+    SetPhase(loader, SWDPhaseStart);
     printf("Starting\n");
     BeginTransaction(loader);
-    if (!WriteMem(loader, DCRDR, nAddress) ||
-        !WriteMem(loader, DCRSR,
-                  (DCRSR_REGSEL_R15 << DCRSR_REGSEL__SHIFT) | DCRSR_REGW_N_R) ||
+    if (!WriteCoreRegister(loader, DCRSR_REGSEL_R15, nAddress) ||
         !WriteMem(loader, DHCSR,
                   DHCSR_C_DEBUGEN |
                       (DHCSR_DBGKEY_KEY << DHCSR_DBGKEY__SHIFT))) {
@@ -291,6 +1378,7 @@ int SWDStart(struct CSWDLoader* loader, uint32_t nAddress) {
         return 0;
     }
     EndTransaction(loader);
+    SetPhase(loader, SWDPhaseOther);
     return 1;
 }
 
@@ -299,8 +1387,10 @@ int PowerOn(struct CSWDLoader* loader) {
                    DP_ABORT_STKCMPCLR | DP_ABORT_STKERRCLR | DP_ABORT_WDERRCLR |
                        DP_ABORT_ORUNERRCLR))
         return 0;
+    struct TSWDTarget* target = &loader->m_Targets[loader->m_nTarget];
     if (!WriteData(loader, WR_DP_SELECT, DP_SELECT_DEFAULT))
         return 0;
+    target->m_nSelect = DP_SELECT_DEFAULT;
     if (!WriteData(loader, WR_DP_CTRL_STAT,
                    DP_CTRL_STAT_ORUNDETECT | DP_CTRL_STAT_STICKYERR |
                        DP_CTRL_STAT_CDBGPWRUPREQ | DP_CTRL_STAT_CSYSPWRUPREQ))
@@ -313,9 +1403,41 @@ int PowerOn(struct CSWDLoader* loader) {
         EndTransaction(loader);
         return 0;
     }
+    target->m_bPowered = 1;
     return 1;
 }
 
+// Select a DP on a multidrop bus, TARGETSEL has to follow a line reset and
+// be followed by a DPIDR read ([1] B4.3.4). Nothing is reported if no DP
+// answers.
+int ProbeTarget(struct CSWDLoader* loader, uint32_t nTargetSel,
+                uint32_t* pIDCode) {
+    LineReset(loader);
+    SelectTarget(loader, nTargetSel & ~(0xFU << DP_TARGETSEL_TINSTANCE__SHIFT),
+                 nTargetSel >> DP_TARGETSEL_TINSTANCE__SHIFT);
+    loader->m_nTransactions++;
+    SWD_STATS_REQUEST(RD_DP_DPIDR);
+    uint64_t nTraceStart = GPIO_TRACE_NOW();
+    WriteBits(loader, RD_DP_DPIDR, 7);
+    ReadBits(loader, 1 + TURN_CYCLES); // park bit (not driven) and turn cycle
+    uint32_t nResponse = ReadBits(loader, 3);
+    if (nResponse != DP_OK) {
+        GPIO_TRACE_REQUEST(nTraceStart, RD_DP_DPIDR, nResponse, 0);
+        ReadBits(loader, TURN_CYCLES);
+        WriteIdle(loader);
+        return 0;
+    }
+    uint32_t nIDCode = ReadBits(loader, 32);
+    uint32_t nParity = ReadBits(loader, 1);
+    int bParity = nParity == (uint32_t)__builtin_parity(nIDCode);
+    GPIO_TRACE_REQUEST(nTraceStart, RD_DP_DPIDR,
+                       bParity ? DP_OK : SWD_PARITY_ERROR, nIDCode);
+    ReadBits(loader, TURN_CYCLES);
+    WriteIdle(loader);
+    *pIDCode = nIDCode;
+    return bParity;
+}
+
 int WriteMem(struct CSWDLoader* loader, uint32_t nAddress, uint32_t nData) {
     return WriteData(loader, WR_AP_TAR, nAddress) &&
            WriteData(loader, WR_AP_DRW, nData);
@@ -327,46 +1449,124 @@ int ReadMem(struct CSWDLoader* loader, uint32_t nAddress, uint32_t* pData) {
            ReadData(loader, RD_DP_RDBUFF, pData);
 }
 
-int WriteData(struct CSWDLoader* loader, uint8_t nRequest, uint32_t nData) {
-    WriteBits(loader, nRequest, 7);
+// One request, counted and traced, the bits are clocked by the engine
+// \return ACK, SWD_PARITY_ERROR for corrupt read data
+static unsigned Request(struct CSWDLoader* loader, uint8_t nRequest,
+                        uint32_t* pData) {
+    loader->m_nTransactions++;
+    SWD_STATS_REQUEST(nRequest);
+    SWD_STATS_ADD(m_nBits, SWD_REQUEST_BITS);
     assert(nRequest & 0x80);
-    ReadBits(loader, 1 + TURN_CYCLES); // park bit (not driven) and turn cycle
-    uint32_t nResponse = ReadBits(loader, 3);
-    ReadBits(loader, TURN_CYCLES);
-    if (nResponse != DP_OK) {
-        EndTransaction(loader);
-        fprintf(stderr, "Cannot write (req 0x%02X, data 0x%X, resp %u)\n",
-                (unsigned)nRequest, nData, nResponse);
+    uint64_t nTraceStart = GPIO_TRACE_NOW();
+    uint32_t nData = *pData;
+    unsigned nResponse = SWDEngineRequest(loader, nRequest, &nData);
+    if (nResponse == SWD_PARITY_ERROR)
+        SWD_STATS_ADD(m_nParityErrors, 1);
+    else
+        SWD_STATS_RESPONSE(nResponse);
+    GPIO_TRACE_REQUEST(nTraceStart, nRequest, nResponse,
+                       nResponse == DP_OK || nResponse == SWD_PARITY_ERROR
+                           ? nData
+                           : 0);
+    if (nResponse == DP_OK)
+        *pData = nData;
+    return nResponse;
+}
+
+unsigned SWDTransfer(struct CSWDLoader* loader, uint8_t nRequest,
+                     uint32_t* pData) {
+    BeginTransaction(loader);
+    unsigned nResponse = Request(loader, nRequest, pData);
+    EndTransaction(loader);
+    return nResponse;
+}
+
+// Clear the sticky flags a failed request has left, after a FAULT or a
+// parity error also write SELECT, CSW and TAR again, so the request can be
+// repeated
+// \return 0 if there was no valid ACK, a new handshake is needed
+int Recover(struct CSWDLoader* loader, unsigned nResponse) {
+    struct TSWDRetries* retries = &loader->m_Retries[loader->m_Phase];
+    if (nResponse == DP_WAIT)
+        retries->m_nWaits++;
+    else if (nResponse == DP_FAULT)
+        retries->m_nFaults++;
+    else if (nResponse == SWD_PARITY_ERROR)
+        retries->m_nParity++;
+    else
+        return 0;
+    uint32_t nAbort = DP_ABORT_STKCMPCLR | DP_ABORT_STKERRCLR |
+                      DP_ABORT_WDERRCLR | DP_ABORT_ORUNERRCLR;
+    if (Request(loader, WR_DP_ABORT, &nAbort) != DP_OK)
         return 0;
+    if (nResponse == DP_WAIT || loader->m_nTarget >= loader->m_nTargets)
+        return 1;
+    struct TSWDTarget* target = &loader->m_Targets[loader->m_nTarget];
+    uint32_t nSelect = target->m_nSelect, nCSW = target->m_nCSW;
+    uint32_t nTAR = target->m_nTAR;
+    return Request(loader, WR_DP_SELECT, &nSelect) == DP_OK &&
+           (!nCSW || Request(loader, WR_AP_CSW, &nCSW) == DP_OK) &&
+           (!target->m_bTAR || Request(loader, WR_AP_TAR, &nTAR) == DP_OK);
+}
+
+// Follow TAR, including the auto-increment of DRW accesses (within 1 KB)
+static void TrackTAR(struct CSWDLoader* loader, uint8_t nRequest,
+                     uint32_t nData) {
+    if (loader->m_nTarget >= loader->m_nTargets)
+        return;
+    struct TSWDTarget* target = &loader->m_Targets[loader->m_nTarget];
+    if (nRequest == WR_AP_TAR) {
+        target->m_nTAR = nData;
+        target->m_bTAR = 1;
+    } else if (nRequest == WR_AP_DRW || nRequest == RD_AP_DRW)
+        target->m_nTAR =
+            (target->m_nTAR & ~0x3FFU) | ((target->m_nTAR + 4) & 0x3FFU);
+}
+
+int WriteData(struct CSWDLoader* loader, uint8_t nRequest, uint32_t nData) {
+    for (unsigned nTry = 0;; nTry++) {
+        uint32_t nWrite = nData;
+        unsigned nResponse = Request(loader, nRequest, &nWrite);
+        if (nResponse == DP_OK)
+            break;
+        unsigned nRetries =
+            nResponse == DP_WAIT ? SWD_WAIT_RETRIES : SWD_FAULT_RETRIES;
+        if (nTry == nRetries || !Recover(loader, nResponse)) {
+            EndTransaction(loader);
+            fprintf(stderr, "Cannot write (req 0x%02X, data 0x%X, resp %u)\n",
+                    (unsigned)nRequest, nData, nResponse);
+            return 0;
+        }
     }
-    WriteBits(loader, nData, 32);
-    WriteBits(loader, __builtin_parity(nData), 1);
+    TrackTAR(loader, nRequest, nData);
     return 1;
 }
 
 int ReadData(struct CSWDLoader* loader, uint8_t nRequest, uint32_t* pData) {
-    WriteBits(loader, nRequest, 7);
-    assert(nRequest & 0x80);
-    ReadBits(loader, 1 + TURN_CYCLES); // park bit (not driven) and turn cycle
-    uint32_t nResponse = ReadBits(loader, 3);
-    if (nResponse != DP_OK) {
-        ReadBits(loader, TURN_CYCLES);
-        EndTransaction(loader);
-        fprintf(stderr, "Cannot read (req 0x%02X, resp %u)\n",
-                (unsigned)nRequest, nResponse);
-        return 0;
-    }
-    uint32_t nData = ReadBits(loader, 32);
-    uint32_t nParity = ReadBits(loader, 1);
-    if (nParity != __builtin_parity(nData)) {
-        ReadBits(loader, TURN_CYCLES);
-        EndTransaction(loader);
-        fprintf(stderr, "Parity error (req 0x%02X)\n", (unsigned)nRequest);
-        return 0;
-    }
     assert(pData != 0);
-    *pData = nData;
-    ReadBits(loader, TURN_CYCLES);
+    for (unsigned nTry = 0;; nTry++) {
+        unsigned nResponse = Request(loader, nRequest, pData);
+        if (nResponse == DP_OK)
+            break;
+        // a DRW read has been made when its data arrives, it is repeated
+        // at the address it was made at
+        int bRepeatable = nResponse != SWD_PARITY_ERROR ||
+                          nRequest != RD_AP_DRW ||
+                          loader->m_Targets[loader->m_nTarget].m_bTAR;
+        unsigned nRetries =
+            nResponse == DP_WAIT ? SWD_WAIT_RETRIES : SWD_FAULT_RETRIES;
+        if (!bRepeatable || nTry == nRetries || !Recover(loader, nResponse)) {
+            EndTransaction(loader);
+            if (nResponse == SWD_PARITY_ERROR)
+                fprintf(stderr, "Parity error (req 0x%02X)\n",
+                        (unsigned)nRequest);
+            else
+                fprintf(stderr, "Cannot read (req 0x%02X, resp %u)\n",
+                        (unsigned)nRequest, nResponse);
+            return 0;
+        }
+    }
+    TrackTAR(loader, nRequest, 0);
     return 1;
 }
 
@@ -374,6 +1574,9 @@ void SelectTarget(struct CSWDLoader* loader, uint32_t nCPUAPID,
                   uint8_t uchInstanceID) {
     uint32_t nWData =
         nCPUAPID | ((uint32_t)uchInstanceID << DP_TARGETSEL_TINSTANCE__SHIFT);
+    SWD_STATS_REQUEST(WR_DP_TARGETSEL);
+    GPIO_TRACE_REQUEST(GPIO_TRACE_NOW(), WR_DP_TARGETSEL, GPIO_TRACE_NO_ACK,
+                       nWData);
     WriteBits(loader, WR_DP_TARGETSEL, 7);
     ReadBits(loader, 1 + 5); // park bit and 5 bits not driven
     WriteBits(loader, nWData, 32);
@@ -401,6 +1604,7 @@ void LineReset(struct CSWDLoader* loader) {
 }
 
 void WriteIdle(struct CSWDLoader* loader) {
+    TimingGap(&loader->m_Timing);
     WriteBits(loader, 0, 8);
     WritePin(&loader->m_ClockPin, LOW);
     SetModePin(&loader->m_DataPin, GPIOModeOutput, 0);
@@ -408,30 +1612,11 @@ void WriteIdle(struct CSWDLoader* loader) {
 }
 
 void WriteBits(struct CSWDLoader* loader, uint32_t nBits, unsigned nBitCount) {
-    SetModePin(&loader->m_DataPin, GPIOModeOutput, 0);
-    while (nBitCount--) {
-        WritePin(&loader->m_DataPin, nBits & 1);
-        WriteClock(loader);
-        nBits >>= 1;
-    }
+    SWD_STATS_ADD(m_nBits, nBitCount);
+    SWDEngineWriteBits(loader, nBits, nBitCount);
 }
 
 uint32_t ReadBits(struct CSWDLoader* loader, unsigned nBitCount) {
-    SetModePin(&loader->m_DataPin, GPIOModeInputPullUp, 0);
-    uint32_t nBits = 0;
-    unsigned nRemaining = nBitCount--;
-    while (nRemaining--) {
-        unsigned nLevel = ReadPin(&loader->m_DataPin);
-        WriteClock(loader);
-        nBits >>= 1;
-        nBits |= nLevel << nBitCount;
-    }
-    return nBits;
-}
-
-void WriteClock(struct CSWDLoader* loader) {
-    WritePin(&loader->m_ClockPin, LOW);
-    delay_nanos(loader->m_nDelayNanos);
-    WritePin(&loader->m_ClockPin, HIGH);
-    delay_nanos(loader->m_nDelayNanos);
+    SWD_STATS_ADD(m_nBits, nBitCount);
+    return SWDEngineReadBits(loader, nBitCount);
 }
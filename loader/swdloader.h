@@ -25,10 +25,76 @@ extern "C" {
 #include <stdint.h>
 
 #include "gpiopin.h"
+#include "gpiospi.h"
+#include "swdimage.h"
+#include "swdtiming.h"
+
+// How SWDLoadChunk() checks what it has written
+enum TSWDVerify {
+    SWDVerifyNone,
+    SWDVerifyFirstWord, // first word of each block
+    SWDVerifySampled,   // a few words spread over each block
+    SWDVerifyReadback,  // every word, roughly doubles the load time
+    SWDVerifyCRC        // CRC32 of the chunk computed by the target DMA
+};
+
+// Whether SWDLoad() uploads the image compressed, together with a stub
+// unpacking it on the target
+enum TSWDCompress {
+    SWDCompressAuto, // when the estimated load time is lower
+    SWDCompressOff,
+    SWDCompressOn // whenever stub and compressed image fit next to the image
+};
+
+// Maximum number of DPs on one multidrop bus, one per TINSTANCE value
+#define SWD_MAX_TARGETS 16
+
+#define SWD_PARITY_ERROR 8 // response beyond the 3 ACK bits
+
+// Connection state of one DP, kept while other DPs on the bus are selected
+struct TSWDTarget {
+    uint32_t m_nTargetSel; // TARGETID and TINSTANCE
+    uint32_t m_nSelect;    // last DP SELECT written
+    uint32_t m_nCSW;       // last MEM-AP CSW written, 0 if none
+    uint32_t m_nTAR;       // MEM-AP TAR, including auto-increments
+    int m_bTAR;            // m_nTAR known (not after a wave)
+    int m_bPowered;        // debug and system power-up acknowledged
+};
+
+// Parts of a session, failed requests are counted per phase
+enum TSWDPhase {
+    SWDPhaseConnect,
+    SWDPhaseHalt,
+    SWDPhaseLoad,
+    SWDPhaseVerify,
+    SWDPhaseStart,
+    SWDPhaseOther, // once started: RTT, dumps, daemon reads
+    SWDPhases
+};
+
+// Failed requests that have been recovered from
+struct TSWDRetries {
+    uint64_t m_nWaits;   // WAIT, request repeated
+    uint64_t m_nFaults;  // FAULT or sticky error, cleared and state restored
+    uint64_t m_nParity;  // read data parity error, read repeated
+    uint64_t m_nResumes; // load resumed at the first unverified block
+};
 
 struct CSWDLoader {
     unsigned m_bResetAvailable;
-    unsigned m_nDelayNanos;
+    unsigned m_nBlockSize; // bytes per TAR setup, must divide 1 KB
+    int m_bStreamWrites;   // skip DRW ACKs, check CTRL/STAT once per block
+    enum TSWDVerify m_Verify;
+    enum TSWDCompress m_Compress;
+    int m_bDelta; // only load the 1 KB blocks that differ in target RAM
+    uint64_t m_nTransactions;
+    struct TSWDTarget m_Targets[SWD_MAX_TARGETS];
+    unsigned m_nTargets;
+    unsigned m_nTarget; // selected, index into m_Targets
+    enum TSWDPhase m_Phase;
+    struct TSWDRetries m_Retries[SWDPhases];
+    struct CSWDTiming m_Timing;
+    struct CGPIOSPI* m_pSPI; // compiled waves are shifted through SPI if set
     struct CGPIOPin m_ResetPin;
     struct CGPIOPin m_ClockPin;
     struct CGPIOPin m_DataPin;
@@ -39,13 +105,50 @@ struct CSWDLoader {
 /// \param nResetPin Optional GPIO pin to which RESET (RUN) is connected
 /// (active LOW) \param nClockRateKHz Requested interface clock rate in KHz
 /// \note GPIO pin numbers are SoC number, not header positions.
-/// \note The actual clock rate may be smaller than the requested.
+/// \note The actual clock rate may be smaller than the requested, see
+/// TimingReport()
 int SWDInitialise(struct CSWDLoader* loader, unsigned nClockPin,
                   unsigned nDataPin, unsigned nResetPin,
                   unsigned nClockRateKHz);
 
 void SWDDeInitialise(struct CSWDLoader* loader);
 
+/// \brief Change the SWCLK rate of an initialised loader
+/// \param nClockRateKHz Requested interface clock rate in KHz
+void SWDSetClock(struct CSWDLoader* loader, unsigned nClockRateKHz);
+
+/// \brief Read DPIDR and CTRL/STAT of the selected DP
+/// \return Both read cleanly, the ID matches and no sticky error is set?
+int SWDCheckLink(struct CSWDLoader* loader);
+
+/// \brief Check the selected DP with SWDCheckLink() and go through the
+/// connect handshake again if that fails, as after a target power cycle or
+/// a failed access
+/// \return Operation successful?
+int SWDCheckConnection(struct CSWDLoader* loader);
+
+/// \brief Find the DPs answering TARGETSEL on a multidrop bus
+/// \param nTargetID TARGETID (TARGETSEL without TINSTANCE) to probe
+/// \return Number of DPs found, their state is in m_Targets
+/// \note The rescue DP is not probed. The first DP found is selected.
+unsigned SWDScan(struct CSWDLoader* loader, uint32_t nTargetID);
+
+/// \brief Make m_Targets[nTarget] the target of the following operations
+/// \note Switching takes a line reset, TARGETSEL and a DPIDR read, power-up
+/// and CSW are only written the first time a DP is used
+/// \return Operation successful?
+int SWDSelectTarget(struct CSWDLoader* loader, unsigned nTarget);
+
+/// \return Lower case name of a phase
+const char* SWDPhaseName(enum TSWDPhase Phase);
+
+/// \return Lower case name of a verify policy, as -v and manifests take it
+const char* SWDVerifyName(enum TSWDVerify Verify);
+
+/// \brief Print the retries of each phase since SWDInitialise(), to spot
+/// flaky connections
+void SWDReportRetries(const struct CSWDLoader* loader, FILE* pFile);
+
 /// \brief Halt the RP2040, load a program image and start it
 /// \param pProgram Pointer to program image in memory
 /// \param nProgSize Size of the program image (must be a multiple of 4)
@@ -53,6 +156,21 @@ void SWDDeInitialise(struct CSWDLoader* loader);
 int SWDLoad(struct CSWDLoader* loader, const void* pProgram, size_t nProgSize,
             uint32_t nAddress);
 
+/// \brief Halt the RP2040, load the segments of a program image and start it
+/// at its entry point
+/// \note Runs of zero words are cleared by the target DMA, not sent.
+/// Segments with a verify policy of their own (manifest entries) are
+/// checked according to it instead of m_Verify.
+int SWDLoadImage(struct CSWDLoader* loader, const struct CSWDImage* image);
+
+/// \brief Halt the RP2040, program the segments of an image into flash
+/// through the bootrom functions and reset the chip to boot from flash
+/// \note Only the 4 KB sectors holding image data are written, bytes of
+/// these not in the image are erased (0xFF). Sectors whose flash contents
+/// match (target CRC32) are skipped. SRAM is overwritten.
+/// \return Operation successful?
+int SWDFlash(struct CSWDLoader* loader, const struct CSWDImage* image);
+
 /// \brief Halt the RP2040
 /// \return Operation successful?
 int SWDHalt(struct CSWDLoader* loader);
@@ -65,6 +183,28 @@ int SWDHalt(struct CSWDLoader* loader);
 int SWDLoadChunk(struct CSWDLoader* loader, const void* pChunk,
                  size_t nChunkSize, uint32_t nAddress);
 
+/// \brief Read target memory with posted DRW reads, each returning the
+/// previous word, TAR is set once per 1 KB
+/// \param nAddress Word aligned address
+/// \param nSize Number of bytes (must be a multiple of 4)
+/// \note The core keeps running unless it has been halted
+/// \return Operation successful?
+int SWDReadBlock(struct CSWDLoader* loader, uint32_t nAddress, void* pBuffer,
+                 size_t nSize);
+
+/// \brief Write one word of target memory, the core keeps running
+/// \param nAddress Word aligned address
+/// \return Operation successful?
+int SWDWriteWord(struct CSWDLoader* loader, uint32_t nAddress,
+                 uint32_t nData);
+
+/// \brief One raw DP/AP request with its data phase, without retries or
+/// recovery, e.g. to replay a transaction log
+/// \param pData Data written, receives the data read
+/// \return ACK, SWD_PARITY_ERROR for corrupt read data
+unsigned SWDTransfer(struct CSWDLoader* loader, uint8_t nRequest,
+                     uint32_t* pData);
+
 /// \brief Start program image
 /// \param nAddress Start address of the program image
 /// \return Operation successful?
@@ -0,0 +1,111 @@
+//
+// swdlz.c
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "swdlz.h"
+
+#define HASH_BITS 15
+#define HASH_SIZE (1U << HASH_BITS)
+#define CHAIN_DEPTH 32 // candidates tried per position
+#define NO_POS (~0U)
+
+static unsigned Hash(const uint8_t* p) {
+    uint32_t n = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (n * 2654435761U) >> (32 - HASH_BITS);
+}
+
+// Worst case a single literal and a 3 byte match alternate, 5 bytes out
+// for 4 in, and a last literal run has its token
+size_t LZBound(size_t nSize) {
+    return nSize + (nSize + 3) / 4 + 1;
+}
+
+// Flush pending literals as runs of up to LZ_MAX_LITERALS bytes
+static uint8_t* Literals(uint8_t* pOut, const uint8_t* pFrom, size_t nCount) {
+    while (nCount) {
+        size_t nRun = nCount < LZ_MAX_LITERALS ? nCount : LZ_MAX_LITERALS;
+        *pOut++ = nRun - 1;
+        memcpy(pOut, pFrom, nRun);
+        pOut += nRun;
+        pFrom += nRun;
+        nCount -= nRun;
+    }
+    return pOut;
+}
+
+size_t LZCompress(const void* pIn, size_t nSize, void* pOut) {
+    const uint8_t* pSrc = (const uint8_t*)pIn;
+    uint8_t* pDst = (uint8_t*)pOut;
+    unsigned* pHead = malloc(HASH_SIZE * sizeof(unsigned));
+    unsigned* pPrev = malloc((nSize ? nSize : 1) * sizeof(unsigned));
+    if (!pHead || !pPrev) {
+        free(pHead);
+        free(pPrev);
+        return Literals(pDst, pSrc, nSize) - (uint8_t*)pOut;
+    }
+    memset(pHead, 0xFF, HASH_SIZE * sizeof(unsigned));
+    size_t nLiteral = 0, i = 0;
+    while (i < nSize) {
+        size_t nBest = 0, nBestDistance = 0;
+        if (i + LZ_MIN_MATCH <= nSize) {
+            unsigned nHash = Hash(pSrc + i);
+            size_t nMax = nSize - i < LZ_MAX_MATCH ? nSize - i : LZ_MAX_MATCH;
+            unsigned nCandidate = pHead[nHash];
+            for (unsigned nDepth = 0; nCandidate != NO_POS &&
+                                      i - nCandidate <= LZ_MAX_DISTANCE &&
+                                      nDepth < CHAIN_DEPTH;
+                 nDepth++, nCandidate = pPrev[nCandidate]) {
+                size_t nLength = 0;
+                while (nLength < nMax &&
+                       pSrc[nCandidate + nLength] == pSrc[i + nLength])
+                    nLength++;
+                if (nLength > nBest) {
+                    nBest = nLength;
+                    nBestDistance = i - nCandidate;
+                    if (nLength == nMax)
+                        break;
+                }
+            }
+            pPrev[i] = pHead[nHash];
+            pHead[nHash] = i;
+        }
+        if (nBest < LZ_MIN_MATCH) {
+            nLiteral++;
+            i++;
+            continue;
+        }
+        pDst = Literals(pDst, pSrc + i - nLiteral, nLiteral);
+        nLiteral = 0;
+        *pDst++ = 0x80 + nBest - LZ_MIN_MATCH;
+        *pDst++ = nBestDistance & 0xFF;
+        *pDst++ = nBestDistance >> 8;
+        // index the positions covered by the match
+        for (size_t j = i + 1; j < i + nBest && j + LZ_MIN_MATCH <= nSize;
+             j++) {
+            unsigned nHash = Hash(pSrc + j);
+            pPrev[j] = pHead[nHash];
+            pHead[nHash] = j;
+        }
+        i += nBest;
+    }
+    pDst = Literals(pDst, pSrc + nSize - nLiteral, nLiteral);
+    free(pHead);
+    free(pPrev);
+    return pDst - (uint8_t*)pOut;
+}
@@ -0,0 +1,51 @@
+//
+// swdlz.h
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _pico_swdlz_h
+#define _pico_swdlz_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Byte oriented LZ77 format, simple enough for a 60 byte Thumb decoder:
+//
+//   token 0x00-0x7F  literal run, token + 1 bytes follow
+//   token 0x80-0xFF  match of token - 0x7D bytes (3..130), followed by the
+//                    distance back from the output position (1..65535, LE)
+//
+// There is no end marker, the decoder stops at the expected output size.
+
+#define LZ_MAX_LITERALS 128
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH 130
+#define LZ_MAX_DISTANCE 65535
+
+/// \return Worst case compressed size of nSize bytes
+size_t LZBound(size_t nSize);
+
+/// \param pOut Buffer of at least LZBound(nSize) bytes
+/// \return Compressed size
+size_t LZCompress(const void* pIn, size_t nSize, void* pOut);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
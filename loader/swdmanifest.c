@@ -0,0 +1,131 @@
+//
+// swdmanifest.c
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "swdloader.h"
+#include "swdmanifest.h"
+
+#define MANIFEST_SEPARATORS " \t\r\n"
+
+static int s_bReading; // manifests don't nest
+
+static int ParseAddress(const char* pToken, uint32_t* pnAddress) {
+    char* pEnd;
+    errno = 0;
+    unsigned long nValue = strtoul(pToken, &pEnd, 0);
+    if (errno || *pEnd || pEnd == pToken || nValue > UINT32_MAX)
+        return 0;
+    *pnAddress = nValue;
+    return 1;
+}
+
+// \return enum TSWDVerify, -1 if pToken is no policy name
+static int ParseVerify(const char* pToken) {
+    for (int nVerify = SWDVerifyNone; nVerify <= SWDVerifyCRC; nVerify++)
+        if (!strcmp(pToken, SWDVerifyName(nVerify)))
+            return nVerify;
+    return -1;
+}
+
+// file [address|-] [verify], merged into image
+static int ReadEntry(struct CSWDImage* image, const char* pManifest,
+                     char* pFile, char** ppSave, uint32_t nBinAddress,
+                     uint32_t* pnEntry) {
+    int nVerify = SWD_VERIFY_LOADER;
+    const char* pToken = strtok_r(0, MANIFEST_SEPARATORS, ppSave);
+    if (pToken && (nVerify = ParseVerify(pToken)) < 0) {
+        nVerify = SWD_VERIFY_LOADER;
+        if (strcmp(pToken, "-") && !ParseAddress(pToken, &nBinAddress))
+            return 0;
+        pToken = strtok_r(0, MANIFEST_SEPARATORS, ppSave);
+        if (pToken && (nVerify = ParseVerify(pToken)) < 0)
+            return 0;
+    }
+    if (pToken && strtok_r(0, MANIFEST_SEPARATORS, ppSave))
+        return 0;
+    char Path[SWD_MANIFEST_MAX_LINE * 2];
+    const char* pSlash = strrchr(pManifest, '/');
+    if (*pFile == '/' || !pSlash)
+        snprintf(Path, sizeof(Path), "%s", pFile);
+    else
+        snprintf(Path, sizeof(Path), "%.*s/%s", (int)(pSlash - pManifest),
+                 pManifest, pFile);
+    struct CSWDImage entry;
+    if (!SWDImageRead(&entry, Path, nBinAddress))
+        return 0;
+    // the first file is the program, the others its data
+    if (!image->m_nSegments)
+        *pnEntry = entry.m_nEntry;
+    return SWDImageMerge(image, &entry, nVerify);
+}
+
+int SWDManifestRead(struct CSWDImage* image, const char* pFileName,
+                    uint32_t nBinAddress) {
+    memset(image, 0, sizeof(*image));
+    if (s_bReading) {
+        fprintf(stderr, "%s: manifests don't nest\n", pFileName);
+        return 0;
+    }
+    FILE* pFile = fopen(pFileName, "r");
+    if (!pFile) {
+        fprintf(stderr, "Can't open %s\n", pFileName);
+        return 0;
+    }
+    s_bReading = 1;
+    char Line[SWD_MANIFEST_MAX_LINE];
+    unsigned nLine = 0;
+    uint32_t nEntry = 0, nFileEntry = 0;
+    int bEntry = 0, bOK = 1;
+    while (bOK && fgets(Line, sizeof(Line), pFile)) {
+        nLine++;
+        if (!strchr(Line, '\n') && !feof(pFile)) {
+            fprintf(stderr, "%s:%u: line too long\n", pFileName, nLine);
+            bOK = 0;
+            break;
+        }
+        char* pSave;
+        char* pToken = strtok_r(Line, MANIFEST_SEPARATORS, &pSave);
+        if (!pToken || *pToken == '#')
+            continue;
+        if (!strcmp(pToken, "entry")) {
+            pToken = strtok_r(0, MANIFEST_SEPARATORS, &pSave);
+            bOK = pToken && ParseAddress(pToken, &nEntry) &&
+                  !strtok_r(0, MANIFEST_SEPARATORS, &pSave);
+            bEntry = 1;
+        } else
+            bOK = ReadEntry(image, pFileName, pToken, &pSave, nBinAddress,
+                            &nFileEntry);
+        if (!bOK)
+            fprintf(stderr, "%s:%u: bad entry\n", pFileName, nLine);
+    }
+    fclose(pFile);
+    s_bReading = 0;
+    if (bOK && !image->m_nSegments) {
+        fprintf(stderr, "%s lists nothing to load\n", pFileName);
+        bOK = 0;
+    }
+    if (!bOK) {
+        SWDImageFree(image);
+        return 0;
+    }
+    image->m_nEntry = bEntry ? nEntry : nFileEntry;
+    return 1;
+}
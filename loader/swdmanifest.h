@@ -0,0 +1,50 @@
+//
+// swdmanifest.h
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _pico_swdmanifest_h
+#define _pico_swdmanifest_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "swdimage.h"
+
+#define SWD_MANIFEST_MAGIC "#swdmanifest" // first line of a manifest
+#define SWD_MANIFEST_MAX_LINE 1024
+
+/// \brief Read the images listed in a manifest into one image, to be loaded
+/// in a single session. Lines after the magic one:
+///
+///     file [address|-] [verify]   image (ELF, UF2 or flat binary), the
+///                                 address is that of a flat binary
+///     entry address               start address, default the first file's
+///     # comment
+///
+/// Files are relative to the manifest's directory, verify is a policy name
+/// as -v takes it (default the loader's).
+/// \param nBinAddress Address of flat binaries listed without one
+/// \return Operation successful? Errors are reported to stderr.
+int SWDManifestRead(struct CSWDImage* image, const char* pFileName,
+                    uint32_t nBinAddress);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,138 @@
+//
+// swdrealtime.c
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "swdrealtime.h"
+
+#define ISOLATED_CPUS "/sys/devices/system/cpu/isolated"
+
+// \return Highest CPU in the isolated list ("1,3-5"), -1 if none
+static int IsolatedCPU(void) {
+    FILE* pFile = fopen(ISOLATED_CPUS, "r");
+    if (!pFile)
+        return -1;
+    char List[256];
+    int nCPU = -1;
+    if (fgets(List, sizeof(List), pFile)) {
+        // the list is ascending, its last number is the highest CPU
+        for (char* p = List; *p;) {
+            if (*p >= '0' && *p <= '9')
+                nCPU = strtol(p, &p, 10);
+            else
+                p++;
+        }
+    }
+    fclose(pFile);
+    return nCPU;
+}
+
+static int PickCPU(const cpu_set_t* pAllowed) {
+    int nCPU = IsolatedCPU();
+    if (nCPU >= 0)
+        return nCPU;
+    for (nCPU = CPU_SETSIZE - 1; nCPU >= 0; nCPU--)
+        if (CPU_ISSET(nCPU, pAllowed))
+            return nCPU;
+    return -1;
+}
+
+// Grow the stack now, the pages stay locked
+static void PrefaultStack(void) {
+    volatile unsigned char Stack[REALTIME_STACK_SIZE];
+    for (size_t i = 0; i < sizeof(Stack); i += 4096)
+        Stack[i] = 0;
+}
+
+int RealtimeEnter(struct CSWDRealtime* rt, int nCPU) {
+    memset(rt, 0, sizeof(*rt));
+    rt->m_nCPU = -1;
+    pthread_t self = pthread_self();
+    int bOK = 1, nError;
+    cpu_set_t* pAffinity = malloc(sizeof(cpu_set_t));
+    if (pAffinity &&
+        pthread_getaffinity_np(self, sizeof(*pAffinity), pAffinity) == 0) {
+        rt->m_pAffinity = pAffinity;
+        if (nCPU < 0)
+            nCPU = PickCPU(pAffinity);
+        cpu_set_t cpu;
+        CPU_ZERO(&cpu);
+        nError = EINVAL;
+        if (nCPU >= 0 && nCPU < CPU_SETSIZE) {
+            CPU_SET(nCPU, &cpu);
+            nError = pthread_setaffinity_np(self, sizeof(cpu), &cpu);
+        }
+        if (nError) {
+            fprintf(stderr, "Cannot run on CPU %d (%s)\n", nCPU,
+                    strerror(nError));
+            bOK = 0;
+        } else
+            rt->m_nCPU = nCPU;
+    } else {
+        free(pAffinity);
+        bOK = 0;
+    }
+    struct sched_param param = {.sched_priority = REALTIME_PRIORITY};
+    pthread_getschedparam(self, &rt->m_nPolicy, &rt->m_Param);
+    nError = pthread_setschedparam(self, SCHED_FIFO, &param);
+    if (nError) {
+        fprintf(stderr, "Cannot use SCHED_FIFO (%s)\n", strerror(nError));
+        bOK = 0;
+    } else
+        rt->m_bScheduled = 1;
+    // faults in everything mapped now, later mappings as they are made
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        fprintf(stderr, "Cannot lock memory (%s)\n", strerror(errno));
+        bOK = 0;
+    } else {
+        rt->m_bLocked = 1;
+        PrefaultStack();
+    }
+    printf("Real-time mode: CPU %d, %s, memory %slocked\n", rt->m_nCPU,
+           rt->m_bScheduled ? "SCHED_FIFO" : "normal priority",
+           rt->m_bLocked ? "" : "not ");
+    return bOK;
+}
+
+void RealtimeLeave(struct CSWDRealtime* rt) {
+    pthread_t self = pthread_self();
+    if (rt->m_bLocked)
+        munlockall();
+    if (rt->m_bScheduled)
+        pthread_setschedparam(self, rt->m_nPolicy, &rt->m_Param);
+    if (rt->m_pAffinity)
+        pthread_setaffinity_np(self, sizeof(cpu_set_t), rt->m_pAffinity);
+    free(rt->m_pAffinity);
+    memset(rt, 0, sizeof(*rt));
+    rt->m_nCPU = -1;
+}
+
+void RealtimePrefault(const void* pData, size_t nSize) {
+    const volatile unsigned char* p = pData;
+    long nPage = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < nSize; i += nPage)
+        (void)p[i];
+    if (nSize)
+        (void)p[nSize - 1];
+}
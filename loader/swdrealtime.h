@@ -0,0 +1,58 @@
+//
+// swdrealtime.h
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _pico_swdrealtime_h
+#define _pico_swdrealtime_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <sched.h>
+#include <stddef.h>
+
+#define REALTIME_PRIORITY 49 // SCHED_FIFO, below threaded IRQs (50)
+#define REALTIME_STACK_SIZE 0x40000 // pre-faulted
+
+// Scheduling state of the calling thread, saved to be restored
+struct CSWDRealtime {
+    int m_nCPU; // -1 if not pinned
+    int m_bScheduled;
+    int m_bLocked;
+    int m_nPolicy;
+    struct sched_param m_Param;
+    void* m_pAffinity; // cpu_set_t
+};
+
+/// \brief Pin the calling thread to one CPU, run it SCHED_FIFO and lock
+/// all current and future memory. Other threads keep their settings.
+/// \param nCPU CPU to use, -1 picks the last isolated CPU (isolcpus=) or
+/// else the last CPU the thread may run on
+/// \return Every step successful? A step that fails (usually missing
+/// CAP_SYS_NICE or RLIMIT_MEMLOCK) is reported and the others still apply.
+int RealtimeEnter(struct CSWDRealtime* rt, int nCPU);
+
+/// \brief Restore the scheduling state saved by RealtimeEnter()
+void RealtimeLeave(struct CSWDRealtime* rt);
+
+/// \brief Touch every page of a buffer, so it is resident before the load
+void RealtimePrefault(const void* pData, size_t nSize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
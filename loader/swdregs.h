@@ -0,0 +1,162 @@
+//
+// swdregs.h
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _pico_swdregs_h
+#define _pico_swdregs_h
+
+// References:
+//
+// [1] ARM Debug Interface Architecture Specification ADIv5.0 to ADIv5.2, IHI
+// 0031E [2] ARM v6-M Architecture Reference Manual, DDI 0419E
+// Debug Port v2
+
+#define TURN_CYCLES 1
+
+#define BIT(x) (1 << (x))
+
+#define XIP_CNTL 0x14000000
+#define USB_CNTL 0x50110040
+
+// SWD-DP Requests
+#define WR_DP_ABORT 0x81
+#define DP_ABORT_STKCMPCLR BIT(1)
+#define DP_ABORT_STKERRCLR BIT(2)
+#define DP_ABORT_WDERRCLR BIT(3)
+#define DP_ABORT_ORUNERRCLR BIT(4)
+#define RD_DP_CTRL_STAT 0x8D
+#define WR_DP_CTRL_STAT 0xA9
+#define DP_CTRL_STAT_ORUNDETECT BIT(0)
+#define DP_CTRL_STAT_STICKYORUN BIT(1)
+#define DP_CTRL_STAT_STICKYERR BIT(5)
+#define DP_CTRL_STAT_WDATAERR BIT(7)
+#define DP_CTRL_STAT_CDBGPWRUPREQ BIT(28)
+#define DP_CTRL_STAT_CDBGPWRUPACK BIT(29)
+#define DP_CTRL_STAT_CSYSPWRUPREQ BIT(30)
+#define DP_CTRL_STAT_CSYSPWRUPACK BIT(31)
+#define RD_DP_DPIDR 0xA5
+#define DP_DPIDR_SUPPORTED 0x0BC12477
+#define RD_DP_RDBUFF 0xBD
+#define WR_DP_SELECT 0xB1
+#define DP_SELECT_DPBANKSEL__SHIFT 0
+#define DP_SELECT_APBANKSEL__SHIFT 4
+#define DP_SELECT_APSEL__SHIFT 24
+#define DP_SELECT_DEFAULT 0 // DP bank 0, AP 0, AP bank 0
+#define WR_DP_TARGETSEL 0x99
+#define DP_TARGETSEL_CPUAPID_SUPPORTED 0x01002927
+#define DP_TARGETSEL_TINSTANCE__SHIFT 28
+#define DP_TARGETSEL_TINSTANCE_CORE0 0
+#define DP_TARGETSEL_TINSTANCE_CORE1 1
+#define DP_TARGETSEL_TINSTANCE_RESCUE 0xF // resets the chip when powered
+#define DP_TARGETSEL_TINSTANCE_COUNT 16
+
+// SW-DP response
+#define DP_OK 0b001
+#define DP_WAIT 0b010
+#define DP_FAULT 0b100
+
+// SWD MEM-AP Requests
+#define WR_AP_CSW 0xA3
+#define AP_CSW_SIZE__SHIFT 0
+#define AP_CSW_SIZE_32BITS 2
+#define AP_CSW_ADDR_INC__SHIFT 4
+#define AP_CSW_SIZE_INCREMENT_SINGLE 1
+#define AP_CSW_DEVICE_EN BIT(6)
+#define AP_CSW_PROT__SHIFT 24
+#define AP_CSW_PROT_DEFAULT 0x22
+#define AP_CSW_DBG_SW_ENABLE BIT(31)
+#define RD_AP_DRW 0x9F
+#define WR_AP_DRW 0xBB
+#define WR_AP_TAR 0x8B
+
+// ARMv6-M Debug System Registers
+#define DHCSR 0xE000EDF0
+#define DHCSR_C_DEBUGEN BIT(0)
+#define DHCSR_C_HALT BIT(1)
+#define DHCSR_C_MASKINTS BIT(3)
+#define DHCSR_S_HALT BIT(17)
+#define DHCSR_DBGKEY__SHIFT 16
+#define DHCSR_DBGKEY_KEY 0xA05F
+#define DCRSR 0xE000EDF4
+#define DCRSR_REGSEL__SHIFT 0
+#define DCRSR_REGSEL_R13 13 // SP register
+#define DCRSR_REGSEL_R14 14 // LR register
+#define DCRSR_REGSEL_R15 15 // PC register
+#define DCRSR_REGSEL_XPSR 16
+#define DCRSR_REGW_N_R BIT(16)
+#define DCRDR 0xE000EDF8
+#define XPSR_T BIT(24) // Thumb state
+#define AIRCR 0xE000ED0C
+#define AIRCR_SYSRESETREQ BIT(2)
+#define AIRCR_VECTKEY__SHIFT 16
+#define AIRCR_VECTKEY_KEY 0x05FA
+
+// RP2040 bootrom, the function table entries are a code and a pointer
+// (halfwords each), the table ends with a zero code
+#define ROM_TABLE_POINTERS 0x14 // function table, data table (halfwords)
+#define ROM_TABLE_MAX_ENTRIES 64
+#define ROM_CODE(c1, c2) ((c1) | (c2) << 8)
+#define ROM_FUNC_CONNECT_INTERNAL_FLASH ROM_CODE('I', 'F')
+#define ROM_FUNC_FLASH_EXIT_XIP ROM_CODE('E', 'X')
+#define ROM_FUNC_FLASH_RANGE_ERASE ROM_CODE('R', 'E')
+#define ROM_FUNC_FLASH_RANGE_PROGRAM ROM_CODE('R', 'P')
+#define ROM_FUNC_FLASH_FLUSH_CACHE ROM_CODE('F', 'C')
+#define ROM_FUNC_FLASH_ENTER_CMD_XIP ROM_CODE('C', 'X')
+
+// RP2040 external flash, seen through the XIP window
+#define XIP_BASE 0x10000000
+#define XIP_NOCACHE_NOALLOC_BASE 0x13000000
+#define FLASH_MAX_SIZE (16 * 1024 * 1024)
+#define FLASH_SECTOR_SIZE 4096 // erase unit
+#define FLASH_SECTOR_ERASE_CMD 0x20
+
+// RP2040 SRAM, SRAM4/5 above the striped banks hold the bootrom stacks
+#define SRAM_BASE 0x20000000
+#define SRAM_STRIPED_END 0x20040000
+#define SRAM_END 0x20042000
+
+// RP2040 peripherals, the DMA computes the verification CRC
+#define REG_ALIAS_SET_BITS 0x2000
+#define REG_ALIAS_CLR_BITS 0x3000
+#define RESETS_RESET 0x4000C000
+#define RESETS_RESET_DONE 0x4000C008
+#define RESETS_DMA BIT(2)
+#define DMA_BASE 0x50000000
+#define DMA_CH 0 // channel used by the loader
+#define DMA_CH_READ_ADDR (DMA_BASE + DMA_CH * 0x40 + 0x00)
+#define DMA_CH_WRITE_ADDR (DMA_BASE + DMA_CH * 0x40 + 0x04)
+#define DMA_CH_TRANS_COUNT (DMA_BASE + DMA_CH * 0x40 + 0x08)
+#define DMA_CH_CTRL_TRIG (DMA_BASE + DMA_CH * 0x40 + 0x0C)
+#define DMA_CTRL_EN BIT(0)
+#define DMA_CTRL_DATA_SIZE__SHIFT 2
+#define DMA_CTRL_DATA_SIZE_WORD 2
+#define DMA_CTRL_INCR_READ BIT(4)
+#define DMA_CTRL_INCR_WRITE BIT(5)
+#define DMA_CTRL_CHAIN_TO__SHIFT 11
+#define DMA_CTRL_TREQ_SEL__SHIFT 15
+#define DMA_CTRL_TREQ_SEL_PERMANENT 0x3F
+#define DMA_CTRL_SNIFF_EN BIT(23)
+#define DMA_CTRL_BUSY BIT(24)
+#define DMA_CTRL_AHB_ERROR BIT(31)
+#define DMA_SNIFF_CTRL (DMA_BASE + 0x434)
+#define DMA_SNIFF_CTRL_EN BIT(0)
+#define DMA_SNIFF_CTRL_DMACH__SHIFT 1
+#define DMA_SNIFF_CTRL_CALC__SHIFT 5
+#define DMA_SNIFF_CTRL_CALC_CRC32R 1 // CRC32 of bit reversed data
+#define DMA_SNIFF_CTRL_OUT_REV BIT(10)
+#define DMA_SNIFF_CTRL_OUT_INV BIT(11)
+#define DMA_SNIFF_DATA (DMA_BASE + 0x438)
+
+#endif
@@ -0,0 +1,173 @@
+//
+// swdrtt.c
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "swdrtt.h"
+#include "swdregs.h"
+
+// Control block: 16 byte ID, up and down buffer counts, the up buffer
+// descriptors, then the down buffer descriptors
+#define RTT_ID "SEGGER RTT"
+#define RTT_ID_SIZE 16
+#define RTT_MAX_BUFFERS 16 // sanity limit for the counts
+#define RTT_UP_BUFFERS (RTT_ID_SIZE + 8)
+#define RTT_SEARCH_CHUNK 0x4000
+#define RTT_RETRY_NANOS 100000000U
+
+// Buffer descriptor
+enum TRTTBuffer {
+    RTTName,
+    RTTBuffer,
+    RTTSize,
+    RTTWriteOffset,
+    RTTReadOffset,
+    RTTFlags,
+    RTTBufferWords
+};
+
+// \return Offset of the control block in the range, -1 if not there
+static long SearchID(const uint8_t* pData, size_t nSize) {
+    uint8_t ID[RTT_ID_SIZE] = RTT_ID;
+    for (size_t i = 0; i + RTT_ID_SIZE + 8 <= nSize; i += 4) {
+        if (memcmp(pData + i, ID, RTT_ID_SIZE))
+            continue;
+        uint32_t nCounts[2];
+        memcpy(nCounts, pData + i + RTT_ID_SIZE, sizeof(nCounts));
+        if (nCounts[0] && nCounts[0] <= RTT_MAX_BUFFERS &&
+            nCounts[1] <= RTT_MAX_BUFFERS)
+            return i;
+    }
+    return -1;
+}
+
+static void Sleep(uint64_t nNanos) {
+    struct timespec ts = {nNanos / 1000000000U, nNanos % 1000000000U};
+    nanosleep(&ts, 0);
+}
+
+int SWDRTTFind(struct CSWDLoader* loader, struct CSWDRTT* rtt,
+               uint32_t nAddress, size_t nSize, uint64_t nTimeoutNanos) {
+    memset(rtt, 0, sizeof(*rtt));
+    // chunks overlap by a control block header
+    uint8_t* pChunk = malloc(RTT_SEARCH_CHUNK + RTT_UP_BUFFERS);
+    if (!pChunk)
+        return 0;
+    uint64_t nDeadline = TimingNow() + nTimeoutNanos;
+    int bOK = 1;
+    do {
+        for (size_t nOffset = 0; bOK && nOffset < nSize;
+             nOffset += RTT_SEARCH_CHUNK) {
+            size_t nRead = nSize - nOffset;
+            if (nRead > RTT_SEARCH_CHUNK + RTT_UP_BUFFERS)
+                nRead = RTT_SEARCH_CHUNK + RTT_UP_BUFFERS;
+            bOK = SWDReadBlock(loader, nAddress + nOffset, pChunk, nRead);
+            long nFound = bOK ? SearchID(pChunk, nRead) : -1;
+            if (nFound >= 0) {
+                rtt->m_nControlBlock = nAddress + nOffset + nFound;
+                memcpy(&rtt->m_nUpBuffers, pChunk + nFound + RTT_ID_SIZE,
+                       sizeof(uint32_t));
+                printf("RTT control block @ 0x%08x, %u up buffers\n",
+                       rtt->m_nControlBlock, rtt->m_nUpBuffers);
+                free(pChunk);
+                return 1;
+            }
+        }
+        if (bOK && TimingNow() < nDeadline)
+            Sleep(RTT_RETRY_NANOS);
+    } while (bOK && TimingNow() < nDeadline);
+    free(pChunk);
+    fprintf(stderr, "RTT control block not found\n");
+    return 0;
+}
+
+// Read nSize bytes at any alignment into pOut
+static int ReadBytes(struct CSWDLoader* loader, uint32_t nAddress,
+                     size_t nSize, FILE* pOut) {
+    uint32_t nStart = nAddress & ~3U;
+    size_t nWords = (nAddress + nSize - nStart + 3) / 4;
+    uint32_t* pWords = malloc(nWords * 4);
+    if (!pWords)
+        return 0;
+    int bOK = SWDReadBlock(loader, nStart, pWords, nWords * 4) &&
+              fwrite((uint8_t*)pWords + (nAddress - nStart), 1, nSize,
+                     pOut) == nSize;
+    free(pWords);
+    return bOK;
+}
+
+int SWDRTTRead(struct CSWDLoader* loader, struct CSWDRTT* rtt,
+               unsigned nBuffer, FILE* pOut) {
+    if (nBuffer >= rtt->m_nUpBuffers) {
+        fprintf(stderr, "No RTT up buffer %u\n", nBuffer);
+        return -1;
+    }
+    uint32_t nDescriptor = rtt->m_nControlBlock + RTT_UP_BUFFERS +
+                           nBuffer * RTTBufferWords * 4;
+    uint32_t Buffer[RTTBufferWords];
+    rtt->m_nPolls++;
+    if (!SWDReadBlock(loader, nDescriptor, Buffer, sizeof(Buffer)))
+        return -1;
+    uint32_t nSize = Buffer[RTTSize], nWrite = Buffer[RTTWriteOffset],
+             nRead = Buffer[RTTReadOffset];
+    if (!nSize)
+        return 0; // not configured yet
+    if (nWrite >= nSize || nRead >= nSize) {
+        fprintf(stderr, "RTT up buffer %u is corrupt (%u/%u of %u)\n",
+                nBuffer, nRead, nWrite, nSize);
+        return -1;
+    }
+    if (nWrite == nRead)
+        return 0;
+    // up to the end of the ring, then from its start
+    uint32_t nEnd = nWrite > nRead ? nWrite : nSize;
+    int bOK = ReadBytes(loader, Buffer[RTTBuffer] + nRead, nEnd - nRead,
+                        pOut) &&
+              (nWrite > nRead || !nWrite ||
+               ReadBytes(loader, Buffer[RTTBuffer], nWrite, pOut)) &&
+              SWDWriteWord(loader, nDescriptor + RTTReadOffset * 4, nWrite);
+    fflush(pOut);
+    if (!bOK) {
+        fprintf(stderr, "RTT read failed\n");
+        return -1;
+    }
+    int nBytes = (nWrite + nSize - nRead) % nSize;
+    rtt->m_nBytes += nBytes;
+    return nBytes;
+}
+
+int SWDRTTStream(struct CSWDLoader* loader, struct CSWDRTT* rtt,
+                 unsigned nBuffer, FILE* pOut,
+                 volatile sig_atomic_t* pStop) {
+    uint64_t nWait = 0;
+    while (!pStop || !*pStop) {
+        int nBytes = SWDRTTRead(loader, rtt, nBuffer, pOut);
+        if (nBytes < 0)
+            return 0;
+        if (nBytes) {
+            nWait = 0; // drain at link speed
+            continue;
+        }
+        nWait = nWait ? nWait * 2 : RTT_POLL_MIN_NANOS;
+        if (nWait > RTT_POLL_MAX_NANOS)
+            nWait = RTT_POLL_MAX_NANOS;
+        Sleep(nWait);
+    }
+    return 1;
+}
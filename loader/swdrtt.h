@@ -0,0 +1,69 @@
+//
+// swdrtt.h
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _pico_swdrtt_h
+#define _pico_swdrtt_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "swdloader.h"
+
+#define RTT_POLL_MIN_NANOS 1000000U   // first wait after an empty poll
+#define RTT_POLL_MAX_NANOS 100000000U // longest wait between polls
+
+// Up (target to host) buffers of a SEGGER RTT compatible control block,
+// read while the core runs. The host only writes RdOff.
+struct CSWDRTT {
+    uint32_t m_nControlBlock; // 0 if not found
+    unsigned m_nUpBuffers;
+    uint64_t m_nBytes; // received
+    uint64_t m_nPolls;
+};
+
+/// \brief Look for the control block ID in target RAM, word aligned
+/// \param nAddress Start of the range searched
+/// \param nSize Size of the range searched (must be a multiple of 4)
+/// \param nTimeoutNanos Search again until found or timed out, the control
+/// block is set up by the target's startup code
+/// \return Control block found?
+int SWDRTTFind(struct CSWDLoader* loader, struct CSWDRTT* rtt,
+               uint32_t nAddress, size_t nSize, uint64_t nTimeoutNanos);
+
+/// \brief Copy what has been written to up buffer nBuffer to pOut
+/// \return Number of bytes copied, -1 on error
+int SWDRTTRead(struct CSWDLoader* loader, struct CSWDRTT* rtt,
+               unsigned nBuffer, FILE* pOut);
+
+/// \brief Poll up buffer nBuffer until an error or *pStop is set, at full
+/// link speed while there is data, backing off to RTT_POLL_MAX_NANOS
+/// between polls while the target is silent
+/// \param pStop May be 0
+/// \return 0 on error
+int SWDRTTStream(struct CSWDLoader* loader, struct CSWDRTT* rtt,
+                 unsigned nBuffer, FILE* pOut,
+                 volatile sig_atomic_t* pStop);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
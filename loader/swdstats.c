@@ -0,0 +1,225 @@
+//
+// swdstats.c
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "swdregs.h"
+#include "swdstats.h"
+
+#define STATS_PATH_MAX 512
+
+struct TSWDStats g_SWDStats;
+
+void SWDStatsResponse(unsigned nResponse) {
+    if (nResponse == DP_WAIT)
+        g_SWDStats.m_nWaits++;
+    else if (nResponse == DP_FAULT)
+        g_SWDStats.m_nFaults++;
+    else if (nResponse != DP_OK)
+        g_SWDStats.m_nNoResponses++;
+}
+
+void SWDStatsPhase(enum TSWDPhase Phase) {
+    uint64_t nNow = TimingNow();
+    if (g_SWDStats.m_nPhaseStart)
+        g_SWDStats.m_PhaseNanos[g_SWDStats.m_Phase] +=
+            nNow - g_SWDStats.m_nPhaseStart;
+    g_SWDStats.m_Phase = Phase;
+    g_SWDStats.m_nPhaseStart = nNow;
+}
+
+// Labels of request type i, e.g. "ap", "write", "0xC"
+static void RequestLabels(unsigned i, const char** ppPort, const char** ppDir,
+                          unsigned* pnAddress) {
+    *ppPort = i & 1 ? "ap" : "dp";
+    *ppDir = i & 2 ? "read" : "write";
+    *pnAddress = (i >> 2) << 2;
+}
+
+static void WriteJSON(const struct CSWDLoader* loader, FILE* pFile) {
+    const struct TSWDStats* stats = &g_SWDStats;
+    const struct CSWDTiming* timing = &loader->m_Timing;
+    fprintf(pFile,
+            "{\"backend\": \"%s\", \"clock_khz\": %u, "
+            "\"achieved_clock_khz\": %.1f,\n"
+            " \"gpio\": {\"writes\": %llu, \"reads\": %llu, "
+            "\"mode_changes\": %llu, \"kernel_calls\": %llu},\n"
+            " \"bits\": %llu, \"transactions\": %llu,\n"
+            " \"responses\": {\"wait\": %llu, \"fault\": %llu, "
+            "\"parity_error\": %llu, \"no_response\": %llu},\n"
+            " \"stalls\": %llu, \"longest_stall_seconds\": %.6f,\n"
+            " \"requests\": [",
+            GPIO_BACKEND, timing->m_nClockRateKHz,
+            TimingAchievedKHz(timing),
+            (unsigned long long)g_GPIOStats.m_nWrites,
+            (unsigned long long)g_GPIOStats.m_nReads,
+            (unsigned long long)g_GPIOStats.m_nModeChanges,
+            (unsigned long long)g_GPIOStats.m_nKernelCalls,
+            (unsigned long long)stats->m_nBits,
+            (unsigned long long)loader->m_nTransactions,
+            (unsigned long long)stats->m_nWaits,
+            (unsigned long long)stats->m_nFaults,
+            (unsigned long long)stats->m_nParityErrors,
+            (unsigned long long)stats->m_nNoResponses,
+            (unsigned long long)timing->m_nStalls,
+            timing->m_nLongestStall / 1e9);
+    int bFirst = 1;
+    for (unsigned i = 0; i < SWD_REQUEST_TYPES; i++) {
+        if (!stats->m_Requests[i])
+            continue;
+        const char *pPort, *pDir;
+        unsigned nAddress;
+        RequestLabels(i, &pPort, &pDir, &nAddress);
+        fprintf(pFile,
+                "%s\n  {\"port\": \"%s\", \"dir\": \"%s\", "
+                "\"addr\": \"0x%X\", \"count\": %llu}",
+                bFirst ? "" : ",", pPort, pDir, nAddress,
+                (unsigned long long)stats->m_Requests[i]);
+        bFirst = 0;
+    }
+    fprintf(pFile, "],\n \"phases\": {");
+    for (unsigned i = 0; i < SWDPhases; i++) {
+        const struct TSWDRetries* retries = &loader->m_Retries[i];
+        fprintf(pFile,
+                "%s\n  \"%s\": {\"seconds\": %.6f, \"wait_retries\": %llu, "
+                "\"fault_retries\": %llu, \"parity_retries\": %llu, "
+                "\"resumes\": %llu}",
+                i ? "," : "", SWDPhaseName(i), stats->m_PhaseNanos[i] / 1e9,
+                (unsigned long long)retries->m_nWaits,
+                (unsigned long long)retries->m_nFaults,
+                (unsigned long long)retries->m_nParity,
+                (unsigned long long)retries->m_nResumes);
+    }
+    fprintf(pFile, "}}\n");
+}
+
+static void WriteMetric(FILE* pFile, const char* pName, const char* pType,
+                        const char* pHelp) {
+    fprintf(pFile, "# HELP swdloader_%s %s\n# TYPE swdloader_%s %s\n", pName,
+            pHelp, pName, pType);
+}
+
+// Text exposition format, one sample per line
+static void WritePrometheus(const struct CSWDLoader* loader, FILE* pFile) {
+    const struct TSWDStats* stats = &g_SWDStats;
+    const struct CSWDTiming* timing = &loader->m_Timing;
+    WriteMetric(pFile, "info", "gauge", "GPIO backend");
+    fprintf(pFile, "swdloader_info{backend=\"%s\"} 1\n", GPIO_BACKEND);
+    WriteMetric(pFile, "clock_khz", "gauge", "SWCLK rate");
+    fprintf(pFile,
+            "swdloader_clock_khz{kind=\"requested\"} %u\n"
+            "swdloader_clock_khz{kind=\"achieved\"} %.1f\n",
+            timing->m_nClockRateKHz, TimingAchievedKHz(timing));
+    WriteMetric(pFile, "gpio_calls_total", "counter", "GPIO backend calls");
+    fprintf(pFile,
+            "swdloader_gpio_calls_total{op=\"write\"} %llu\n"
+            "swdloader_gpio_calls_total{op=\"read\"} %llu\n"
+            "swdloader_gpio_calls_total{op=\"mode\"} %llu\n",
+            (unsigned long long)g_GPIOStats.m_nWrites,
+            (unsigned long long)g_GPIOStats.m_nReads,
+            (unsigned long long)g_GPIOStats.m_nModeChanges);
+    WriteMetric(pFile, "kernel_calls_total", "counter",
+                "System calls made by the GPIO backend");
+    fprintf(pFile, "swdloader_kernel_calls_total %llu\n",
+            (unsigned long long)g_GPIOStats.m_nKernelCalls);
+    WriteMetric(pFile, "bits_total", "counter", "SWCLK cycles");
+    fprintf(pFile, "swdloader_bits_total %llu\n",
+            (unsigned long long)stats->m_nBits);
+    WriteMetric(pFile, "requests_total", "counter", "SWD requests by type");
+    for (unsigned i = 0; i < SWD_REQUEST_TYPES; i++) {
+        const char *pPort, *pDir;
+        unsigned nAddress;
+        RequestLabels(i, &pPort, &pDir, &nAddress);
+        fprintf(pFile,
+                "swdloader_requests_total{port=\"%s\",dir=\"%s\","
+                "addr=\"0x%X\"} %llu\n",
+                pPort, pDir, nAddress,
+                (unsigned long long)stats->m_Requests[i]);
+    }
+    WriteMetric(pFile, "responses_total", "counter",
+                "Requests not answered with OK");
+    fprintf(pFile,
+            "swdloader_responses_total{ack=\"wait\"} %llu\n"
+            "swdloader_responses_total{ack=\"fault\"} %llu\n"
+            "swdloader_responses_total{ack=\"parity_error\"} %llu\n"
+            "swdloader_responses_total{ack=\"none\"} %llu\n",
+            (unsigned long long)stats->m_nWaits,
+            (unsigned long long)stats->m_nFaults,
+            (unsigned long long)stats->m_nParityErrors,
+            (unsigned long long)stats->m_nNoResponses);
+    WriteMetric(pFile, "phase_seconds_total", "counter",
+                "Wall time per phase");
+    for (unsigned i = 0; i < SWDPhases; i++)
+        fprintf(pFile, "swdloader_phase_seconds_total{phase=\"%s\"} %.6f\n",
+                SWDPhaseName(i), stats->m_PhaseNanos[i] / 1e9);
+    WriteMetric(pFile, "retries_total", "counter",
+                "Failed requests recovered from, per phase");
+    for (unsigned i = 0; i < SWDPhases; i++) {
+        const struct TSWDRetries* retries = &loader->m_Retries[i];
+        const char* pPhase = SWDPhaseName(i);
+        fprintf(pFile,
+                "swdloader_retries_total{phase=\"%s\",kind=\"wait\"} %llu\n"
+                "swdloader_retries_total{phase=\"%s\",kind=\"fault\"} %llu\n"
+                "swdloader_retries_total{phase=\"%s\",kind=\"parity\"} %llu\n"
+                "swdloader_retries_total{phase=\"%s\",kind=\"resume\"} %llu\n",
+                pPhase, (unsigned long long)retries->m_nWaits, pPhase,
+                (unsigned long long)retries->m_nFaults, pPhase,
+                (unsigned long long)retries->m_nParity, pPhase,
+                (unsigned long long)retries->m_nResumes);
+    }
+    WriteMetric(pFile, "stalls_total", "counter",
+                "Scheduling stalls in the last load");
+    fprintf(pFile, "swdloader_stalls_total %llu\n",
+            (unsigned long long)timing->m_nStalls);
+    WriteMetric(pFile, "longest_stall_seconds", "gauge",
+                "Longest scheduling stall in the last load");
+    fprintf(pFile, "swdloader_longest_stall_seconds %.6f\n",
+            timing->m_nLongestStall / 1e9);
+}
+
+int SWDStatsWrite(const struct CSWDLoader* loader, const char* pPath) {
+    // the current phase up to now
+    SWDStatsPhase(g_SWDStats.m_Phase);
+    if (!strcmp(pPath, "-")) {
+        WriteJSON(loader, stdout);
+        return 1;
+    }
+    size_t nLength = strlen(pPath);
+    int bPrometheus = nLength > 5 && !strcmp(pPath + nLength - 5, ".prom");
+    // the collector may read the file at any time
+    char Temp[STATS_PATH_MAX];
+    if (snprintf(Temp, sizeof(Temp), "%s.tmp", pPath) >= (int)sizeof(Temp)) {
+        fprintf(stderr, "Path too long: %s\n", pPath);
+        return 0;
+    }
+    FILE* pFile = fopen(Temp, "w");
+    if (!pFile) {
+        fprintf(stderr, "Can't create %s\n", Temp);
+        return 0;
+    }
+    if (bPrometheus)
+        WritePrometheus(loader, pFile);
+    else
+        WriteJSON(loader, pFile);
+    if (fclose(pFile) != 0 || rename(Temp, pPath) != 0) {
+        fprintf(stderr, "Can't write %s\n", pPath);
+        remove(Temp);
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,80 @@
+//
+// swdstats.h
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _pico_swdstats_h
+#define _pico_swdstats_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "swdloader.h"
+
+// Request types counted, APnDP, RnW and A[3:2] of the request
+#define SWD_REQUEST_TYPES 16
+#define SWD_REQUEST_TYPE(nRequest) (((nRequest) >> 1) & 0xF)
+
+// Link counters and wall time per phase, only kept with USE_SWDSTATS (cmake
+// -DSWD_STATS=ON). GPIO calls are in g_GPIOStats, retries in the loader.
+struct TSWDStats {
+    uint64_t m_nBits; // clocked, both directions
+    uint64_t m_Requests[SWD_REQUEST_TYPES];
+    uint64_t m_nWaits;
+    uint64_t m_nFaults;
+    uint64_t m_nParityErrors;
+    uint64_t m_nNoResponses; // no valid ACK
+    uint64_t m_PhaseNanos[SWDPhases];
+    enum TSWDPhase m_Phase;
+    uint64_t m_nPhaseStart; // 0 before the first phase
+};
+
+extern struct TSWDStats g_SWDStats;
+
+#if defined(USE_SWDSTATS)
+#define SWD_STATS_ENABLED 1
+#define SWD_STATS_ADD(member, n) (g_SWDStats.member += (n))
+#define SWD_STATS_REQUEST(nRequest)                                        \
+    (g_SWDStats.m_Requests[SWD_REQUEST_TYPE(nRequest)]++)
+#define SWD_STATS_RESPONSE(nResponse) SWDStatsResponse(nResponse)
+#define SWD_STATS_PHASE(Phase) SWDStatsPhase(Phase)
+#else
+#define SWD_STATS_ENABLED 0
+#define SWD_STATS_ADD(member, n) ((void)0)
+#define SWD_STATS_REQUEST(nRequest) ((void)0)
+#define SWD_STATS_RESPONSE(nResponse) ((void)0)
+#define SWD_STATS_PHASE(Phase) ((void)0)
+#endif
+
+/// \brief Count a non-OK ACK
+void SWDStatsResponse(unsigned nResponse);
+
+/// \brief Charge the time since the last call to the phase then current
+void SWDStatsPhase(enum TSWDPhase Phase);
+
+/// \brief Write counters, phase times, retries and timing of a session
+/// \param pPath File name, a Prometheus textfile if it ends in .prom (written
+/// to a temporary file and renamed, for node_exporter), JSON otherwise, "-"
+/// for JSON on stdout
+/// \return Operation successful?
+int SWDStatsWrite(const struct CSWDLoader* loader, const char* pPath);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,155 @@
+//
+// swdtiming.c
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <string.h>
+
+#include "swdtiming.h"
+
+#define CALIBRATION_WRITES 1000
+
+static const unsigned s_BucketLimits[TIMING_BUCKETS] = TIMING_BUCKET_LIMITS;
+
+static void SetHalfPeriod(struct CSWDTiming* timing, unsigned nClockRateKHz) {
+    timing->m_nClockRateKHz = nClockRateKHz;
+    timing->m_nHalfPeriodNanos =
+        nClockRateKHz < TIMING_MAX_KHZ ? 500000U / nClockRateKHz : 1;
+}
+
+void TimingInit(struct CSWDTiming* timing, unsigned nClockRateKHz) {
+    memset(timing, 0, sizeof(*timing));
+    SetHalfPeriod(timing, nClockRateKHz);
+    timing->m_bPaced = 1;
+    timing->m_nStallNanos = TIMING_STALL_NANOS;
+    TimingStart(timing);
+}
+
+void TimingCalibrate(struct CSWDTiming* timing, struct CGPIOPin* pin) {
+    uint64_t nStart = TimingNow();
+    for (unsigned i = 0; i < CALIBRATION_WRITES; i++)
+        WritePin(pin, i & 1);
+    WritePin(pin, LOW);
+    timing->m_nLatencyNanos =
+        (TimingNow() - nStart) / (CALIBRATION_WRITES + 1);
+    // A half period has at least one GPIO write, if that alone takes longer
+    // than requested reading the clock only slows things down further
+    timing->m_bPaced = timing->m_nLatencyNanos < timing->m_nHalfPeriodNanos;
+    TimingStart(timing);
+}
+
+void TimingSetRate(struct CSWDTiming* timing, unsigned nClockRateKHz) {
+    SetHalfPeriod(timing, nClockRateKHz);
+    timing->m_bPaced = timing->m_nLatencyNanos < timing->m_nHalfPeriodNanos;
+    TimingStart(timing);
+}
+
+void TimingStart(struct CSWDTiming* timing) {
+    timing->m_nStart = TimingNow();
+    timing->m_nLastEdge = timing->m_nStart;
+    timing->m_nHalfPeriods = 0;
+    timing->m_nClockedHalfPeriods = 0;
+    timing->m_nClockedNanos = 0;
+    memset(timing->m_Histogram, 0, sizeof(timing->m_Histogram));
+    timing->m_nStalls = 0;
+    timing->m_nLongestStall = 0;
+    timing->m_bGap = 0;
+}
+
+static void RecordStall(struct CSWDTiming* timing, uint64_t nNanos) {
+    timing->m_nStalls++;
+    if (nNanos > timing->m_nLongestStall)
+        timing->m_nLongestStall = nNanos;
+}
+
+void TimingRecord(struct CSWDTiming* timing, uint64_t nInterval) {
+    uint64_t nOver = nInterval > timing->m_nHalfPeriodNanos
+                         ? nInterval - timing->m_nHalfPeriodNanos
+                         : 0;
+    uint64_t nPercent = nOver * 100 / timing->m_nHalfPeriodNanos;
+    unsigned i = 0;
+    while (i < TIMING_BUCKETS - 1 && nPercent > s_BucketLimits[i])
+        i++;
+    timing->m_Histogram[i]++;
+    if (i < TIMING_BUCKETS - 1) {
+        timing->m_nClockedHalfPeriods++;
+        timing->m_nClockedNanos += nInterval;
+    }
+    if (nOver > timing->m_nStallNanos && !timing->m_bGap)
+        RecordStall(timing, nOver);
+    timing->m_bGap = 0;
+}
+
+void TimingRecordRun(struct CSWDTiming* timing) {
+    uint64_t nNow = TimingNow();
+    // a half period has a clock write and at most a mode change, a data
+    // write and a sample
+    uint64_t nExpected = (uint64_t)TIMING_RUN_HALF_PERIODS * 4 *
+                         timing->m_nLatencyNanos;
+    uint64_t nRun = nNow - timing->m_nLastEdge;
+    if (nRun > nExpected + timing->m_nStallNanos && !timing->m_bGap)
+        RecordStall(timing, nRun - nExpected);
+    timing->m_nLastEdge = nNow;
+    timing->m_bGap = 0;
+}
+
+void TimingDelay(uint64_t nNanos) {
+    uint64_t nDeadline = TimingNow() + nNanos;
+    while (TimingNow() < nDeadline)
+        ;
+}
+
+double TimingAchievedKHz(const struct CSWDTiming* timing) {
+    if (timing->m_bPaced && timing->m_nClockedNanos)
+        return timing->m_nClockedHalfPeriods * 500000.0 /
+               timing->m_nClockedNanos;
+    uint64_t nElapsed = TimingNow() - timing->m_nStart;
+    return nElapsed ? timing->m_nHalfPeriods * 500000.0 / nElapsed : 0;
+}
+
+static void ReportStalls(const struct CSWDTiming* timing, FILE* pFile) {
+    fprintf(pFile, "Stalls over %u us: %llu", timing->m_nStallNanos / 1000,
+            (unsigned long long)timing->m_nStalls);
+    if (timing->m_nStalls)
+        fprintf(pFile, " (longest %llu us)",
+                (unsigned long long)timing->m_nLongestStall / 1000);
+    fprintf(pFile, "\n");
+}
+
+void TimingReport(const struct CSWDTiming* timing, FILE* pFile) {
+    fprintf(pFile,
+            "SWCLK requested %u KHz, GPIO write %u ns, achieved %.1f KHz",
+            timing->m_nClockRateKHz, timing->m_nLatencyNanos,
+            TimingAchievedKHz(timing));
+    if (!timing->m_bPaced || !timing->m_nClockedNanos) {
+        // edges not timed
+        fprintf(pFile, " (average, unpaced)\n");
+        ReportStalls(timing, pFile);
+        return;
+    }
+    uint64_t nElapsed = TimingNow() - timing->m_nStart;
+    fprintf(pFile, " (%.0f%% of time clocking)\n",
+            timing->m_nClockedNanos * 100.0 / nElapsed);
+    fprintf(pFile, "Half period over requested:");
+    for (unsigned i = 0; i < TIMING_BUCKETS; i++) {
+        if (i < TIMING_BUCKETS - 1)
+            fprintf(pFile, " <=%u%% %llu", s_BucketLimits[i],
+                    (unsigned long long)timing->m_Histogram[i]);
+        else
+            fprintf(pFile, " more %llu\n",
+                    (unsigned long long)timing->m_Histogram[i]);
+    }
+    ReportStalls(timing, pFile);
+}
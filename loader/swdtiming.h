@@ -0,0 +1,123 @@
+//
+// swdtiming.h
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _pico_swdtiming_h
+#define _pico_swdtiming_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "gpiopin.h"
+
+// Half period histogram, bucket upper limits in percent over the requested
+// half period. The last bucket also collects gaps between transactions.
+#define TIMING_BUCKETS 7
+#define TIMING_BUCKET_LIMITS {5, 10, 25, 50, 100, 300, ~0U}
+
+// A half period this much longer than requested is counted as a scheduling
+// stall. Unpaced edges are not timed, a run of TIMING_RUN_HALF_PERIODS is
+// checked against the GPIO calls it should take instead.
+#define TIMING_STALL_NANOS 100000U
+#define TIMING_RUN_HALF_PERIODS 16 // power of 2
+
+#define TIMING_MAX_KHZ 500000U // a half period of 1 ns
+
+struct CSWDTiming {
+    unsigned m_nClockRateKHz;    // requested
+    unsigned m_nHalfPeriodNanos; // requested, at least 1
+    unsigned m_nLatencyNanos;    // calibrated cost of one WritePin()
+    int m_bPaced;                // 0 if the GPIO calls alone are too slow
+    uint64_t m_nLastEdge;
+    uint64_t m_nStart;
+    uint64_t m_nHalfPeriods;
+    uint64_t m_nClockedHalfPeriods; // half periods within the last bucket
+    uint64_t m_nClockedNanos;
+    uint64_t m_Histogram[TIMING_BUCKETS];
+    unsigned m_nStallNanos; // threshold
+    uint64_t m_nStalls;
+    uint64_t m_nLongestStall; // nanos
+    int m_bGap; // host work since the last edge
+};
+
+static inline uint64_t TimingNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000U + ts.tv_nsec;
+}
+
+/// \param nClockRateKHz Requested interface clock rate in KHz, rates above
+/// TIMING_MAX_KHZ are timed as TIMING_MAX_KHZ
+void TimingInit(struct CSWDTiming* timing, unsigned nClockRateKHz);
+
+/// \brief Measure the GPIO write latency and decide whether to pace edges
+/// \param pin Output pin that may be toggled freely
+void TimingCalibrate(struct CSWDTiming* timing, struct CGPIOPin* pin);
+
+/// \brief Change the requested rate, keeping the calibrated GPIO latency
+void TimingSetRate(struct CSWDTiming* timing, unsigned nClockRateKHz);
+
+/// \brief Start a new measurement window
+void TimingStart(struct CSWDTiming* timing);
+
+/// \return Achieved SWCLK rate in KHz, while clocking if edges are paced,
+/// otherwise averaged over the measurement window
+double TimingAchievedKHz(const struct CSWDTiming* timing);
+
+/// \brief Print achieved SWCLK rate, half period histogram and stalls
+void TimingReport(const struct CSWDTiming* timing, FILE* pFile);
+
+/// \brief Busy wait
+void TimingDelay(uint64_t nNanos);
+
+void TimingRecord(struct CSWDTiming* timing, uint64_t nInterval);
+
+void TimingRecordRun(struct CSWDTiming* timing);
+
+/// \brief The next half period follows host work (compression, waiting for
+/// a wave), it is not checked for a stall
+static inline void TimingGap(struct CSWDTiming* timing) {
+    timing->m_bGap = 1;
+}
+
+/// \brief End the current clock half period
+/// \note Paces against the previous edge, so the time spent in the GPIO
+/// calls is not waited a second time
+static inline void TimingHalfPeriod(struct CSWDTiming* timing) {
+    timing->m_nHalfPeriods++;
+    if (!timing->m_bPaced) {
+        if (!(timing->m_nHalfPeriods & (TIMING_RUN_HALF_PERIODS - 1)))
+            TimingRecordRun(timing);
+        return;
+    }
+    uint64_t nDeadline = timing->m_nLastEdge + timing->m_nHalfPeriodNanos;
+    uint64_t nNow;
+    do
+        nNow = TimingNow();
+    while (nNow < nDeadline);
+    TimingRecord(timing, nNow - timing->m_nLastEdge);
+    timing->m_nLastEdge = nNow;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
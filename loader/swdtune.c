@@ -0,0 +1,186 @@
+//
+// swdtune.c
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "swdregs.h"
+#include "swdtune.h"
+
+#define TUNE_SCRATCH SRAM_STRIPED_END // SRAM4, not touched by the loader
+#define TUNE_WORDS 256
+#define TUNE_ID_READS 8
+#define TUNE_MIN_GAIN 1.05 // achieved rate, worth a higher request
+#define TUNE_CACHE_LINE 256
+#define TUNE_CACHE_LINES 64
+
+static const unsigned s_Rates[] = {100,  200,  400,  700,   1000,  1500, 2000,
+                                   3000, 4000, 6000, 8000, 12000, 16000, 24000};
+#define TUNE_RATES (sizeof(s_Rates) / sizeof(s_Rates[0]))
+
+// Solid, alternating, walking and pseudo random bits, to catch both slow
+// edges and crosstalk
+static void FillPattern(uint32_t* pData, unsigned nRound) {
+    uint32_t nRandom = 0x9E3779B9U * (nRound + 1);
+    for (unsigned i = 0; i < TUNE_WORDS; i++) {
+        switch (nRound % 4) {
+        case 0:
+            pData[i] = i & 1 ? 0xFFFFFFFFU : 0;
+            break;
+        case 1:
+            pData[i] = i & 1 ? 0xAAAAAAAAU : 0x55555555U;
+            break;
+        case 2:
+            pData[i] = (1U << (i & 31)) ^ (i & 32 ? ~0U : 0);
+            break;
+        default:
+            nRandom ^= nRandom << 13;
+            nRandom ^= nRandom >> 17;
+            nRandom ^= nRandom << 5;
+            pData[i] = nRandom;
+            break;
+        }
+    }
+}
+
+int SWDTuneCheck(struct CSWDLoader* loader) {
+    uint32_t Pattern[TUNE_WORDS], Readback[TUNE_WORDS];
+    // the pattern is compared in full here
+    enum TSWDVerify Verify = loader->m_Verify;
+    loader->m_Verify = SWDVerifyNone;
+    // a retry is an error here, and not one of the session
+    struct TSWDRetries Retries[SWDPhases];
+    memcpy(Retries, loader->m_Retries, sizeof(Retries));
+    int bOK = SWDHalt(loader);
+    for (unsigned nRound = 0; bOK && nRound < TUNE_ROUNDS; nRound++) {
+        for (unsigned i = 0; bOK && i < TUNE_ID_READS; i++)
+            bOK = SWDCheckLink(loader);
+        FillPattern(Pattern, nRound);
+        bOK = bOK &&
+              SWDLoadChunk(loader, Pattern, sizeof(Pattern), TUNE_SCRATCH) &&
+              SWDReadBlock(loader, TUNE_SCRATCH, Readback,
+                           sizeof(Readback)) &&
+              !memcmp(Pattern, Readback, sizeof(Pattern)) &&
+              SWDCheckLink(loader);
+    }
+    loader->m_Verify = Verify;
+    bOK = bOK && !memcmp(Retries, loader->m_Retries, sizeof(Retries));
+    memcpy(loader->m_Retries, Retries, sizeof(Retries));
+    return bOK;
+}
+
+// \return Rate below nKHz on the ladder, 0 if none
+static unsigned LowerRate(unsigned nKHz) {
+    unsigned nLower = 0;
+    for (unsigned i = 0; i < TUNE_RATES && s_Rates[i] < nKHz; i++)
+        nLower = s_Rates[i];
+    return nLower;
+}
+
+static unsigned HigherRate(unsigned nKHz) {
+    for (unsigned i = 0; i < TUNE_RATES; i++)
+        if (s_Rates[i] > nKHz)
+            return s_Rates[i];
+    return 0;
+}
+
+static int CheckRate(struct CSWDLoader* loader, unsigned nKHz) {
+    SWDSetClock(loader, nKHz);
+    int bClean = SWDTuneCheck(loader);
+    printf("\nSWCLK %u KHz (achieved %.0f KHz): %s\n", nKHz,
+           TimingAchievedKHz(&loader->m_Timing), bClean ? "clean" : "errors");
+    return bClean;
+}
+
+unsigned SWDTuneClock(struct CSWDLoader* loader, unsigned nStartKHz,
+                      unsigned nMaxKHz) {
+    printf("Tuning SWCLK\n");
+    // from whatever state a failed check at another rate left
+    SWDSetClock(loader, nStartKHz);
+    SWDCheckConnection(loader);
+    unsigned nGood = 0, nKHz = nStartKHz;
+    double fAchieved = 0;
+    while (nKHz && nKHz <= nMaxKHz) {
+        if (!CheckRate(loader, nKHz))
+            break;
+        // once GPIO calls set the pace, a higher request changes nothing
+        double fLast = fAchieved;
+        fAchieved = TimingAchievedKHz(&loader->m_Timing);
+        if (nGood && fAchieved < fLast * TUNE_MIN_GAIN) {
+            SWDSetClock(loader, nGood);
+            return nGood;
+        }
+        nGood = nKHz;
+        if (!loader->m_Timing.m_bPaced)
+            return nGood;
+        nKHz = HigherRate(nKHz);
+    }
+    if (!nKHz || nKHz > nMaxKHz)
+        return nGood; // no errors up to the limit
+    // back off, the link may have lost sync and sticky errors are set
+    if (!nGood)
+        nGood = LowerRate(nKHz);
+    while (nGood) {
+        SWDSetClock(loader, nGood);
+        if (SWDCheckConnection(loader) && CheckRate(loader, nGood))
+            break;
+        nGood = LowerRate(nGood);
+    }
+    if (!nGood)
+        fprintf(stderr, "No clean SWCLK rate from %u KHz\n", nStartKHz);
+    return nGood;
+}
+
+unsigned SWDTuneCacheRead(const char* pPath, const char* pKey) {
+    FILE* pFile = fopen(pPath, "r");
+    if (!pFile)
+        return 0;
+    char Line[TUNE_CACHE_LINE], Key[TUNE_CACHE_LINE];
+    unsigned nKHz = 0, nLineKHz;
+    while (fgets(Line, sizeof(Line), pFile))
+        if (sscanf(Line, "%255s %u", Key, &nLineKHz) == 2 &&
+            !strcmp(Key, pKey))
+            nKHz = nLineKHz;
+    fclose(pFile);
+    return nKHz;
+}
+
+int SWDTuneCacheWrite(const char* pPath, const char* pKey, unsigned nKHz) {
+    // the other pin sets are kept
+    static char Lines[TUNE_CACHE_LINES][TUNE_CACHE_LINE];
+    char Key[TUNE_CACHE_LINE];
+    unsigned nLines = 0;
+    FILE* pFile = fopen(pPath, "r");
+    if (pFile) {
+        while (nLines < TUNE_CACHE_LINES - 1 &&
+               fgets(Lines[nLines], TUNE_CACHE_LINE, pFile))
+            if (sscanf(Lines[nLines], "%255s", Key) == 1 &&
+                strcmp(Key, pKey))
+                nLines++;
+        fclose(pFile);
+    }
+    snprintf(Lines[nLines++], TUNE_CACHE_LINE, "%s %u\n", pKey, nKHz);
+    pFile = fopen(pPath, "w");
+    if (!pFile) {
+        fprintf(stderr, "Cannot write %s\n", pPath);
+        return 0;
+    }
+    for (unsigned i = 0; i < nLines; i++)
+        fputs(Lines[i], pFile);
+    return fclose(pFile) == 0;
+}
@@ -0,0 +1,59 @@
+//
+// swdtune.h
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _pico_swdtune_h
+#define _pico_swdtune_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "swdloader.h"
+
+#define TUNE_START_KHZ 100 // without a cached rate
+#define TUNE_MAX_KHZ 24000
+#define TUNE_ROUNDS 4 // clean checks required at a rate
+
+/// \brief Raise SWCLK from nStartKHz through a ladder of rates while DPIDR
+/// reads and a 1 KB write/readback pattern in scratch RAM (SRAM4) stay clean.
+/// A parity error, WAIT, FAULT or mismatch, even if recovered from, falls
+/// back to the last clean rate, or below nStartKHz if that fails. Raising
+/// stops once GPIO calls alone set the rate (unpaced) or the achieved rate
+/// hardly improves.
+/// \param nMaxKHz Highest rate tried
+/// \note The core is halted
+/// \return Rate in KHz the loader is left at, 0 if none is clean
+unsigned SWDTuneClock(struct CSWDLoader* loader, unsigned nStartKHz,
+                      unsigned nMaxKHz);
+
+/// \brief Check the loader's current rate as SWDTuneClock() does
+/// \return Rate clean?
+int SWDTuneCheck(struct CSWDLoader* loader);
+
+/// \param pPath Cache file, lines of a key and a rate in KHz
+/// \param pKey Pin set and backend, without white space
+/// \return Rate tuned before, 0 if not cached
+unsigned SWDTuneCacheRead(const char* pPath, const char* pKey);
+
+/// \brief Add or replace the rate of a pin set
+/// \return Operation successful?
+int SWDTuneCacheWrite(const char* pPath, const char* pKey, unsigned nKHz);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
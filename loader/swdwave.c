@@ -0,0 +1,255 @@
+//
+// swdwave.c
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gpiopin.h"
+#include "swdregs.h"
+#include "swdwave.h"
+
+#define WAVE_COMPILER_STACK 0x40000
+
+void WaveInit(struct CSWDWave* wave) { memset(wave, 0, sizeof(*wave)); }
+
+void WaveFree(struct CSWDWave* wave) {
+    free(wave->m_pSteps);
+    free(wave->m_pSamples);
+    free(wave->m_pOps);
+    WaveInit(wave);
+}
+
+void WaveReset(struct CSWDWave* wave) {
+    wave->m_nSteps = 0;
+    wave->m_nSamples = 0;
+    wave->m_nOps = 0;
+}
+
+static void Grow(void** ppBuffer, size_t nItemSize, size_t* pnMax,
+                 size_t nNeeded) {
+    if (nNeeded <= *pnMax)
+        return;
+    size_t nMax = *pnMax ? *pnMax : 1024;
+    while (nMax < nNeeded)
+        nMax *= 2;
+    *ppBuffer = realloc(*ppBuffer, nMax * nItemSize);
+    assert(*ppBuffer);
+    *pnMax = nMax;
+}
+
+// One bit is two steps: clock low with the data set up (and sampled),
+// then clock high
+static void WaveBit(struct CSWDWave* wave, uint8_t uchStep) {
+    Grow((void**)&wave->m_pSteps, 1, &wave->m_nMaxSteps, wave->m_nSteps + 2);
+    wave->m_pSteps[wave->m_nSteps++] = uchStep;
+    wave->m_pSteps[wave->m_nSteps++] = (uchStep & ~WAVE_SAMPLE) | WAVE_CLOCK;
+    if (uchStep & WAVE_SAMPLE) {
+        Grow((void**)&wave->m_pSamples, 4, &wave->m_nMaxSamples,
+             (wave->m_nSamples + 32) / 32);
+        wave->m_nSamples++;
+    }
+}
+
+static unsigned Sample(const struct CSWDWave* wave, unsigned nIndex) {
+    return (wave->m_pSamples[nIndex / 32] >> (nIndex & 31)) & 1;
+}
+
+static uint32_t Samples(const struct CSWDWave* wave, unsigned nIndex,
+                        unsigned nBitCount) {
+    uint32_t nBits = 0;
+    for (unsigned i = 0; i < nBitCount; i++)
+        nBits |= Sample(wave, nIndex + i) << i;
+    return nBits;
+}
+
+static struct TSWDWaveOp* AddOp(struct CSWDWave* wave, uint8_t nRequest) {
+    Grow((void**)&wave->m_pOps, sizeof(struct TSWDWaveOp), &wave->m_nMaxOps,
+         wave->m_nOps + 1);
+    struct TSWDWaveOp* op = &wave->m_pOps[wave->m_nOps++];
+    op->m_nRequest = nRequest;
+    op->m_nData = 0;
+    op->m_nAck = wave->m_nSamples;
+    op->m_nResponse = 0;
+    return op;
+}
+
+void WaveWriteBits(struct CSWDWave* wave, uint32_t nBits, unsigned nBitCount) {
+    while (nBitCount--) {
+        WaveBit(wave, (nBits & 1) ? WAVE_DATA : 0);
+        nBits >>= 1;
+    }
+}
+
+void WaveReadBits(struct CSWDWave* wave, unsigned nBitCount, int bSample) {
+    while (nBitCount--)
+        WaveBit(wave, WAVE_INPUT | (bSample ? WAVE_SAMPLE : 0));
+}
+
+void WaveIdle(struct CSWDWave* wave) {
+    WaveWriteBits(wave, 0, 8);
+    Grow((void**)&wave->m_pSteps, 1, &wave->m_nMaxSteps, wave->m_nSteps + 1);
+    wave->m_pSteps[wave->m_nSteps++] = 0;
+}
+
+void WaveWriteData(struct CSWDWave* wave, uint8_t nRequest, uint32_t nData) {
+    assert(nRequest & 0x80);
+    WaveWriteBits(wave, nRequest, 7);
+    WaveReadBits(wave, 1 + TURN_CYCLES, 0); // park bit and turn cycle
+    struct TSWDWaveOp* op = AddOp(wave, nRequest);
+    op->m_nData = nData;
+    WaveReadBits(wave, 3, 1);
+    WaveReadBits(wave, TURN_CYCLES, 0);
+    WaveWriteBits(wave, nData, 32);
+    WaveWriteBits(wave, __builtin_parity(nData), 1);
+}
+
+void WaveStreamData(struct CSWDWave* wave, uint8_t nRequest, uint32_t nData) {
+    assert(nRequest & 0x80);
+    WaveWriteBits(wave, nRequest, 7);
+    struct TSWDWaveOp* op = AddOp(wave, nRequest);
+    op->m_nData = nData;
+    op->m_nAck = WAVE_NO_ACK;
+    // park bit, turn cycle, ACK and turn cycle back
+    WaveReadBits(wave, 1 + TURN_CYCLES + 3 + TURN_CYCLES, 0);
+    WaveWriteBits(wave, nData, 32);
+    WaveWriteBits(wave, __builtin_parity(nData), 1);
+}
+
+void WaveReadData(struct CSWDWave* wave, uint8_t nRequest) {
+    assert(nRequest & 0x80);
+    WaveWriteBits(wave, nRequest, 7);
+    WaveReadBits(wave, 1 + TURN_CYCLES, 0); // park bit and turn cycle
+    AddOp(wave, nRequest);
+    WaveReadBits(wave, 3 + 32 + 1, 1); // ACK, data and parity
+    WaveReadBits(wave, TURN_CYCLES, 0);
+}
+
+unsigned WaveDecode(struct CSWDWave* wave) {
+    for (unsigned i = 0; i < wave->m_nOps; i++) {
+        struct TSWDWaveOp* op = &wave->m_pOps[i];
+        if (op->m_nAck == WAVE_NO_ACK)
+            continue;
+        op->m_nResponse = Samples(wave, op->m_nAck, 3);
+        if (op->m_nResponse != DP_OK)
+            return i;
+        if (op->m_nRequest & 0x04) { // RnW
+            op->m_nData = Samples(wave, op->m_nAck + 3, 32);
+            if (Sample(wave, op->m_nAck + 35) != __builtin_parity(op->m_nData))
+                return i;
+        }
+    }
+    return wave->m_nOps;
+}
+
+static void* WavePipeThread(void* pParam) {
+    struct CSWDWavePipe* pipe = (struct CSWDWavePipe*)pParam;
+    for (unsigned nBlock = 0; nBlock < pipe->m_nBlocks; nBlock++) {
+        unsigned nBuffer = nBlock & 1;
+        sem_wait(&pipe->m_Free[nBuffer]);
+        if (pipe->m_bAbort)
+            break;
+        WaveReset(&pipe->m_Wave[nBuffer]);
+        pipe->m_pCompile(&pipe->m_Wave[nBuffer], nBlock, pipe->m_pParam);
+        sem_post(&pipe->m_Ready[nBuffer]);
+    }
+    return 0;
+}
+
+// A real-time player keeps its CPU to itself, the compiler then runs at
+// normal priority on the other CPUs
+static void CompilerAttributes(pthread_attr_t* attr) {
+    // the stack is locked too under mlockall(MCL_FUTURE)
+    pthread_attr_setstacksize(attr, WAVE_COMPILER_STACK);
+    pthread_t self = pthread_self();
+    struct sched_param param;
+    int nPolicy;
+    cpu_set_t cpus;
+    if (pthread_getschedparam(self, &nPolicy, &param) != 0 ||
+        nPolicy == SCHED_OTHER ||
+        pthread_getaffinity_np(self, sizeof(cpus), &cpus) != 0)
+        return;
+    param.sched_priority = 0;
+    pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(attr, SCHED_OTHER);
+    pthread_attr_setschedparam(attr, &param);
+    long nCPUs = sysconf(_SC_NPROCESSORS_CONF);
+    cpu_set_t others;
+    CPU_ZERO(&others);
+    for (long i = 0; i < nCPUs && i < CPU_SETSIZE; i++)
+        if (!CPU_ISSET(i, &cpus))
+            CPU_SET(i, &others);
+    if (CPU_COUNT(&others))
+        pthread_attr_setaffinity_np(attr, sizeof(others), &others);
+}
+
+int WavePipeStart(struct CSWDWavePipe* pipe, unsigned nBlocks,
+                  TWaveCompiler pCompile, void* pParam) {
+    pipe->m_nBlocks = nBlocks;
+    pipe->m_nNext = 0;
+    pipe->m_bAbort = 0;
+    pipe->m_pCompile = pCompile;
+    pipe->m_pParam = pParam;
+    for (unsigned i = 0; i < 2; i++) {
+        WaveInit(&pipe->m_Wave[i]);
+        sem_init(&pipe->m_Free[i], 0, 1);
+        sem_init(&pipe->m_Ready[i], 0, 0);
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    CompilerAttributes(&attr);
+    int nError = pthread_create(&pipe->m_Thread, &attr, WavePipeThread, pipe);
+    pthread_attr_destroy(&attr);
+    if (nError)
+        nError = pthread_create(&pipe->m_Thread, 0, WavePipeThread, pipe);
+    if (nError) {
+        for (unsigned i = 0; i < 2; i++) {
+            sem_destroy(&pipe->m_Free[i]);
+            sem_destroy(&pipe->m_Ready[i]);
+        }
+        return 0;
+    }
+    return 1;
+}
+
+struct CSWDWave* WavePipeNext(struct CSWDWavePipe* pipe) {
+    if (pipe->m_nNext >= pipe->m_nBlocks)
+        return 0;
+    unsigned nBuffer = pipe->m_nNext++ & 1;
+    sem_wait(&pipe->m_Ready[nBuffer]);
+    return &pipe->m_Wave[nBuffer];
+}
+
+void WavePipeRelease(struct CSWDWavePipe* pipe, struct CSWDWave* wave) {
+    sem_post(&pipe->m_Free[wave == &pipe->m_Wave[1]]);
+}
+
+void WavePipeStop(struct CSWDWavePipe* pipe) {
+    pipe->m_bAbort = 1;
+    for (unsigned i = 0; i < 2; i++)
+        sem_post(&pipe->m_Free[i]);
+    pthread_join(pipe->m_Thread, 0);
+    for (unsigned i = 0; i < 2; i++) {
+        sem_destroy(&pipe->m_Free[i]);
+        sem_destroy(&pipe->m_Ready[i]);
+        WaveFree(&pipe->m_Wave[i]);
+    }
+}
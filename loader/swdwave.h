@@ -0,0 +1,119 @@
+//
+// swdwave.h
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _pico_swdwave_h
+#define _pico_swdwave_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define WAVE_NO_ACK (~0U)
+
+// One compiled DP/AP request
+struct TSWDWaveOp {
+    uint8_t m_nRequest;
+    uint32_t m_nData;     // data written, or data read after WaveDecode()
+    unsigned m_nAck;      // sample index of the ACK, WAVE_NO_ACK if streamed
+    unsigned m_nResponse; // ACK received, set by WaveDecode()
+};
+
+// A sequence of SWD transactions compiled into PlayWave() steps
+struct CSWDWave {
+    uint8_t* m_pSteps;
+    size_t m_nSteps;
+    size_t m_nMaxSteps;
+    uint32_t* m_pSamples;
+    unsigned m_nSamples;
+    size_t m_nMaxSamples;
+    struct TSWDWaveOp* m_pOps;
+    unsigned m_nOps;
+    size_t m_nMaxOps;
+};
+
+void WaveInit(struct CSWDWave* wave);
+void WaveFree(struct CSWDWave* wave);
+
+/// \brief Empty the wave, keeping its buffers
+void WaveReset(struct CSWDWave* wave);
+
+void WaveWriteBits(struct CSWDWave* wave, uint32_t nBits, unsigned nBitCount);
+/// \param bSample Record the levels read for WaveDecode()
+void WaveReadBits(struct CSWDWave* wave, unsigned nBitCount, int bSample);
+
+/// \brief Idle cycles ending with SWCLK and SWDIO low (WriteIdle())
+void WaveIdle(struct CSWDWave* wave);
+
+/// \brief Compile a write request
+/// \note The data phase is clocked whatever the ACK, which the target
+/// expects once CTRL/STAT.ORUNDETECT is set
+void WaveWriteData(struct CSWDWave* wave, uint8_t nRequest, uint32_t nData);
+
+/// \brief Compile a write request whose ACK is clocked but not sampled
+/// \note Only valid with CTRL/STAT.ORUNDETECT set, errors then show up as
+/// sticky flags in CTRL/STAT
+void WaveStreamData(struct CSWDWave* wave, uint8_t nRequest, uint32_t nData);
+
+/// \brief Compile a read request
+void WaveReadData(struct CSWDWave* wave, uint8_t nRequest);
+
+/// \brief Check ACKs and parity of a wave that has been played
+/// \return Index of the first failed request, or wave->m_nOps if all OK
+unsigned WaveDecode(struct CSWDWave* wave);
+
+/// \brief Fills a wave with the transactions of one block
+typedef void (*TWaveCompiler)(struct CSWDWave* wave, unsigned nBlock,
+                              void* pParam);
+
+// Double buffered waves, the next block is compiled by a producer thread
+// while the current one is clocked out
+struct CSWDWavePipe {
+    pthread_t m_Thread;
+    sem_t m_Free[2];
+    sem_t m_Ready[2];
+    struct CSWDWave m_Wave[2];
+    unsigned m_nBlocks;
+    unsigned m_nNext;
+    volatile int m_bAbort;
+    TWaveCompiler m_pCompile;
+    void* m_pParam;
+};
+
+/// \brief Start compiling nBlocks blocks
+/// \return Operation successful?
+int WavePipeStart(struct CSWDWavePipe* pipe, unsigned nBlocks,
+                  TWaveCompiler pCompile, void* pParam);
+
+/// \brief Wait for the next compiled block
+/// \return Wave to be played, 0 after the last block
+struct CSWDWave* WavePipeNext(struct CSWDWavePipe* pipe);
+
+/// \brief Hand a played wave back to the producer
+void WavePipeRelease(struct CSWDWavePipe* pipe, struct CSWDWave* wave);
+
+/// \brief Stop the producer (early or after the last block) and free waves
+void WavePipeStop(struct CSWDWavePipe* pipe);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
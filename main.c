@@ -14,55 +14,283 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
-#include <fcntl.h>
+#include <getopt.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/mman.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include "gpiospi.h"
+#include "gpiotrace.h"
+#include "swddaemon.h"
+#include "swdgang.h"
 #include "swdloader.h"
+#include "swdmanifest.h"
+#include "swdrealtime.h"
+#include "swdregs.h"
+#include "swdrtt.h"
+#include "swdstats.h"
+#include "swdtune.h"
 
 #define RAM_BASE 0x20000000u
 #define APROXIMATE_SWD_CLK_KHZ 500
+#define DUMP_CHUNK_SIZE 0x10000
+#define RTT_FIND_NANOS 10000000000ULL
+#define CLOCK_CACHE "swdloader-clock"
 
-static int fd = -1;
+enum { OPT_DUMP = 256, OPT_RTT, OPT_REALTIME, OPT_STATS, OPT_TRACE,
+       OPT_SPI, OPT_SIM_FAULTS };
+
+static const struct option s_LongOptions[] = {
+    {"dump", no_argument, 0, OPT_DUMP},
+    {"rtt", optional_argument, 0, OPT_RTT},
+    {"realtime", optional_argument, 0, OPT_REALTIME},
+    {"stats", required_argument, 0, OPT_STATS},
+    {"trace", required_argument, 0, OPT_TRACE},
+    {"spi", required_argument, 0, OPT_SPI},
+    {"sim-faults", required_argument, 0, OPT_SIM_FAULTS},
+    {0, 0, 0, 0}};
+
+static const char* s_CompressNames[] = {"auto", "off", "on"};
+
+static struct CSWDImage image;
 static int swdInitialized = 0;
 static struct CSWDLoader loader;
+static struct CSWDGang gang;
+static struct CGPIOSPI spi;
+static unsigned gangTargets = 0;
+static const char* daemonSocket = 0;
+static volatile sig_atomic_t streaming = 0, stopStreaming = 0;
+static struct CSWDRealtime realtime;
+static int realtimeEntered = 0;
 
 static void INThandler(int sig) {
+    if (streaming) {
+        // Ctrl-C ends RTT streaming, the session is closed normally
+        stopStreaming = 1;
+        return;
+    }
     signal(sig, SIG_IGN);
     fprintf(stderr, "\nInterrupted!\n");
-    if (swdInitialized)
-        SWDDeInitialise(&loader);
-    if (fd >= 0)
-        close(fd);
+    if (swdInitialized) {
+        if (gangTargets)
+            SWDGangDeInitialise(&gang);
+        else
+            SWDDeInitialise(&loader);
+    }
+    SWDImageFree(&image);
+    if (daemonSocket)
+        unlink(daemonSocket);
     exit(-1);
 }
 
+// Read target memory into a file, the core keeps running
+static int Dump(uint32_t address, uint32_t length, const char* fileName) {
+    FILE* file = fopen(fileName, "wb");
+    if (!file) {
+        fprintf(stderr, "Can't create %s\n", fileName);
+        return 0;
+    }
+    static uint32_t buffer[DUMP_CHUNK_SIZE / 4];
+    uint64_t start = TimingNow();
+    int ok = 1;
+    for (uint32_t offset = 0; ok && offset < length;
+         offset += DUMP_CHUNK_SIZE) {
+        uint32_t size = length - offset < DUMP_CHUNK_SIZE ? length - offset
+                                                          : DUMP_CHUNK_SIZE;
+        printf("\rReading @ 0x%08x", address + offset);
+        fflush(stdout);
+        ok = SWDReadBlock(&loader, address + offset, buffer, size) &&
+             fwrite(buffer, 1, size, file) == size;
+    }
+    if (fclose(file) != 0)
+        ok = 0;
+    if (!ok) {
+        fprintf(stderr, "\nDump to %s failed\n", fileName);
+        return 0;
+    }
+    double seconds = (TimingNow() - start) / 1e9;
+    printf("\n%u bytes read in %.2f seconds (%.1f KBytes/s)\n", length,
+           seconds, length / seconds / 1024.0);
+    return 1;
+}
+
+// Tuned rates are kept per user, in the XDG cache directory
+static int ClockCachePath(char* path, size_t size) {
+    const char* dir = getenv("XDG_CACHE_HOME");
+    if (dir && *dir)
+        return snprintf(path, size, "%s/" CLOCK_CACHE, dir) < (int)size;
+    dir = getenv("HOME");
+    if (!dir || !*dir)
+        return 0;
+    snprintf(path, size, "%s/.cache", dir);
+    mkdir(path, 0755);
+    return snprintf(path, size, "%s/.cache/" CLOCK_CACHE, dir) < (int)size;
+}
+
+// The latest pin events and requests as name.vcd, the requests alone as
+// name.swdtrace for swdbench -t
+#if defined(USE_SIMGPIO)
+// w,f,p,k as --sim-faults takes them, missing ones are 0
+static int ParseSimFaults(const char* list, struct TSimFaults* faults) {
+    unsigned* values[] = {&faults->m_nWaitEvery, &faults->m_nFaultEvery,
+                          &faults->m_nParityEvery, &faults->m_nMaxClockKHz};
+    char* p = (char*)list;
+    for (unsigned i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        *values[i] = strtoul(p, &p, 0);
+        if (!*p)
+            return 1;
+        if (*p++ != ',')
+            return 0;
+    }
+    return 0;
+}
+#endif
+
+static int WriteTrace(const char* name) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s.vcd", name);
+    int ok = GPIOTraceWriteVCD(path);
+    snprintf(path, sizeof(path), "%s.swdtrace", name);
+    ok = GPIOTraceWriteLog(path) && ok;
+    printf("Trace: %llu pin events, %llu requests written to %s.*\n",
+           (unsigned long long)g_GPIOTrace.m_Pins.m_nCount,
+           (unsigned long long)g_GPIOTrace.m_Requests.m_nCount, name);
+    GPIOTraceFree();
+    return ok;
+}
+
+// Copy RTT up buffer 0 of the running target to a file or stdout
+static int StreamRTT(const char* fileName) {
+    FILE* file = fileName ? fopen(fileName, "wb") : stdout;
+    if (!file) {
+        fprintf(stderr, "Can't create %s\n", fileName);
+        return 0;
+    }
+    struct CSWDRTT rtt;
+    int ok = SWDRTTFind(&loader, &rtt, SRAM_BASE, SRAM_END - SRAM_BASE,
+                        RTT_FIND_NANOS);
+    if (ok) {
+        streaming = 1;
+        ok = SWDRTTStream(&loader, &rtt, 0, file, &stopStreaming);
+        streaming = 0;
+        fprintf(stderr, "\n%llu RTT bytes received in %llu polls\n",
+                (unsigned long long)rtt.m_nBytes,
+                (unsigned long long)rtt.m_nPolls);
+    }
+    if (file != stdout && fclose(file) != 0)
+        ok = 0;
+    return ok;
+}
+
 int main(int ac, char* av[]) {
     signal(SIGINT, INThandler);
+    unsigned swdio_gpios[GANG_MAX_TARGETS] = {SWDIO_GPIO}, swdio_count = 1;
     int swdio_gpio = SWDIO_GPIO, swclk_gpio = SWCLK_GPIO,
         swrst_gpio = SWRST_GPIO, swfreq = APROXIMATE_SWD_CLK_KHZ, rc = -1;
+    enum TSWDVerify verify = SWDVerifyFirstWord;
+    enum TSWDCompress compress = SWDCompressAuto;
+    int delta = 0, multidrop = 0, dump = 0, rtt = 0;
+    const char* rttFile = 0;
+    const char* statsFile = 0;
+    const char* traceName = 0;
+    const char* spiDevice = 0;
+    const char* simFaults = 0;
+    int realtimeMode = 0, realtimeCPU = -1, autoClock = 0;
+    unsigned cachedKHz = 0;
+    char cachePath[512] = "", cacheKey[64];
+    uint32_t dumpAddress = 0, dumpLength = 0;
+    const char* requestSocket = 0;
     char* f_name;
     if (ac < 2) {
     help:
         fprintf(stderr,
-                "Usage: swdloader [-d n] [-c n] [-r n] [-f n] image_file_name\n"
-                " -d n  SWD Data IO GPIO # (default = %d)\n"
+                "Usage: swdloader [-d n[,n...]] [-c n] [-r n] [-f n|auto] "
+                "[-v policy] [-z mode] [-i] [-m] image_file_name\n"
+                "       swdloader [options] -D socket\n"
+                "       swdloader -s socket image_file_name\n"
+                "       swdloader [options] --dump address length file\n"
+                " -d n  SWD Data IO GPIO # (default = %d), a list loads up to "
+                "%d\n"
+                "       targets sharing SWD Clock and Reset at once (-v, -z "
+                "and -i\n"
+                "       don't apply)\n"
                 " -c n  SWD Clock GPIO # (default = %d)\n"
                 " -r n  SWD Reset GPIO # (default = %d)\n"
-                " -f n  SWD Clock Frequency in KHz (default = %d)\n",
-                swdio_gpio, swclk_gpio, swrst_gpio, swfreq);
+                " -f n  SWD Clock Frequency in KHz (default = %d), auto "
+                "raises it while\n"
+                "       link checks stay clean (cached per pin set)\n"
+                " -v p  Verify none, first (word of each block, default),\n"
+                "       sampled, full (read back) or crc (computed by the "
+                "target)\n"
+                " -z m  Upload compressed auto (if faster, default), off or "
+                "on\n"
+                " -i    Incremental, only load 1 KB blocks that differ in "
+                "target RAM\n"
+                " -m    Load every RP2040 DP instance found on a multidrop bus "
+                "(but core 1)\n"
+                " -D s  Stay connected and serve load, halt, start and read "
+                "requests\n"
+                "       on Unix socket s\n"
+                " -s s  Have the daemon on Unix socket s load the image\n"
+                " --dump a l f  Read l bytes of target memory at a into file "
+                "f, without\n"
+                "       halting the core\n"
+                " --rtt[=f]  Once started, stream RTT up buffer 0 of the "
+                "target to stdout\n"
+                "       or file f until Ctrl-C\n"
+                " --realtime[=n]  Load pinned to CPU n (default the last "
+                "isolated one),\n"
+                "       SCHED_FIFO, with memory locked\n"
+                " --stats=f  Write link counters and phase times to f at "
+                "exit, JSON or a\n"
+                "       Prometheus textfile (*.prom), - for JSON on stdout "
+                "(SWD_STATS builds)\n"
+                " --trace=n  Write the last pin events and SWD requests to "
+                "n.vcd and the\n"
+                "       requests to n.swdtrace at exit (SWD_TRACE builds)\n"
+                " --spi=dev  Shift load blocks through spidev device dev "
+                "(gpiomem: SWCLK\n"
+                "       GPIO%d, SWDIO GPIO%d, MOSI GPIO%d via a resistor to "
+                "SWDIO, sim: mock)\n"
+                " --sim-faults=w,f,p,k  Simulated target answers every wth "
+                "AP request\n"
+                "       WAIT, every fth FAULT, sends every pth read with a bad "
+                "parity bit\n"
+                "       and inverts reads above k KHz, 0 = never (sim "
+                "builds)\n"
+                "The image is an ELF or UF2 file, or a flat binary loaded "
+                "and started at\n"
+                "0x%08x. Images linked for flash (0x%08x) are programmed "
+                "into it\n"
+                "and the target is reset. A manifest (first line "
+                SWD_MANIFEST_MAGIC ") lists\n"
+                "images, their addresses and verify policies and the entry "
+                "point, all are\n"
+                "loaded in one session.\n",
+                swdio_gpio, GANG_MAX_TARGETS, swclk_gpio, swrst_gpio, swfreq,
+                SPI_SCLK_GPIO, SPI_MISO_GPIO, SPI_MOSI_GPIO, RAM_BASE,
+                XIP_BASE);
         exit(-1);
     }
     int opt;
 
-    while ((opt = getopt(ac, av, "d:c:r:f:")) != -1) {
+    while ((opt = getopt_long(ac, av, "d:c:r:f:v:z:imD:s:", s_LongOptions,
+                              0)) != -1) {
         switch (opt) {
-        case 'd':
-            swdio_gpio = atoi(optarg);
+        case 'd': {
+            char* p = optarg;
+            swdio_count = 0;
+            do {
+                if (swdio_count == GANG_MAX_TARGETS)
+                    goto help;
+                swdio_gpios[swdio_count++] = strtoul(p, &p, 0);
+            } while (*p++ == ',');
+            swdio_gpio = swdio_gpios[0];
             break;
+        }
         case 'c':
             swclk_gpio = atoi(optarg);
             break;
@@ -70,44 +298,166 @@ int main(int ac, char* av[]) {
             swrst_gpio = atoi(optarg);
             break;
         case 'f':
-            swfreq = atoi(optarg);
+            autoClock = !strcmp(optarg, "auto");
+            swfreq = autoClock ? TUNE_START_KHZ : atoi(optarg);
+            if (swfreq <= 0 || swfreq > (int)TIMING_MAX_KHZ)
+                goto help;
+            break;
+        case 'v':
+            for (verify = SWDVerifyNone; verify <= SWDVerifyCRC; verify++)
+                if (!strcmp(optarg, SWDVerifyName(verify)))
+                    break;
+            if (verify > SWDVerifyCRC)
+                goto help;
+            break;
+        case 'i':
+            delta = 1;
+            break;
+        case 'm':
+            multidrop = 1;
+            break;
+        case 'D':
+            daemonSocket = optarg;
+            break;
+        case 's':
+            requestSocket = optarg;
+            break;
+        case OPT_DUMP:
+            dump = 1;
+            break;
+        case OPT_RTT:
+            rtt = 1;
+            rttFile = optarg;
+            break;
+        case OPT_STATS:
+            statsFile = optarg;
+            break;
+        case OPT_TRACE:
+            traceName = optarg;
+            break;
+        case OPT_SPI:
+            spiDevice = optarg;
+            break;
+        case OPT_SIM_FAULTS:
+            simFaults = optarg;
+            break;
+        case OPT_REALTIME:
+            realtimeMode = 1;
+            if (optarg)
+                realtimeCPU = atoi(optarg);
+            break;
+        case 'z':
+            for (compress = SWDCompressAuto; compress <= SWDCompressOn;
+                 compress++)
+                if (!strcmp(optarg, s_CompressNames[compress]))
+                    break;
+            if (compress > SWDCompressOn)
+                goto help;
             break;
         default:
             goto help;
         }
     }
-    if (optind >= ac) {
+    if (dump) {
+        char *address, *length;
+        if (ac - optind != 3 || daemonSocket || requestSocket ||
+            multidrop || swdio_count > 1)
+            goto help;
+        dumpAddress = strtoul(av[optind], &address, 0);
+        dumpLength = strtoul(av[optind + 1], &length, 0);
+        if (*address || *length || (dumpAddress & 3) || (dumpLength & 3)) {
+            fprintf(stderr, "Address and length must be multiples of 4\n");
+            exit(-1);
+        }
+    } else if (optind >= ac && !daemonSocket) {
         fprintf(stderr, "image file name is required\n");
         goto help;
     }
     f_name = av[optind];
-
-    if (geteuid() != 0) {
-        fprintf(stderr, "swdloader needs root\n");
+    if (requestSocket) {
+        // the daemon may run in another directory
+        char* path = realpath(f_name, 0);
+        if (!path) {
+            fprintf(stderr, "Can't find %s\n", f_name);
+            exit(-1);
+        }
+        char request[DAEMON_MAX_REQUEST];
+        snprintf(request, sizeof(request), "load %s", path);
+        free(path);
+        return SWDDaemonRequest(requestSocket, request) ? 0 : -1;
+    }
+    if (rtt && (daemonSocket || dump || multidrop || swdio_count > 1)) {
+        fprintf(stderr, "--rtt is for a single target load\n");
         exit(-1);
     }
-
-    fd = open(f_name, 0);
-    if (fd < 0) {
-        fprintf(stderr, "Can't open %s\n", f_name);
+    if (autoClock && (dump || multidrop || swdio_count > 1)) {
+        // tuning halts the core and writes SRAM4
+        fprintf(stderr, "-f auto is for loading a single target\n");
         exit(-1);
     }
-    off_t f_size = lseek(fd, 0, SEEK_END);
-    if (f_size < 0) {
-        fprintf(stderr, "Can't get size of %s\n", f_name);
-        goto exit_fd;
+    if (statsFile && !SWD_STATS_ENABLED) {
+        fprintf(stderr, "Built without SWD_STATS, --stats is not available\n");
+        exit(-1);
     }
-    if ((f_size & 3) != 0) {
-        fprintf(stderr, "Image size must be multiple of 4\n");
-        goto exit_fd;
+    if (statsFile && swdio_count > 1) {
+        fprintf(stderr, "--stats is for a single SWDIO pin\n");
+        exit(-1);
     }
-    lseek(fd, 0, SEEK_SET);
-    printf("Image size %lu bytes (0x%08x-0x%08x)\n", f_size, RAM_BASE,
-           RAM_BASE + (unsigned int)f_size);
-    char* image = (char*)mmap(NULL, f_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (image == MAP_FAILED) {
-        fprintf(stderr, "Not enough memory\n");
-        goto exit_fd;
+    if (traceName && !GPIO_TRACE_ENABLED) {
+        fprintf(stderr, "Built without SWD_TRACE, --trace is not available\n");
+        exit(-1);
+    }
+#if defined(USE_SIMGPIO)
+    struct TSimFaults faults = {0};
+    if (simFaults && !ParseSimFaults(simFaults, &faults))
+        goto help;
+#else
+    if (simFaults) {
+        fprintf(stderr, "--sim-faults is for the sim build\n");
+        exit(-1);
+    }
+#endif
+    if (spiDevice && swdio_count > 1) {
+        fprintf(stderr, "--spi is for a single SWDIO pin\n");
+        exit(-1);
+    }
+    if (daemonSocket && (multidrop || swdio_count > 1)) {
+        fprintf(stderr, "The daemon serves a single target\n");
+        exit(-1);
+    }
+
+#if !defined(USE_SIMGPIO)
+    if (geteuid() != 0) {
+        fprintf(stderr, "swdloader needs root\n");
+        exit(-1);
+    }
+#endif
+
+    int (*load)(struct CSWDLoader*, const struct CSWDImage*) = SWDLoadImage;
+    if (daemonSocket)
+        signal(SIGTERM, INThandler);
+    else if (!dump) {
+        // ELF, UF2 or a flat binary loaded at RAM_BASE
+        if (!SWDImageRead(&image, f_name, RAM_BASE))
+            exit(-1);
+        printf("Image size %zu bytes, entry 0x%08x\n", image.m_nSize,
+               image.m_nEntry);
+        for (unsigned i = 0; i < image.m_nSegments; i++) {
+            const struct TSWDSegment* segment = &image.m_pSegments[i];
+            printf("  0x%08x-0x%08zx", segment->m_nAddress,
+                   segment->m_nAddress + segment->m_nSize);
+            if (segment->m_nVerify != SWD_VERIFY_LOADER)
+                printf(" (verify %s)", SWDVerifyName(segment->m_nVerify));
+            printf("\n");
+        }
+        // flash images are programmed, the others loaded into RAM and
+        // started
+        if (image.m_pSegments[0].m_nAddress < RAM_BASE)
+            load = SWDFlash;
+        if (load == SWDFlash && swdio_count > 1) {
+            fprintf(stderr, "Gang loading is for RAM images only\n");
+            goto exit_fd;
+        }
     }
 #if defined(USE_LIBPIGPIO)
     int cfg = gpioCfgGetInternals();
@@ -118,26 +468,151 @@ int main(int ac, char* av[]) {
         goto exit_fd;
     }
 #endif
+#if defined(USE_SIMGPIO)
+    for (unsigned i = 0; i < swdio_count; i++)
+        SimTargetSetFaults(SimTargetAttach(swclk_gpio, swdio_gpios[i],
+                                           swrst_gpio, SIM_TARGETSEL_CORE0),
+                           &faults);
+#endif
+    if (realtimeMode) {
+        // calibration and handshake under the same conditions as the load
+        RealtimeEnter(&realtime, realtimeCPU);
+        realtimeEntered = 1;
+        for (unsigned i = 0; i < image.m_nSegments; i++)
+            RealtimePrefault(image.m_pSegments[i].m_pData,
+                             image.m_pSegments[i].m_nSize);
+    }
+    if (traceName && !GPIOTraceStart()) {
+        traceName = 0;
+        goto exit_gang;
+    }
+    if (swdio_count > 1) {
+        // gang, every target has the whole image written and its first
+        // word per 1 KB block read back
+        printf("SWD clk = GPIO%d", swclk_gpio);
+        if (swrst_gpio)
+            printf(", rst = GPIO%d", swrst_gpio);
+        printf("\n");
+        gangTargets = swdio_count;
+        uint32_t loaded = SWDGangInitialise(&gang, swclk_gpio, swdio_gpios,
+                                            swdio_count, swrst_gpio, swfreq);
+        swdInitialized = 1;
+        if (loaded)
+            loaded = SWDGangLoad(&gang, &image);
+        for (unsigned i = 0; i < swdio_count; i++)
+            printf("Target %u (dio = GPIO%u): %s\n", i, swdio_gpios[i],
+                   loaded & (1U << i) ? "started" : "failed");
+        SWDGangDeInitialise(&gang);
+        rc = loaded == (1U << swdio_count) - 1 ? 0 : -1;
+        goto exit_gang;
+    }
     printf("SWD dio = GPIO%d, clk = GPIO%d", swdio_gpio, swclk_gpio);
     if (swrst_gpio)
         printf(", rst = GPIO%d", swrst_gpio);
     printf("\n");
-    if (!SWDInitialise(&loader, swclk_gpio, swdio_gpio, swrst_gpio, swfreq)) {
+    if (autoClock) {
+        snprintf(cacheKey, sizeof(cacheKey), "%s:clk%d:dio%d:rst%d",
+                 GPIO_BACKEND, swclk_gpio, swdio_gpio, swrst_gpio);
+        if (ClockCachePath(cachePath, sizeof(cachePath)))
+            cachedKHz = SWDTuneCacheRead(cachePath, cacheKey);
+        if (cachedKHz)
+            swfreq = cachedKHz;
+    }
+    if (!SWDInitialise(&loader, swclk_gpio, swdio_gpio, swrst_gpio, swfreq) &&
+        !cachedKHz) {
         fprintf(stderr, "Firmware init failed\n");
         goto exit_swd;
     }
     swdInitialized = 1;
-    if (!SWDLoad(&loader, image, f_size, RAM_BASE)) {
+    if (spiDevice) {
+        // the handshake is bit-banged, the blocks go through SPI
+        if (!SPIOpen(&spi, spiDevice, swclk_gpio, swdio_gpio, swfreq * 1000))
+            goto exit_swd;
+        loader.m_pSPI = &spi;
+    }
+    loader.m_Verify = verify;
+    loader.m_Compress = compress;
+    loader.m_bDelta = delta;
+    if (autoClock) {
+        // the cached rate is checked, and tuned again if it fails
+        unsigned tuned = cachedKHz;
+        if (cachedKHz && SWDCheckLink(&loader) && SWDTuneCheck(&loader))
+            printf("\nSWCLK %u KHz (cached)\n", cachedKHz);
+        else
+            tuned = SWDTuneClock(&loader, TUNE_START_KHZ, TUNE_MAX_KHZ);
+        if (!tuned) {
+            fprintf(stderr, "Firmware init failed\n");
+            goto exit_swd;
+        }
+        if (tuned != cachedKHz && *cachePath)
+            SWDTuneCacheWrite(cachePath, cacheKey, tuned);
+    }
+    if (dump) {
+        rc = Dump(dumpAddress, dumpLength, av[optind + 2]) ? 0 : -1;
+        goto exit_swd;
+    }
+    if (daemonSocket) {
+        rc = SWDDaemonRun(&loader, daemonSocket) ? 0 : -1;
+        daemonSocket = 0; // removed
+        goto exit_swd;
+    }
+    if (multidrop) {
+        // one session, each DP keeps its power-up and CSW state
+        unsigned targets = SWDScan(&loader, DP_TARGETSEL_CPUAPID_SUPPORTED);
+        unsigned failed = 0;
+        for (unsigned i = 0; i < targets; i++) {
+            unsigned instance = loader.m_Targets[i].m_nTargetSel >>
+                                DP_TARGETSEL_TINSTANCE__SHIFT;
+            // same chip as the core 0 DP
+            if (instance == DP_TARGETSEL_TINSTANCE_CORE1)
+                continue;
+            printf("Loading DP instance %u\n", instance);
+            if (!SWDSelectTarget(&loader, i) ||
+                !load(&loader, &image)) {
+                fprintf(stderr, "Firmware load failed (DP instance %u)\n",
+                        instance);
+                failed++;
+            }
+        }
+        SWDReportRetries(&loader, stdout);
+        if (targets && !failed)
+            rc = 0;
+        goto exit_swd;
+    }
+    // also when failed, a fixture that needs retries is worth knowing about
+    int loaded = load(&loader, &image);
+    SWDReportRetries(&loader, stdout);
+    if (!loaded) {
         fprintf(stderr, "Firmware load failed\n");
         goto exit_swd;
     }
     rc = 0;
+    if (realtimeEntered) {
+        // polls mostly sleep
+        RealtimeLeave(&realtime);
+        realtimeEntered = 0;
+    }
+    if (rtt && !StreamRTT(rttFile))
+        rc = -1;
 exit_swd:
+    if (statsFile && !SWDStatsWrite(&loader, statsFile))
+        rc = -1;
+    if (loader.m_pSPI) {
+        printf("SPI: %llu messages, %llu bytes\n",
+               (unsigned long long)spi.m_nMessages,
+               (unsigned long long)spi.m_nBytes);
+        SPIClose(&spi);
+    }
     SWDDeInitialise(&loader);
+exit_gang:
+    if (traceName && !WriteTrace(traceName))
+        rc = -1;
+    if (realtimeEntered)
+        RealtimeLeave(&realtime);
 #if defined(USE_LIBPIGPIO)
     gpioTerminate();
 #endif
 exit_fd:
-    close(fd);
+    SWDImageFree(&image);
     return rc;
 }
@@ -0,0 +1,222 @@
+//
+// gpiomemtest.c
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gpiopin.h"
+
+// The gpiomem backend against a buffer in place of /dev/gpiomem, checks
+// the register words it leaves behind: gpiomemtest name
+
+// BCM283x/BCM2711 GPIO register word offsets, as in gpiopin.c
+#define GPFSEL0 (0x00 / 4)
+#define GPSET0 (0x1C / 4)
+#define GPCLR0 (0x28 / 4)
+#define GPLEV0 (0x34 / 4)
+#define GPPUD (0x94 / 4)
+#define GPPUDCLK0 (0x98 / 4)
+#define GPIO_PUP_PDN_CNTRL_REG0 (0xE4 / 4)
+
+#define CLOCK_PIN 25 // GPFSEL2, bits 15-17
+#define DATA_PIN 24  // GPFSEL2, bits 12-14
+#define PULL_PIN 23  // GPPUDCLK0 bit 23, GPIO_PUP_PDN_CNTRL_REG1 bits 14-15
+#define HIGH_PIN 40  // bank 1, GPFSEL4 bits 0-2
+
+#define MAX_SNAPS 8
+
+static uint32_t s_Regs[GPIOMEM_BLOCK_SIZE / 4];
+
+// The legacy pull sequence waits between its writes, the register words
+// are recorded there
+static struct {
+    uint32_t m_nPUD;
+    uint32_t m_nPUDClk;
+} s_Snaps[MAX_SNAPS];
+static unsigned s_nSnaps;
+
+int usleep(useconds_t usec) {
+    (void)usec;
+    if (s_nSnaps < MAX_SNAPS) {
+        s_Snaps[s_nSnaps].m_nPUD = s_Regs[GPPUD];
+        s_Snaps[s_nSnaps].m_nPUDClk = s_Regs[GPPUDCLK0];
+    }
+    s_nSnaps++;
+    return 0;
+}
+
+static int Check(const char* pWhat, uint32_t nValue, uint32_t nExpected) {
+    if (nValue == nExpected)
+        return 1;
+    fprintf(stderr, "%s is 0x%08x, expected 0x%08x\n", pWhat, nValue,
+            nExpected);
+    return 0;
+}
+
+static unsigned FSel(unsigned nPin) {
+    return (s_Regs[GPFSEL0 + nPin / 10] >> (nPin % 10) * 3) & GPFSEL_MASK;
+}
+
+static void ClearSetClr(void) {
+    s_Regs[GPSET0] = s_Regs[GPSET0 + 1] = 0;
+    s_Regs[GPCLR0] = s_Regs[GPCLR0 + 1] = 0;
+}
+
+// Function selects, the other fields of a GPFSELn are left alone
+static int TestMode(void) {
+    s_Regs[GPFSEL0 + 2] = 0x3F000FFF; // pins 20-23 and 28-29 alternate
+    struct CGPIOPin pin;
+    InitPin(&pin, CLOCK_PIN, GPIOModeOutput);
+    int bOK = Check("GPFSEL2", s_Regs[GPFSEL0 + 2], 0x3F008FFF) &&
+              Check("GPCLR0", s_Regs[GPCLR0], 1U << CLOCK_PIN);
+    SetModePin(&pin, GPIOModeInputPullNone, 0);
+    bOK = bOK && Check("GPFSEL2", s_Regs[GPFSEL0 + 2], 0x3F000FFF);
+    SetFunctionPin(&pin, GPFSEL_ALT0);
+    bOK = bOK && Check("pin function", FSel(CLOCK_PIN), GPFSEL_ALT0);
+    // not skipped, the mode before the peripheral had it is still recorded
+    SetModePin(&pin, GPIOModeInputPullNone, 0);
+    bOK = bOK && Check("pin function", FSel(CLOCK_PIN), GPFSEL_INPUT) &&
+          Check("GPFSEL2", s_Regs[GPFSEL0 + 2], 0x3F000FFF);
+    DeInitPin(&pin);
+    return bOK;
+}
+
+// Single writes and reads, one bank 0 and one bank 1 pin
+static int TestWrite(void) {
+    struct CGPIOPin pin, high;
+    InitPin(&pin, CLOCK_PIN, GPIOModeOutput);
+    InitPin(&high, HIGH_PIN, GPIOModeOutput);
+    int bOK = Check("GPFSEL4", s_Regs[GPFSEL0 + 4], GPFSEL_OUTPUT);
+    ClearSetClr();
+    WritePin(&pin, HIGH);
+    bOK = bOK && Check("GPSET0", s_Regs[GPSET0], 1U << CLOCK_PIN) &&
+          Check("GPCLR0", s_Regs[GPCLR0], 0);
+    ClearSetClr();
+    WritePin(&pin, LOW);
+    bOK = bOK && Check("GPCLR0", s_Regs[GPCLR0], 1U << CLOCK_PIN) &&
+          Check("GPSET0", s_Regs[GPSET0], 0);
+    ClearSetClr();
+    WritePin(&high, HIGH);
+    bOK = bOK && Check("GPSET1", s_Regs[GPSET0 + 1], 1U << (HIGH_PIN - 32)) &&
+          Check("GPSET0", s_Regs[GPSET0], 0);
+    SetModePin(&pin, GPIOModeInputPullNone, 0);
+    s_Regs[GPLEV0] = 1U << CLOCK_PIN;
+    bOK = bOK && Check("ReadPin()", ReadPin(&pin), HIGH);
+    s_Regs[GPLEV0] = ~(1U << CLOCK_PIN);
+    bOK = bOK && Check("ReadPin()", ReadPin(&pin), LOW);
+    DeInitPin(&high);
+    DeInitPin(&pin);
+    return bOK;
+}
+
+// One set and one clear word per bank for a pin set
+static int TestWritePins(void) {
+    struct CGPIOPin clock, data, high;
+    struct CGPIOPin* ppPins[] = {&clock, &data, &high};
+    const unsigned Pins[] = {CLOCK_PIN, DATA_PIN, HIGH_PIN};
+    InitPins(ppPins, Pins, 3, GPIOModeOutput);
+    ClearSetClr();
+    WritePins(ppPins, 3, 0x5); // clock and high pin high, data low
+    int bOK = Check("GPSET0", s_Regs[GPSET0], 1U << CLOCK_PIN) &&
+              Check("GPCLR0", s_Regs[GPCLR0], 1U << DATA_PIN) &&
+              Check("GPSET1", s_Regs[GPSET0 + 1], 1U << (HIGH_PIN - 32)) &&
+              Check("GPCLR1", s_Regs[GPCLR0 + 1], 0);
+    ClearSetClr();
+    WritePins(ppPins, 2, 0x2);
+    bOK = bOK && Check("GPSET0", s_Regs[GPSET0], 1U << DATA_PIN) &&
+          Check("GPCLR0", s_Regs[GPCLR0], 1U << CLOCK_PIN) &&
+          Check("GPSET1", s_Regs[GPSET0 + 1], 0) &&
+          Check("GPCLR1", s_Regs[GPCLR0 + 1], 0);
+    SetModePins(ppPins, 3, GPIOModeInputPullNone);
+    s_Regs[GPLEV0] = 1U << DATA_PIN;
+    s_Regs[GPLEV0 + 1] = 1U << (HIGH_PIN - 32);
+    bOK = bOK && Check("ReadPins()", ReadPins(ppPins, 3), 0x6);
+    for (unsigned i = 0; i < 3; i++)
+        DeInitPin(ppPins[i]);
+    return bOK;
+}
+
+#if defined(GPIOMEM_BCM2711)
+
+// Two bits per pin in GPIO_PUP_PDN_CNTRL_REGn, written directly
+static int TestPull(void) {
+    volatile uint32_t* pReg = s_Regs + GPIO_PUP_PDN_CNTRL_REG0 + PULL_PIN / 16;
+    *pReg = 0xAAAAAAAA; // all pull down
+    struct CGPIOPin pin;
+    InitPin(&pin, PULL_PIN, GPIOModeInputPullUp);
+    int bOK = Check("GPIO_PUP_PDN_CNTRL_REG1", *pReg, 0xAAAA6AAA) &&
+              Check("waits", s_nSnaps, 0);
+    SetModePin(&pin, GPIOModeInputPullNone, 1);
+    bOK = bOK && Check("GPIO_PUP_PDN_CNTRL_REG1", *pReg, 0xAAAA2AAA);
+    DeInitPin(&pin);
+    return bOK && Check("GPPUD", s_Regs[GPPUD], 0) &&
+           Check("GPPUDCLK0", s_Regs[GPPUDCLK0], 0);
+}
+
+#else
+
+// GPPUD is clocked into the pin by GPPUDCLK0, then both are cleared
+static int CheckPullSequence(uint32_t nPUD) {
+    int bOK = Check("waits", s_nSnaps, 2) &&
+              Check("GPPUD", s_Snaps[0].m_nPUD, nPUD) &&
+              Check("GPPUDCLK0", s_Snaps[0].m_nPUDClk, 0) &&
+              Check("GPPUD", s_Snaps[1].m_nPUD, nPUD) &&
+              Check("GPPUDCLK0", s_Snaps[1].m_nPUDClk, 1U << PULL_PIN) &&
+              Check("GPPUD", s_Regs[GPPUD], 0) &&
+              Check("GPPUDCLK0", s_Regs[GPPUDCLK0], 0);
+    s_nSnaps = 0;
+    return bOK;
+}
+
+static int TestPull(void) {
+    struct CGPIOPin pin;
+    InitPin(&pin, PULL_PIN, GPIOModeInputPullUp);
+    int bOK = CheckPullSequence(2);
+    SetModePin(&pin, GPIOModeInputPullNone, 1);
+    bOK = bOK && CheckPullSequence(0);
+    SetModePin(&pin, GPIOModeInputPullUp, 0); // no init, no sequence
+    bOK = bOK && Check("waits", s_nSnaps, 0) &&
+          Check("GPIO_PUP_PDN_CNTRL_REG1",
+                s_Regs[GPIO_PUP_PDN_CNTRL_REG0 + 1], 0);
+    DeInitPin(&pin);
+    return bOK;
+}
+
+#endif
+
+static const struct {
+    const char* m_pName;
+    int (*m_pTest)(void);
+} s_Tests[] = {{"mode", TestMode},
+               {"write", TestWrite},
+               {"writepins", TestWritePins},
+               {"pull", TestPull}};
+
+#define TESTS (sizeof(s_Tests) / sizeof(s_Tests[0]))
+
+int main(int ac, char* av[]) {
+    for (unsigned i = 0; ac == 2 && i < TESTS; i++) {
+        if (strcmp(av[1], s_Tests[i].m_pName))
+            continue;
+        SetGPIOMemBuffer(s_Regs);
+        int bOK = s_Tests[i].m_pTest();
+        printf("%s: %s\n", av[1], bOK ? "passed" : "FAILED");
+        return bOK ? 0 : 1;
+    }
+    fprintf(stderr, "Usage: gpiomemtest name\n");
+    return 2;
+}
@@ -0,0 +1,196 @@
+//
+// swdsimtest.c
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <stdio.h>
+#include <string.h>
+
+#include "swdloader.h"
+#include "swdtune.h"
+
+// Loader checks against the simulated target, one per process as the sim
+// keeps its targets in globals: swdsimtest name
+
+#define RAM_BASE 0x20000000u
+#define TEST_KHZ 4000
+#define TEST_WORDS (24 * 1024 / 4)
+#define TEST_BLOCK_WORDS (1024 / 4)
+#define RESUME_BLOCK 16   // of 24
+#define RESUME_FAULTS 4   // one per play of the block, all of them fail
+#define TUNE_LIMIT_KHZ 2000 // unlimited the sim is clean up to TUNE_MAX_KHZ
+
+static struct CSimTarget* s_pTarget;
+
+static int Connect(struct CSWDLoader* loader,
+                   const struct TSimFaults* pFaults, unsigned nKHz) {
+    s_pTarget = SimTargetAttach(SWCLK_GPIO, SWDIO_GPIO, SWRST_GPIO,
+                                SIM_TARGETSEL_CORE0);
+    SimTargetSetFaults(s_pTarget, pFaults);
+    if (!SWDInitialise(loader, SWCLK_GPIO, SWDIO_GPIO, SWRST_GPIO, nKHz)) {
+        fprintf(stderr, "Cannot connect to the sim\n");
+        return 0;
+    }
+    return 1;
+}
+
+// A program that waits in a branch to itself at its entry, followed by
+// incompressible data
+static void MakeProgram(uint32_t* pProgram, unsigned nWords, uint32_t nSeed) {
+    uint32_t nState = nSeed;
+    pProgram[0] = 0xE7FEE7FE; // b .
+    for (unsigned i = 1; i < nWords; i++) {
+        nState ^= nState << 13;
+        nState ^= nState >> 17;
+        nState ^= nState << 5;
+        pProgram[i] = nState;
+    }
+}
+
+// The program is in target SRAM
+static int CheckMemory(const uint32_t* pProgram, unsigned nWords) {
+    for (unsigned i = 0; i < nWords; i++) {
+        uint32_t nAddress = RAM_BASE + i * 4;
+        const uint32_t* pWord = SimTargetMemory(s_pTarget, nAddress);
+        if (!pWord || *pWord != pProgram[i]) {
+            fprintf(stderr, "Target memory differs @ 0x%08x\n", nAddress);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// A RAM program is loaded and started
+static int TestLoad(void) {
+    static uint32_t Program[TEST_WORDS];
+    MakeProgram(Program, TEST_WORDS, 0x2545F491);
+    struct TSimFaults faults = {0};
+    struct CSWDLoader loader;
+    int bOK = Connect(&loader, &faults, TEST_KHZ) &&
+              SWDLoad(&loader, Program, sizeof(Program), RAM_BASE) &&
+              CheckMemory(Program, TEST_WORDS);
+    if (bOK && !SimTargetRunning(s_pTarget)) {
+        fprintf(stderr, "Target not started\n");
+        bOK = 0;
+    }
+    SWDDeInitialise(&loader);
+    return bOK;
+}
+
+// Now and then WAIT, FAULT and bad parity: each is retried in the phase it
+// occurred in and the load still verifies
+static int TestFaults(void) {
+    static uint32_t Program[TEST_WORDS];
+    MakeProgram(Program, TEST_WORDS, 0x2545F491);
+    // longer than a block, a streamed block is replayed whole
+    struct TSimFaults faults = {400, 700, 5, 0, 0, 0};
+    struct CSWDLoader loader;
+    int bOK = Connect(&loader, &faults, TEST_KHZ);
+    loader.m_Compress = SWDCompressOff;
+    loader.m_Verify = SWDVerifyCRC;
+    bOK = bOK && SWDLoad(&loader, Program, sizeof(Program), RAM_BASE) &&
+          CheckMemory(Program, TEST_WORDS);
+    SWDReportRetries(&loader, stdout);
+    uint64_t nParity = 0;
+    for (unsigned i = 0; i < SWDPhases; i++)
+        nParity += loader.m_Retries[i].m_nParity;
+    const struct TSWDRetries* load = &loader.m_Retries[SWDPhaseLoad];
+    if (bOK && (!load->m_nWaits || !load->m_nFaults || !nParity)) {
+        fprintf(stderr, "Injected faults not counted\n");
+        bOK = 0;
+    }
+    SWDDeInitialise(&loader);
+    return bOK;
+}
+
+// A block that keeps failing is resumed at, the blocks before it are not
+// written again
+static int TestResume(void) {
+    static uint32_t Program[TEST_WORDS];
+    struct TSimFaults faults = {0};
+    struct CSWDLoader loader;
+    int bOK = Connect(&loader, &faults, TEST_KHZ) && SWDHalt(&loader);
+    loader.m_nTransactions = 0;
+    MakeProgram(Program, TEST_WORDS, 0x2545F491);
+    bOK = bOK && SWDLoadChunk(&loader, Program, sizeof(Program), RAM_BASE);
+    uint64_t nClean = loader.m_nTransactions;
+    faults.m_nBadAddress = RAM_BASE + RESUME_BLOCK * 1024 + 8;
+    faults.m_nBadWrites = RESUME_FAULTS;
+    SimTargetSetFaults(s_pTarget, &faults);
+    loader.m_nTransactions = 0;
+    MakeProgram(Program, TEST_WORDS, 0x9E3779B9);
+    bOK = bOK && SWDLoadChunk(&loader, Program, sizeof(Program), RAM_BASE) &&
+          CheckMemory(Program, TEST_WORDS);
+    SWDReportRetries(&loader, stdout);
+    uint64_t nExtra = loader.m_nTransactions - nClean;
+    printf("%llu transactions more than without faults\n",
+           (unsigned long long)nExtra);
+    if (bOK && !loader.m_Retries[SWDPhaseLoad].m_nResumes) {
+        fprintf(stderr, "Load not resumed\n");
+        bOK = 0;
+    }
+    // restarting at block 0 would write RESUME_BLOCK blocks again
+    if (bOK && nExtra >= RESUME_BLOCK * TEST_BLOCK_WORDS) {
+        fprintf(stderr, "Load not resumed at block %u\n", RESUME_BLOCK);
+        bOK = 0;
+    }
+    SWDDeInitialise(&loader);
+    return bOK;
+}
+
+// -f auto backs off from rates the target cannot follow and loads at the
+// rate it settled at
+static int TestTune(void) {
+    static uint32_t Program[TEST_WORDS];
+    MakeProgram(Program, TEST_WORDS, 0x2545F491);
+    struct TSimFaults faults = {0, 0, 0, TUNE_LIMIT_KHZ, 0, 0};
+    struct CSWDLoader loader;
+    // as swdloader -f auto does
+    int bOK = Connect(&loader, &faults, TUNE_START_KHZ) && SWDHalt(&loader);
+    unsigned nKHz =
+        bOK ? SWDTuneClock(&loader, TUNE_START_KHZ, TUNE_MAX_KHZ) : 0;
+    printf("Settled at %u KHz, limit %u KHz\n", nKHz, TUNE_LIMIT_KHZ);
+    if (bOK && (nKHz <= TUNE_START_KHZ || nKHz > TUNE_LIMIT_KHZ)) {
+        fprintf(stderr, "Not settled within %u-%u KHz\n", TUNE_START_KHZ,
+                TUNE_LIMIT_KHZ);
+        bOK = 0;
+    }
+    bOK = bOK && SWDLoad(&loader, Program, sizeof(Program), RAM_BASE) &&
+          CheckMemory(Program, TEST_WORDS);
+    SWDDeInitialise(&loader);
+    return bOK;
+}
+
+static const struct {
+    const char* m_pName;
+    int (*m_pTest)(void);
+} s_Tests[] = {
+    {"load", TestLoad},
+    {"faults", TestFaults},
+    {"resume", TestResume},
+    {"tune", TestTune}};
+
+#define TESTS (sizeof(s_Tests) / sizeof(s_Tests[0]))
+
+int main(int ac, char* av[]) {
+    for (unsigned i = 0; ac == 2 && i < TESTS; i++) {
+        if (strcmp(av[1], s_Tests[i].m_pName))
+            continue;
+        int bOK = s_Tests[i].m_pTest();
+        printf("\n%s: %s\n", av[1], bOK ? "passed" : "FAILED");
+        return bOK ? 0 : 1;
+    }
+    fprintf(stderr, "Usage: swdsimtest name\n");
+    return 2;
+}